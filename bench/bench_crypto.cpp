@@ -0,0 +1,123 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <sodium/crypto_sign.h>
+#include <scout.hpp>
+#include <utils.hpp>
+
+using namespace scout;
+
+namespace
+{
+	secret_key make_secret()
+	{
+		secret_key sk;
+		for (std::size_t i = 0; i < sk.size(); ++i) sk[i] = gsl::byte(i);
+		return sk;
+	}
+
+	// the sizes of a sealed list of entries range up to the 1000 byte limit
+	// of a DHT item
+	void buffer_args(benchmark::internal::Benchmark* b)
+	{
+		b->Arg(64)->Arg(256)->Arg(960);
+	}
+}
+
+static void encrypt(benchmark::State& state)
+{
+	secret_key sk = make_secret();
+	std::vector<char> const plaintext(state.range(0), 'x');
+
+	for (auto _ : state)
+	{
+		auto ciphertext = encrypt_buffer(plaintext, sk);
+		benchmark::DoNotOptimize(ciphertext.data());
+	}
+	state.SetBytesProcessed(state.iterations() * plaintext.size());
+}
+BENCHMARK(encrypt)->Apply(buffer_args);
+
+static void decrypt(benchmark::State& state)
+{
+	secret_key sk = make_secret();
+	std::vector<char> const ciphertext = encrypt_buffer(std::vector<char>(state.range(0), 'x'), sk);
+
+	for (auto _ : state)
+	{
+		auto plaintext = decrypt_buffer(ciphertext, sk);
+		benchmark::DoNotOptimize(plaintext.data());
+	}
+	state.SetBytesProcessed(state.iterations() * ciphertext.size());
+}
+BENCHMARK(decrypt)->Apply(buffer_args);
+
+static void sha1(benchmark::State& state)
+{
+	std::vector<byte> const buffer(state.range(0), 0x5a);
+
+	for (auto _ : state)
+	{
+		sha1_hash h = sha1_fun(buffer.data(), int(buffer.size()));
+		benchmark::DoNotOptimize(h);
+	}
+	state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(sha1)->Arg(20)->Arg(256)->Arg(1000);
+
+static void push_front(benchmark::State& state)
+{
+	std::vector<gsl::byte> const msg(state.range(0), gsl::byte(0x5a));
+	list_head head;
+
+	for (auto _ : state)
+	{
+		list_token token = head.push_front(gsl::as_span(msg));
+		benchmark::DoNotOptimize(token);
+	}
+}
+BENCHMARK(push_front)->Arg(16)->Arg(256)->Arg(900);
+
+static void ecdh_key_exchange(benchmark::State& state)
+{
+	auto alice = generate_keypair();
+	auto bob = generate_keypair();
+
+	for (auto _ : state)
+	{
+		secret_key shared = key_exchange(alice.first, bob.second);
+		benchmark::DoNotOptimize(shared);
+	}
+}
+BENCHMARK(ecdh_key_exchange);
+
+// synchronize derives the DHT target keypair from the shared secret on
+// every call
+static void seed_keypair(benchmark::State& state)
+{
+	secret_key const seed = make_secret();
+	std::array<unsigned char, crypto_sign_PUBLICKEYBYTES> pk;
+	std::array<unsigned char, crypto_sign_SECRETKEYBYTES> sk;
+
+	for (auto _ : state)
+	{
+		crypto_sign_seed_keypair(pk.data(), sk.data(), (unsigned char const*)seed.data());
+		benchmark::DoNotOptimize(pk.data());
+	}
+}
+BENCHMARK(seed_keypair);
@@ -0,0 +1,104 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <scout.hpp>
+#include <utils.hpp>
+#include "alloc_counter.hpp"
+#include "fake_dht.h"
+
+using namespace scout;
+
+// The cost of moving an entry vector through one synchronize, from the
+// caller to the stored blob, against a DHT which does nothing itself. The
+// allocs and alloc_bytes counters are per synchronize.
+
+namespace
+{
+	// the entries are stored as one item of at most this many bytes
+	int const item_size = 1000;
+
+	std::vector<entry> make_entries(int count, int size)
+	{
+		std::vector<gsl::byte> contents(size, gsl::byte(0x5a));
+		std::vector<entry> entries;
+		for (int i = 0; i < count; ++i)
+		{
+			entries.emplace_back(std::uint32_t(i));
+			entries.back().assign(gsl::as_span(contents));
+		}
+		return entries;
+	}
+
+	// the blob the DHT answers with: our entries, half of them newer
+	std::vector<char> dht_blob(std::vector<entry> entries, secret_key_span key)
+	{
+		for (std::size_t i = 0; i < entries.size(); i += 2)
+			entries[i].update_seq(entries[i].seq() + 1);
+		return entries_blob(entries, key);
+	}
+
+	// a few entries, and as many as fit in the item: 31 of 16 bytes or 12
+	// of 64 bytes
+	void entry_args(benchmark::internal::Benchmark* b)
+	{
+		for (int size : { 16, 64 })
+		{
+			int const fit = int((item_size - sizeof(entries_header))
+				/ (sizeof(entry_header) + size));
+			for (int count : { 8, fit })
+				b->Args({ count, size });
+		}
+	}
+}
+
+static void synchronize_entries(benchmark::State& state)
+{
+	int const count = int(state.range(0));
+	int const size = int(state.range(1));
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	secret_key key;
+	key.fill(gsl::byte(7));
+	std::vector<entry> const entries = make_entries(count, size);
+	fake_dht.putDataCallbackBuffer = dht_blob(entries, key);
+	int updated = 0;
+
+	std::uint64_t allocs = 0;
+	std::uint64_t bytes = 0;
+	for (auto _ : state)
+	{
+		// the caller's copy is made outside of the measurement
+		state.PauseTiming();
+		std::vector<entry> mine = entries;
+		state.ResumeTiming();
+
+		std::uint64_t const start = thread_allocations();
+		std::uint64_t const start_bytes = thread_allocated_bytes();
+		synchronize(fake_dht, key, std::move(mine)
+			, [&updated](entry const&) { ++updated; }
+			, [](std::vector<entry>& e) { benchmark::DoNotOptimize(e.data()); }
+			, [] {});
+		allocs += thread_allocations() - start;
+		bytes += thread_allocated_bytes() - start_bytes;
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["allocs"] = double(allocs) / state.iterations();
+	state.counters["alloc_bytes"] = double(bytes) / state.iterations();
+	benchmark::DoNotOptimize(updated);
+}
+BENCHMARK(synchronize_entries)->Apply(entry_args);
@@ -0,0 +1,134 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <scout.hpp>
+#include <utils.hpp>
+
+using namespace scout;
+
+namespace
+{
+	// a list of entries with the given number of entries and content size
+	std::vector<entry> make_entries(int count, int size)
+	{
+		std::vector<gsl::byte> contents(size, gsl::byte(0x5a));
+		std::vector<entry> entries;
+		for (int i = 0; i < count; ++i)
+		{
+			entries.emplace_back(std::uint32_t(i));
+			entries.back().assign(gsl::as_span(contents));
+		}
+		return entries;
+	}
+
+	// upper bound on the serialized size of a list of entries
+	std::size_t buffer_size(int count, int size)
+	{
+		return sizeof(entries_header) + count * (sizeof(entry_header) + size);
+	}
+
+	// entry counts (up to the 255 which fit in the header) by content sizes
+	// (up to the 255 bytes which fit in an entry)
+	void entry_args(benchmark::internal::Benchmark* b)
+	{
+		for (int count : { 1, 8, 64, 255 })
+			for (int size : { 16, 64, 255 })
+				b->Args({ count, size });
+	}
+}
+
+static void serialize_entries(benchmark::State& state)
+{
+	int const count = int(state.range(0));
+	int const size = int(state.range(1));
+	std::vector<entry> const entries = make_entries(count, size);
+	std::vector<gsl::byte> buffer(buffer_size(count, size));
+
+	for (auto _ : state)
+	{
+		auto residue = serialize(entries, gsl::as_span(buffer));
+		benchmark::DoNotOptimize(residue.data());
+	}
+	state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(serialize_entries)->Apply(entry_args);
+
+static void parse_entries(benchmark::State& state)
+{
+	int const count = int(state.range(0));
+	int const size = int(state.range(1));
+	std::vector<gsl::byte> buffer(buffer_size(count, size));
+	serialize(make_entries(count, size), gsl::as_span(buffer));
+
+	std::vector<entry> entries;
+	for (auto _ : state)
+	{
+		entries.clear();
+		parse(gsl::as_span(buffer), entries);
+		benchmark::DoNotOptimize(entries.data());
+	}
+	state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(parse_entries)->Apply(entry_args);
+
+static void entry_parse(benchmark::State& state)
+{
+	int const size = int(state.range(0));
+	std::vector<gsl::byte> buffer(sizeof(entry_header) + size);
+	make_entries(1, size)[0].serialize(gsl::as_span(buffer));
+
+	for (auto _ : state)
+	{
+		auto parsed = entry::parse(gsl::as_span(buffer));
+		benchmark::DoNotOptimize(parsed.first.value().data());
+	}
+	state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(entry_parse)->Arg(0)->Arg(16)->Arg(64)->Arg(255);
+
+static void dht_blob_write(benchmark::State& state)
+{
+	std::vector<gsl::byte> const msg(state.range(0), gsl::byte(0x5a));
+	hash next;
+	next.fill(gsl::byte(1));
+
+	for (auto _ : state)
+	{
+		auto blob = message_dht_blob_write(gsl::as_span(msg), next);
+		benchmark::DoNotOptimize(blob.data());
+	}
+	state.SetBytesProcessed(state.iterations() * msg.size());
+}
+BENCHMARK(dht_blob_write)->Arg(16)->Arg(256)->Arg(900);
+
+static void dht_blob_read(benchmark::State& state)
+{
+	std::vector<gsl::byte> const msg(state.range(0), gsl::byte(0x5a));
+	hash next;
+	next.fill(gsl::byte(1));
+	std::vector<gsl::byte> const blob = message_dht_blob_write(gsl::as_span(msg), next);
+
+	for (auto _ : state)
+	{
+		hash read_next;
+		auto contents = message_dht_blob_read(gsl::as_span(blob), read_next);
+		benchmark::DoNotOptimize(contents.data());
+	}
+	state.SetBytesProcessed(state.iterations() * blob.size());
+}
+BENCHMARK(dht_blob_read)->Arg(16)->Arg(256)->Arg(900);
@@ -0,0 +1,230 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <benchmark/benchmark.h>
+
+#include <histogram.hpp>
+#include <scout.hpp>
+#include <utils.hpp>
+#include "sim_dht.hpp"
+
+using namespace scout;
+
+// End-to-end benchmarks of scout's requests against a simulated DHT. The
+// benchmark time is the CPU cost of driving the simulation, while the
+// latency counters are in virtual milliseconds as seen by the application.
+
+namespace
+{
+	int const batch = 64;
+
+	// arguments are the number of nodes and the packet loss in per mille
+	void network_args(benchmark::internal::Benchmark* b)
+	{
+		for (int nodes : { 1000, 10000 })
+			for (int loss : { 0, 50 })
+				b->Args({ nodes, loss });
+		b->Unit(benchmark::kMillisecond);
+	}
+
+	sim_config make_config(benchmark::State const& state)
+	{
+		sim_config cfg;
+		cfg.nodes = int(state.range(0));
+		cfg.loss = state.range(1) / 1000.0;
+		return cfg;
+	}
+
+	// records the virtual time from now until the returned function is called
+	std::function<void()> time_request(sim_network& net, latency_histogram& latency)
+	{
+		auto const start = net.now();
+		return [&net, &latency, start]()
+		{
+			latency.record(std::chrono::microseconds(net.now() - start));
+		};
+	}
+
+	void report(benchmark::State& state, latency_histogram const& latency)
+	{
+		histogram_snapshot const h = latency.snapshot();
+		state.counters["p50_ms"] = h.p50() / 1000.0;
+		state.counters["p99_ms"] = h.p99() / 1000.0;
+		state.counters["max_ms"] = h.max / 1000.0;
+	}
+
+	std::vector<gsl::byte> message(int i)
+	{
+		std::vector<gsl::byte> msg(200, gsl::byte(0x5a));
+		std::memcpy(msg.data(), &i, sizeof(i));
+		return msg;
+	}
+
+	secret_key make_key(int i)
+	{
+		secret_key sk;
+		sk.fill(gsl::byte(0));
+		std::memcpy(sk.data(), &i, sizeof(i));
+		return sk;
+	}
+}
+
+static void sim_put(benchmark::State& state)
+{
+	sim_network net(make_config(state), &sha1_fun);
+	sim_dht dht(net);
+	list_head head;
+	latency_histogram latency;
+	int n = 0;
+
+	for (auto _ : state)
+	{
+		for (int i = 0; i < batch; ++i)
+		{
+			auto const msg = message(n++);
+			list_token const token = head.push_front(gsl::as_span(msg));
+			put(dht, token, gsl::as_span(msg), time_request(net, latency));
+		}
+		net.run();
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+	report(state, latency);
+}
+BENCHMARK(sim_put)->Apply(network_args);
+
+static void sim_get(benchmark::State& state)
+{
+	sim_network net(make_config(state), &sha1_fun);
+	sim_dht dht(net);
+	list_head head;
+	std::vector<hash> targets;
+	for (int i = 0; i < batch; ++i)
+	{
+		auto const msg = message(i);
+		list_token const token = head.push_front(gsl::as_span(msg));
+		put(dht, token, gsl::as_span(msg), []() {});
+		targets.push_back(head.head());
+	}
+	net.run();
+
+	latency_histogram latency;
+	int found = 0;
+	for (auto _ : state)
+	{
+		for (hash const& target : targets)
+		{
+			auto done = time_request(net, latency);
+			get(dht, target, [&found, done](std::vector<gsl::byte> contents, hash const&)
+			{
+				if (!contents.empty()) ++found;
+				done();
+			});
+		}
+		net.run();
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+	state.counters["found"] = double(found) / (state.iterations() * batch);
+	report(state, latency);
+}
+BENCHMARK(sim_get)->Apply(network_args);
+
+// every iteration has a batch of peers each synchronize their own entry
+// into a list shared with one other peer
+static void sim_synchronize(benchmark::State& state)
+{
+	sim_network net(make_config(state), &sha1_fun);
+	sim_dht dht(net);
+	latency_histogram latency;
+	int received = 0;
+	std::uint32_t round = 0;
+
+	for (auto _ : state)
+	{
+		// the two peers sharing a list take turns
+		std::uint32_t const id = round++ % 2;
+		for (int i = 0; i < batch; ++i)
+		{
+			secret_key key = make_key(i);
+			std::vector<entry> entries;
+			entries.emplace_back(id);
+			entries.back().assign(gsl::as_span(message(i)));
+
+			synchronize(dht, key, entries
+				, [&received](entry const&) { ++received; }
+				, [](std::vector<entry>&) {}
+				, time_request(net, latency));
+		}
+		net.run();
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+	state.counters["received"] = double(received) / (state.iterations() * batch);
+	report(state, latency);
+}
+BENCHMARK(sim_synchronize)->Apply(network_args);
+
+namespace
+{
+	// fetch every message of a list, one after the other
+	void walk(IDht& dht, hash const& target, int& length, std::function<void()> done)
+	{
+		get(dht, target, [&dht, &length, done](std::vector<gsl::byte> contents, hash const& next)
+		{
+			bool const last = std::all_of(next.begin(), next.end()
+				, [](gsl::byte b) { return b == gsl::byte(0); });
+			if (contents.empty() || last)
+			{
+				done();
+				return;
+			}
+			++length;
+			walk(dht, next, length, done);
+		});
+	}
+}
+
+static void sim_list_walk(benchmark::State& state)
+{
+	int const list_length = 16;
+	sim_network net(make_config(state), &sha1_fun);
+	sim_dht dht(net);
+	std::vector<hash> heads;
+	for (int l = 0; l < batch; ++l)
+	{
+		list_head head;
+		for (int i = 0; i < list_length; ++i)
+		{
+			auto const msg = message(l * list_length + i);
+			list_token const token = head.push_front(gsl::as_span(msg));
+			put(dht, token, gsl::as_span(msg), []() {});
+		}
+		heads.push_back(head.head());
+	}
+	net.run();
+
+	latency_histogram latency;
+	int length = 0;
+	for (auto _ : state)
+	{
+		for (hash const& head : heads)
+			walk(dht, head, length, time_request(net, latency));
+		net.run();
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+	state.counters["messages"] = double(length + state.iterations() * batch)
+		/ (state.iterations() * batch);
+	report(state, latency);
+}
+BENCHMARK(sim_list_walk)->Apply(network_args);
@@ -0,0 +1,306 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Runs a cluster of dht_sessions on 127.0.x.y, bootstrapping off each other
+// with no internet access, and reports throughput, CPU use and latency of a
+// synchronize/put/get workload as JSON.
+//
+// A cluster may be spread over several processes by giving each process its
+// own range of nodes with --first and --count. Every node bootstraps off the
+// first few nodes of the cluster, so start the process running those first.
+//
+// On Linux the whole of 127.0.0.0/8 routes to the loopback interface, so no
+// setup is needed.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/resource.h>
+
+#include <dht_session.hpp>
+
+using namespace scout;
+
+namespace
+{
+	struct options
+	{
+		int nodes = 16;
+		int first = 0;
+		int count = -1;
+		int port = 7000;
+		int ops = 16;
+		int bootstrap_timeout = 60;
+	};
+
+	void usage()
+	{
+		std::fprintf(stderr, "usage: cluster [--nodes N] [--first I] [--count M] [--port P]\n"
+			"               [--ops K] [--bootstrap-timeout SECONDS]\n"
+			"\n"
+			"  --nodes              the size of the whole cluster (default 16)\n"
+			"  --first, --count     the range of nodes to run in this process\n"
+			"                       (default all of them)\n"
+			"  --port               the UDP port every node binds to (default 7000)\n"
+			"  --ops                requests of each type issued per node (default 16)\n"
+			"  --bootstrap-timeout  how long to wait for routing tables to fill\n");
+	}
+
+	// node i listens on 127.0.x.y, skipping the .0 and .255 host parts
+	std::string node_address(int i)
+	{
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "127.0.%d.%d", i / 254, i % 254 + 1);
+		return buf;
+	}
+
+	double cpu_seconds()
+	{
+		rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+			+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+	}
+
+	// counts down outstanding requests
+	struct latch
+	{
+		explicit latch(int n) : m_count(n) {}
+
+		void count_down()
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			if (--m_count == 0) m_cond.notify_all();
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> l(m_mutex);
+			m_cond.wait(l, [this] { return m_count == 0; });
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		int m_count;
+	};
+
+	std::vector<gsl::byte> message(int node, int i)
+	{
+		std::vector<gsl::byte> msg(200, gsl::byte(0x5a));
+		std::memcpy(msg.data(), &node, sizeof(node));
+		std::memcpy(msg.data() + sizeof(node), &i, sizeof(i));
+		return msg;
+	}
+
+	void print_latency(char const* name, histogram_snapshot const& h, bool last)
+	{
+		std::printf("    \"%s\": {\"count\": %llu, \"p50_ms\": %.3f, \"p99_ms\": %.3f"
+			", \"p999_ms\": %.3f, \"max_ms\": %.3f}%s\n"
+			, name, (unsigned long long)h.count, h.p50() / 1000.0, h.p99() / 1000.0
+			, h.p999() / 1000.0, h.max / 1000.0, last ? "" : ",");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	options opt;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 == argc) { usage(); return 1; }
+		char const* arg = argv[i];
+		int const value = std::atoi(argv[++i]);
+		if (std::strcmp(arg, "--nodes") == 0) opt.nodes = value;
+		else if (std::strcmp(arg, "--first") == 0) opt.first = value;
+		else if (std::strcmp(arg, "--count") == 0) opt.count = value;
+		else if (std::strcmp(arg, "--port") == 0) opt.port = value;
+		else if (std::strcmp(arg, "--ops") == 0) opt.ops = value;
+		else if (std::strcmp(arg, "--bootstrap-timeout") == 0) opt.bootstrap_timeout = value;
+		else { usage(); return 1; }
+	}
+	if (opt.count < 0) opt.count = opt.nodes - opt.first;
+	if (opt.count <= 0 || opt.first + opt.count > opt.nodes) { usage(); return 1; }
+
+	set_log_level(log_level::warning);
+
+	// every node bootstraps off the first few nodes of the cluster
+	int const routers = (std::min)(opt.nodes, 4);
+	std::vector<std::unique_ptr<dht_session>> sessions;
+	for (int i = opt.first; i < opt.first + opt.count; ++i)
+	{
+		session_settings s;
+		s.bootstrap_nodes.clear();
+		for (int r = 0; r < routers; ++r)
+		{
+			if (r != i) s.bootstrap_nodes.push_back({ node_address(r), opt.port });
+		}
+		s.bind_address = boost::asio::ip::address::from_string(node_address(i));
+		s.port = std::uint16_t(opt.port);
+		s.persist_state = false;
+		s.map_ports = false;
+		// loopback can take a lot more than the default
+		s.rate_limit = 1000000;
+
+		sessions.emplace_back(new dht_session(s));
+		if (sessions.back()->start() != 0)
+		{
+			std::fprintf(stderr, "failed to start node %d on %s:%d\n"
+				, i, node_address(i).c_str(), opt.port);
+			return 1;
+		}
+	}
+
+	// wait for the routing tables to fill
+	int const wanted = (std::min)(opt.nodes - 1, 8);
+	auto const bootstrap_start = std::chrono::steady_clock::now();
+	auto const deadline = bootstrap_start + std::chrono::seconds(opt.bootstrap_timeout);
+	for (;;)
+	{
+		int ready = 0;
+		for (auto& ses : sessions)
+			if (ses->get_stats().routing_table_size >= wanted) ++ready;
+		if (ready == int(sessions.size())) break;
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			std::fprintf(stderr, "only %d of %d nodes bootstrapped, continuing anyway\n"
+				, ready, int(sessions.size()));
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	double const bootstrap_seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - bootstrap_start).count();
+
+	// only measure the workload
+	for (auto& ses : sessions) ses->get_stats(true);
+	std::uint64_t packets_before = 0;
+	for (auto& ses : sessions)
+	{
+		session_stats const s = ses->get_stats();
+		packets_before += s.packets_in + s.packets_out;
+	}
+	double const cpu_start = cpu_seconds();
+	auto const start = std::chrono::steady_clock::now();
+
+	int const n = int(sessions.size());
+
+	// every node pushes ops messages onto its own list
+	std::vector<std::vector<std::vector<gsl::byte>>> messages(n);
+	std::vector<std::vector<hash>> addresses(n);
+	{
+		latch done(n * opt.ops);
+		for (int s = 0; s < n; ++s)
+		{
+			list_head head;
+			for (int i = 0; i < opt.ops; ++i)
+				messages[s].push_back(message(opt.first + s, i));
+			for (int i = 0; i < opt.ops; ++i)
+			{
+				list_token const token = head.push_front(gsl::as_span(messages[s][i]));
+				addresses[s].push_back(head.head());
+				sessions[s]->put(token, gsl::as_span(messages[s][i]), [&done] { done.count_down(); });
+			}
+		}
+		done.wait();
+	}
+
+	// and fetches the messages of its neighbour
+	std::atomic<int> found(0);
+	{
+		latch done(n * opt.ops);
+		for (int s = 0; s < n; ++s)
+		{
+			for (hash& address : addresses[(s + 1) % n])
+			{
+				sessions[s]->get(address, [&](std::vector<gsl::byte> contents, hash const&)
+				{
+					if (!contents.empty()) ++found;
+					done.count_down();
+				});
+			}
+		}
+		done.wait();
+	}
+
+	// pairs of nodes share lists of entries, each adding its own
+	std::atomic<int> received(0);
+	{
+		latch done(n * opt.ops);
+		// every request has its own key, which must outlive it
+		std::vector<secret_key> keys(n * opt.ops);
+		for (int s = 0; s < n; ++s)
+		{
+			for (int i = 0; i < opt.ops; ++i)
+			{
+				secret_key& key = keys[s * opt.ops + i];
+				key.fill(gsl::byte(0));
+				int const pair = (opt.first + s) / 2;
+				std::memcpy(key.data(), &pair, sizeof(pair));
+				std::memcpy(key.data() + sizeof(pair), &i, sizeof(i));
+
+				std::vector<entry> entries;
+				entries.emplace_back(std::uint32_t(opt.first + s));
+				entries.back().assign(gsl::as_span(messages[s][i]));
+				sessions[s]->synchronize(key, std::move(entries)
+					, [&](entry const&) { ++received; }
+					, [](std::vector<entry>&) {}
+					, [&done] { done.count_down(); });
+			}
+		}
+		done.wait();
+	}
+
+	double const seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	double const cpu = cpu_seconds() - cpu_start;
+
+	std::uint64_t packets = 0;
+	std::array<histogram_snapshot, num_op_types> latency;
+	for (auto& ses : sessions)
+	{
+		session_stats const s = ses->get_stats();
+		packets += s.packets_in + s.packets_out;
+		for (int t = 0; t < num_op_types; ++t)
+			latency[t].merge(s.ops[t].latency);
+	}
+	for (auto& ses : sessions) ses->stop();
+
+	packets -= packets_before;
+	int const ops = 3 * n * opt.ops;
+
+	std::printf("{\n");
+	std::printf("  \"nodes\": %d,\n  \"local_nodes\": %d,\n", opt.nodes, n);
+	std::printf("  \"bootstrap_seconds\": %.3f,\n", bootstrap_seconds);
+	std::printf("  \"seconds\": %.3f,\n", seconds);
+	std::printf("  \"operations\": %d,\n", ops);
+	std::printf("  \"operations_per_second\": %.1f,\n", ops / seconds);
+	std::printf("  \"packets_per_second\": %.1f,\n", packets / seconds);
+	std::printf("  \"cpu_us_per_operation\": %.1f,\n", cpu * 1e6 / ops);
+	std::printf("  \"gets_found\": %d,\n", found.load());
+	std::printf("  \"entries_received\": %d,\n", received.load());
+	std::printf("  \"latency\": {\n");
+	for (int t = 0; t < num_op_types; ++t)
+		print_latency(op_type_name(op_type(t)), latency[t], t == num_op_types - 1);
+	std::printf("  }\n}\n");
+	return 0;
+}
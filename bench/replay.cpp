@@ -0,0 +1,138 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Feeds the incoming packets of a capture written by
+// dht_session::start_capture() into a session, for profiling the receive
+// path offline. By default packets are replayed as fast as the session
+// can take them and the throughput is reported as JSON. With --realtime
+// they are replayed with their original spacing.
+//
+// The session doesn't send anything, so nodes in the capture are never
+// contacted. Responses to queries the session didn't send are still parsed
+// and dispatched, then dropped by the DHT.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <sys/resource.h>
+
+#include <dht_session.hpp>
+#include <packet_capture.hpp>
+
+using namespace scout;
+
+namespace
+{
+	void usage()
+	{
+		std::fprintf(stderr, "usage: replay <capture file> [--realtime] [--repeat N]\n");
+	}
+
+	double cpu_seconds()
+	{
+		rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+			+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+	}
+
+	// inject packets and wait for the session to process them
+	void inject(dht_session& ses, std::vector<captured_packet> packets)
+	{
+		std::promise<void> done;
+		ses.inject_packets(std::move(packets), [&done] { done.set_value(); });
+		done.get_future().wait();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) { usage(); return 1; }
+
+	bool realtime = false;
+	int repeat = 1;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--realtime") == 0) realtime = true;
+		else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = std::atoi(argv[++i]);
+		else { usage(); return 1; }
+	}
+
+	capture_reader reader(argv[1]);
+	if (!reader.is_open()) return 1;
+
+	std::vector<captured_packet> packets;
+	captured_packet p;
+	while (reader.next(p))
+	{
+		if (p.direction == packet_direction::incoming) packets.push_back(p);
+	}
+	if (packets.empty())
+	{
+		std::fprintf(stderr, "no incoming packets in \"%s\"\n", argv[1]);
+		return 1;
+	}
+
+	set_log_level(log_level::warning);
+
+	session_settings s;
+	s.bootstrap_nodes.clear();
+	s.bind_address = boost::asio::ip::address_v4::loopback();
+	s.persist_state = false;
+	s.map_ports = false;
+	s.send_packets = false;
+	dht_session ses(s);
+	if (ses.start() != 0) return 1;
+
+	double const cpu_start = cpu_seconds();
+	auto const start = std::chrono::steady_clock::now();
+
+	for (int r = 0; r < repeat; ++r)
+	{
+		if (!realtime)
+		{
+			inject(ses, packets);
+			continue;
+		}
+
+		auto const capture_start = packets.front().time;
+		auto const replay_start = std::chrono::steady_clock::now();
+		for (captured_packet const& pkt : packets)
+		{
+			std::this_thread::sleep_until(replay_start + (pkt.time - capture_start));
+			ses.inject_packets({ pkt }, [] {});
+		}
+		// wait for the last one
+		inject(ses, {});
+	}
+
+	double const seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	double const cpu = cpu_seconds() - cpu_start;
+	ses.stop();
+
+	std::uint64_t const total = std::uint64_t(packets.size()) * repeat;
+	std::printf("{\n");
+	std::printf("  \"packets\": %llu,\n", (unsigned long long)total);
+	std::printf("  \"seconds\": %.3f,\n", seconds);
+	std::printf("  \"packets_per_second\": %.1f,\n", total / seconds);
+	std::printf("  \"cpu_us_per_packet\": %.3f\n", cpu * 1e6 / total);
+	std::printf("}\n");
+	return 0;
+}
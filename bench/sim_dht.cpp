@@ -0,0 +1,391 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "sim_dht.hpp"
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace scout
+{
+
+namespace
+{
+	using node_id = sim_network::node_id;
+
+	// whether a is closer to target than b by the XOR metric
+	bool closer(node_id const& a, node_id const& b, node_id const& target)
+	{
+		for (std::size_t i = 0; i < target.size(); ++i)
+		{
+			byte const da = a[i] ^ target[i];
+			byte const db = b[i] ^ target[i];
+			if (da != db) return da < db;
+		}
+		return false;
+	}
+
+	node_id to_id(sha1_hash const& h)
+	{
+		node_id id;
+		std::copy(h.value, h.value + id.size(), id.begin());
+		return id;
+	}
+
+	// the nodes are given addresses in 10.0.0.0/8 after their index
+	SockAddr node_addr(int node)
+	{
+		SockAddr addr;
+		addr.set_addr4(0x0a000000 + std::uint32_t(node));
+		addr.set_port(6881);
+		return addr;
+	}
+}
+
+struct sim_network::lookup_state
+{
+	enum { fresh, pending, responded, failed };
+
+	struct candidate
+	{
+		int node;
+		int state;
+	};
+
+	node_id target;
+	std::vector<candidate> candidates;
+	int outstanding = 0;
+	bool finished = false;
+	std::function<bool(int)> on_response;
+	std::function<void(std::vector<int> const&)> on_done;
+};
+
+sim_network::sim_network(sim_config const& cfg, DhtSHACallback* sha)
+	: mutable_items(cfg.nodes)
+	, immutable_items(cfg.nodes)
+	, m_cfg(cfg)
+	, m_sha(sha)
+	, m_rng(cfg.seed)
+	, m_nodes(cfg.nodes)
+	, m_now(0)
+	, m_event_seq(0)
+{
+	std::lognormal_distribution<double> rtt(std::log(cfg.rtt_median_ms * 1000), cfg.rtt_sigma);
+	std::bernoulli_distribution dead(cfg.dead_nodes);
+	for (node& n : m_nodes)
+	{
+		for (byte& b : n.id) b = byte(m_rng());
+		n.rtt = clock_us(rtt(m_rng));
+		n.dead = dead(m_rng);
+	}
+
+	m_sorted.resize(m_nodes.size());
+	for (int i = 0; i < int(m_sorted.size()); ++i) m_sorted[i] = i;
+	std::sort(m_sorted.begin(), m_sorted.end(), [this](int a, int b)
+		{ return m_nodes[a].id < m_nodes[b].id; });
+
+	for (node& n : m_nodes)
+		n.routing_table = build_table(n.id);
+}
+
+std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>
+sim_network::prefix_range(node_id prefix, int bits) const
+{
+	// the nodes sharing a prefix are contiguous in id order, between the
+	// prefix followed by all zeros and the prefix followed by all ones
+	node_id lo = prefix;
+	node_id hi = prefix;
+	for (int i = bits; i < 160; ++i)
+	{
+		byte const bit = byte(0x80 >> (i % 8));
+		lo[i / 8] &= byte(~bit);
+		hi[i / 8] |= bit;
+	}
+	auto const first = std::lower_bound(m_sorted.begin(), m_sorted.end(), lo
+		, [this](int a, node_id const& b) { return m_nodes[a].id < b; });
+	auto const last = std::upper_bound(first, m_sorted.cend(), hi
+		, [this](node_id const& a, int b) { return a < m_nodes[b].id; });
+	return { first, last };
+}
+
+std::vector<int> sim_network::build_table(node_id const& id)
+{
+	std::vector<int> table;
+	// bucket d holds the nodes sharing exactly the first d bits with id
+	for (int d = 0; d < 160; ++d)
+	{
+		node_id other = id;
+		other[d / 8] ^= byte(0x80 >> (d % 8));
+		auto const range = prefix_range(other, d + 1);
+		std::vector<int> bucket(range.first, range.second);
+		if (int(bucket.size()) > m_cfg.k)
+		{
+			// a deterministic sample of k nodes
+			for (int i = 0; i < m_cfg.k; ++i)
+				std::swap(bucket[i], bucket[i + m_rng() % (bucket.size() - i)]);
+			bucket.resize(m_cfg.k);
+		}
+		table.insert(table.end(), bucket.begin(), bucket.end());
+
+		// stop once no other node shares the next prefix with us
+		auto const own = prefix_range(id, d + 1);
+		if (std::none_of(own.first, own.second, [&](int n) { return m_nodes[n].id != id; }))
+			break;
+	}
+	return table;
+}
+
+std::vector<int> sim_network::closest(std::vector<int> const& table, node_id const& target) const
+{
+	std::vector<int> ret = table;
+	auto const mid = ret.begin() + (std::min)(ret.size(), std::size_t(m_cfg.k));
+	std::partial_sort(ret.begin(), mid, ret.end(), [&](int a, int b)
+		{ return closer(m_nodes[a].id, m_nodes[b].id, target); });
+	ret.erase(mid, ret.end());
+	return ret;
+}
+
+std::vector<int> sim_network::join()
+{
+	node_id id;
+	for (byte& b : id) b = byte(m_rng());
+	return build_table(id);
+}
+
+void sim_network::post_at(clock_us t, std::function<void()> f)
+{
+	m_events.push(event{ t, m_event_seq++, std::move(f) });
+}
+
+std::size_t sim_network::run()
+{
+	std::size_t ret = 0;
+	while (!m_events.empty())
+	{
+		event e = std::move(const_cast<event&>(m_events.top()));
+		m_events.pop();
+		m_now = e.time;
+		e.fun();
+		++ret;
+	}
+	return ret;
+}
+
+void sim_network::request(int n, std::function<void(bool)> done)
+{
+	std::uniform_real_distribution<double> uniform;
+	// the request and the response may each be lost
+	bool const lost = m_nodes[n].dead
+		|| uniform(m_rng) < m_cfg.loss
+		|| uniform(m_rng) < m_cfg.loss;
+	if (lost)
+	{
+		post_at(m_now + m_cfg.timeout_ms * 1000, [=]() { done(false); });
+		return;
+	}
+	clock_us const rtt = clock_us(m_nodes[n].rtt * (1.0 + m_cfg.jitter * uniform(m_rng)));
+	post_at(m_now + rtt, [=]() { done(true); });
+}
+
+void sim_network::lookup(node_id const& target, std::vector<int> start
+	, std::function<bool(int)> on_response
+	, std::function<void(std::vector<int> const&)> on_done)
+{
+	auto l = std::make_shared<lookup_state>();
+	l->target = target;
+	l->on_response = std::move(on_response);
+	l->on_done = std::move(on_done);
+	for (int n : closest(start, target))
+		l->candidates.push_back({ n, lookup_state::fresh });
+	step(l);
+}
+
+void sim_network::step(std::shared_ptr<lookup_state> l)
+{
+	if (l->finished) return;
+
+	// the lookup has converged once the k closest live candidates have all
+	// responded
+	std::vector<int> result;
+	bool converged = true;
+	int counted = 0;
+	for (auto& c : l->candidates)
+	{
+		if (c.state == lookup_state::failed) continue;
+		if (counted++ == m_cfg.k) break;
+		if (c.state != lookup_state::responded) converged = false;
+		else result.push_back(c.node);
+	}
+
+	if (converged)
+	{
+		l->finished = true;
+		l->on_done(result);
+		return;
+	}
+
+	counted = 0;
+	for (auto& c : l->candidates)
+	{
+		if (l->outstanding >= m_cfg.alpha) break;
+		if (c.state == lookup_state::failed) continue;
+		if (counted++ == m_cfg.k) break;
+		if (c.state != lookup_state::fresh) continue;
+
+		c.state = lookup_state::pending;
+		++l->outstanding;
+		int const n = c.node;
+		request(n, [this, l, n](bool ok)
+		{
+			--l->outstanding;
+			if (l->finished) return;
+
+			auto const it = std::find_if(l->candidates.begin(), l->candidates.end()
+				, [n](lookup_state::candidate const& c) { return c.node == n; });
+			it->state = ok ? lookup_state::responded : lookup_state::failed;
+
+			if (ok)
+			{
+				if (l->on_response(n))
+				{
+					l->finished = true;
+					return;
+				}
+
+				// merge in the closer nodes the responder knows about
+				for (int m : closest(m_nodes[n].routing_table, l->target))
+				{
+					if (std::none_of(l->candidates.begin(), l->candidates.end()
+						, [m](lookup_state::candidate const& c) { return c.node == m; }))
+					{
+						l->candidates.push_back({ m, lookup_state::fresh });
+					}
+				}
+				std::stable_sort(l->candidates.begin(), l->candidates.end()
+					, [&](lookup_state::candidate const& a, lookup_state::candidate const& b)
+					{ return closer(m_nodes[a.node].id, m_nodes[b.node].id, l->target); });
+			}
+			step(l);
+		});
+	}
+}
+
+sim_dht::sim_dht(sim_network& net)
+	: m_net(net)
+	, m_bootstrap(net.join())
+{}
+
+void sim_dht::store(std::vector<int> const& nodes, std::function<void(int)> apply
+	, std::function<void()> done)
+{
+	if (nodes.empty())
+	{
+		done();
+		return;
+	}
+
+	auto remaining = std::make_shared<int>(int(nodes.size()));
+	for (int n : nodes)
+	{
+		m_net.request(n, [=](bool ok)
+		{
+			if (ok) apply(n);
+			if (--*remaining == 0) done();
+		});
+	}
+}
+
+void sim_dht::Put(const byte * pkey, const byte * skey, DhtPutCallback* put_callback,
+	DhtPutCompletedCallback * put_completed_callback, DhtPutDataCallback* put_data_callback,
+	void *ctx, int flags, int64 seq)
+{
+	node_id const target = to_id(m_net.sha1(pkey, 32));
+	auto highest_seq = std::make_shared<int64>(seq - 1);
+
+	m_net.lookup(target, m_bootstrap, [=](int n)
+	{
+		auto const it = m_net.mutable_items[n].find(target);
+		if (it != m_net.mutable_items[n].end())
+		{
+			put_data_callback(ctx, it->second.value, it->second.seq, node_addr(n));
+			*highest_seq = (std::max)(*highest_seq, it->second.seq);
+		}
+		return false;
+	}
+	, [=](std::vector<int> const& nodes)
+	{
+		if (nodes.empty())
+		{
+			put_completed_callback(ctx);
+			return;
+		}
+
+		std::vector<char> buffer;
+		int64 new_seq = *highest_seq + 1;
+		if (put_callback(ctx, buffer, new_seq, node_addr(nodes.front())) != 0)
+		{
+			put_completed_callback(ctx);
+			return;
+		}
+
+		auto item = std::make_shared<sim_network::mutable_item>(
+			sim_network::mutable_item{ new_seq, std::move(buffer) });
+		store(nodes, [=](int n)
+		{
+			auto& stored = m_net.mutable_items[n][target];
+			if (stored.value.empty() || stored.seq < item->seq) stored = *item;
+		}
+		, [=]() { put_completed_callback(ctx); });
+	});
+}
+
+sha1_hash sim_dht::ImmutablePut(const byte * data, size_t data_len,
+	DhtPutCompletedCallback* put_completed_callback, void *ctx)
+{
+	// items are stored bencoded, and their target is the hash of that
+	std::string const prefix = std::to_string(data_len) + ":";
+	auto value = std::make_shared<std::vector<char>>(prefix.begin(), prefix.end());
+	value->insert(value->end(), data, data + data_len);
+	sha1_hash const hash = m_net.sha1((byte const*)value->data(), int(value->size()));
+	node_id const target = to_id(hash);
+
+	m_net.lookup(target, m_bootstrap, [](int) { return false; }
+		, [=](std::vector<int> const& nodes)
+	{
+		store(nodes, [=](int n) { m_net.immutable_items[n][target] = *value; }
+			, [=]() { if (put_completed_callback) put_completed_callback(ctx); });
+	});
+	return hash;
+}
+
+void sim_dht::ImmutableGet(sha1_hash target_hash, DhtGetCallback* cb, void* ctx)
+{
+	node_id const target = to_id(target_hash);
+
+	m_net.lookup(target, m_bootstrap, [=](int n)
+	{
+		auto const it = m_net.immutable_items[n].find(target);
+		if (it == m_net.immutable_items[n].end()) return false;
+		cb(ctx, it->second);
+		return true;
+	}
+	, [=](std::vector<int> const&)
+	{
+		cb(ctx, std::vector<char>());
+	});
+}
+
+} // namespace scout
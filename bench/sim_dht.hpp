@@ -0,0 +1,220 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_SIM_DHT_HPP
+#define SCOUT_SIM_DHT_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+#include "dht.h"
+
+namespace scout
+{
+
+struct sim_config
+{
+	// the number of virtual DHT nodes
+	int nodes = 2000;
+	// the seed of all random choices, runs with the same seed and the same
+	// sequence of requests are identical
+	std::uint64_t seed = 1;
+	// each node's round trip time is drawn from a log-normal distribution
+	// with this median and shape (sigma), each packet adds up to jitter of
+	// that on top
+	double rtt_median_ms = 80;
+	double rtt_sigma = 0.6;
+	double jitter = 0.2;
+	// the probability of any one request or its response being lost
+	double loss = 0.02;
+	// the fraction of nodes which never respond
+	double dead_nodes = 0.05;
+	// how long to wait for a lost request before giving up on the node
+	std::uint64_t timeout_ms = 2000;
+	// the bucket size of the routing tables, which is also the number of
+	// nodes an item is stored on
+	int k = 8;
+	// the number of outstanding requests per lookup
+	int alpha = 3;
+};
+
+// A deterministic, in-process model of a DHT. Every virtual node has a
+// random id, a Kademlia routing table and storage for items. Requests are
+// delivered through an event queue driven by a virtual clock, so lookups
+// are genuinely iterative, overlap with each other and suffer the
+// configured latency and loss without touching the network.
+class sim_network
+{
+public:
+	using node_id = std::array<byte, 20>;
+	using clock_us = std::uint64_t;
+
+	sim_network(sim_config const& cfg, DhtSHACallback* sha);
+
+	// the current virtual time, in microseconds
+	clock_us now() const { return m_now; }
+
+	// run events until there are none left. Returns the number of events run
+	std::size_t run();
+
+	// schedule f to run at the given virtual time
+	void post_at(clock_us t, std::function<void()> f);
+
+	sim_config const& config() const { return m_cfg; }
+	sha1_hash sha1(byte const* buf, int len) const { return m_sha(buf, len); }
+
+	// pick a random id for a new client and return the routing table it
+	// starts its lookups from
+	std::vector<int> join();
+
+	// issue a lookup for target. on_response is called for every node which
+	// responds, and returns true to end the lookup early. on_done is passed
+	// the closest responding nodes once the lookup converges
+	void lookup(node_id const& target, std::vector<int> start
+		, std::function<bool(int)> on_response
+		, std::function<void(std::vector<int> const&)> on_done);
+
+	// send a request to node and call done with whether it was answered
+	// (false if either direction was lost), after the round trip or timeout
+	void request(int node, std::function<void(bool)> done);
+
+	struct mutable_item
+	{
+		std::int64_t seq;
+		std::vector<char> value;
+	};
+
+	// per node storage, indexed by node
+	std::vector<std::map<node_id, mutable_item>> mutable_items;
+	std::vector<std::map<node_id, std::vector<char>>> immutable_items;
+
+private:
+	struct node
+	{
+		node_id id;
+		// round trip time in microseconds
+		clock_us rtt;
+		bool dead;
+		std::vector<int> routing_table;
+	};
+
+	struct event
+	{
+		clock_us time;
+		std::uint64_t seq;
+		std::function<void()> fun;
+		bool operator<(event const& o) const
+		{ return time != o.time ? time > o.time : seq > o.seq; }
+	};
+
+	struct lookup_state;
+
+	// the nodes whose ids start with the first bits of prefix, in id order
+	std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>
+	prefix_range(node_id prefix, int bits) const;
+	// the routing table a node with the given id would have
+	std::vector<int> build_table(node_id const& id);
+	// up to k entries of table, closest to target first
+	std::vector<int> closest(std::vector<int> const& table, node_id const& target) const;
+	void step(std::shared_ptr<lookup_state> l);
+
+	sim_config m_cfg;
+	DhtSHACallback* m_sha;
+	std::mt19937_64 m_rng;
+	std::vector<node> m_nodes;
+	// node indices ordered by id
+	std::vector<int> m_sorted;
+	std::priority_queue<event> m_events;
+	clock_us m_now;
+	std::uint64_t m_event_seq;
+};
+
+// An IDht client attached to a sim_network. All callbacks are invoked from
+// sim_network::run(). Only the calls scout makes are modelled, the rest are
+// no-ops.
+class sim_dht : public IDht
+{
+public:
+	explicit sim_dht(sim_network& net);
+	REFBASE;
+
+	virtual void Put(const byte * pkey, const byte * skey, DhtPutCallback* put_callback,
+		DhtPutCompletedCallback * put_completed_callback, DhtPutDataCallback* put_data_callback,
+		void *ctx, int flags = 0, int64 seq = 0);
+	virtual sha1_hash ImmutablePut(const byte * data, size_t data_len,
+		DhtPutCompletedCallback* put_completed_callback = nullptr, void *ctx = nullptr);
+	virtual void ImmutableGet(sha1_hash target, DhtGetCallback* cb, void* ctx = nullptr);
+
+	virtual bool handleReadEvent(UDPSocketInterface *socket, byte *buffer, size_t len, const SockAddr& addr) { return true; }
+	virtual bool handleICMP(UDPSocketInterface *socket, byte *buffer, size_t len, const SockAddr& addr) { return true; }
+	virtual void Tick() {}
+	virtual void Vote(void *ctx, const sha1_hash* info_hash, int vote, DhtVoteCallback* callb) {}
+	virtual void AnnounceInfoHash(const byte *info_hash, DhtAddNodesCallback *addnodes_callback,
+		DhtPortCallback* pcb, cstr file_name, void *ctx, int flags = 0) {}
+	virtual void SetId(byte new_id_bytes[20]) {}
+	virtual void Enable(bool enabled, int rate) {}
+	virtual void SetVersion(char const* client, int major, int minor) {}
+	virtual void SetRate(int bytes_per_second) {}
+	virtual void SetExternalIPCounter(ExternalIPCounter* ip) {}
+	virtual void SetPacketCallback(DhtPacketCallback* cb) {}
+	virtual void SetAddNodeResponseCallback(DhtAddNodeResponseCallback* cb) {}
+	virtual void SetSHACallback(DhtSHACallback* cb) {}
+	virtual void SetEd25519VerifyCallback(Ed25519VerifyCallback* cb) {}
+	virtual void SetEd25519SignCallback(Ed25519SignCallback* cb) {}
+	virtual void AddBootstrapNode(SockAddr const& addr) {}
+	virtual void AddNode(const SockAddr& addr, void* userdata, uint origin) {}
+	virtual bool CanAnnounce() { return true; }
+	virtual void Close() {}
+	virtual void Shutdown() {}
+	virtual void Initialize(UDPSocketInterface *, UDPSocketInterface *) {}
+	virtual bool IsEnabled() { return true; }
+	virtual void ForceRefresh() {}
+	virtual void SetReadOnly(bool readOnly) {}
+	virtual void SetPingFrequency(int seconds) {}
+	virtual void SetPingBatching(int num_pings) {}
+	virtual void EnableQuarantine(bool e) {}
+	virtual bool ProcessIncoming(byte *buffer, size_t len, const SockAddr& addr) { return true; }
+	virtual void DumpTracked() {}
+	virtual void DumpBuckets() {}
+	virtual int GetProbeQuota() { return 0; }
+	virtual bool CanAddNode() { return true; }
+	virtual int GetNumPeers() { return int(m_bootstrap.size()); }
+	virtual bool IsBusy() { return false; }
+	virtual int GetBootstrapState() { return 0; }
+	virtual int GetRate() { return 0; }
+	virtual int GetQuota() { return 0; }
+	virtual int GetProbeRate() { return 0; }
+	virtual int GetNumPeersTracked() { return 0; }
+	virtual void Restart() {}
+	virtual void GenerateId() {}
+
+private:
+	// store to each of nodes and call done once all have answered or timed out
+	void store(std::vector<int> const& nodes, std::function<void(int)> apply
+		, std::function<void()> done);
+
+	sim_network& m_net;
+	std::vector<int> m_bootstrap;
+};
+
+} // namespace scout
+
+#endif
@@ -186,7 +186,7 @@ int main(int argc, char const* argv[])
 			{
 				for (entry& e : entries)
 				{
-					if (e.id() == eid && e.value() != content)
+					if (e.id() == eid && !std::equal(e.value().begin(), e.value().end(), content.begin(), content.end()))
 						e.assign(content);
 					std::cout << e.id() << ' ' << std::string(e.value().begin(), e.value().end())
 						<< '\n';
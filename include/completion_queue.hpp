@@ -0,0 +1,88 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_COMPLETION_QUEUE_HPP
+#define SCOUT_COMPLETION_QUEUE_HPP
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "scout.hpp"
+
+namespace scout
+{
+
+// the result of a request issued against a completion_queue
+struct completion
+{
+	// the id returned when the request was issued
+	std::uint64_t id;
+	op_type type;
+	op_status status;
+	// get only: the item's contents and the hash of the next item in the list
+	std::vector<gsl::byte> contents;
+	hash next_hash;
+	// synchronize only: the entries as they were stored in the DHT
+	std::vector<entry> entries;
+};
+
+// Results of requests are written to the queue by the session's network
+// thread and harvested in batches by the application's thread, instead of
+// invoking a callback per request on the network thread. A file descriptor
+// becomes readable whenever completions are waiting, so the queue can be
+// watched by the application's event loop (epoll, select, asio etc.).
+//
+// Completions are stored in a fixed size lock-free ring. If the application
+// falls behind and the ring fills up, further completions spill into a
+// locked overflow list, so none are ever lost but they may be harvested out
+// of order.
+//
+// Any number of threads may post, but only one thread may harvest at a time.
+class completion_queue
+{
+public:
+	completion_queue();
+	~completion_queue();
+
+	completion_queue(completion_queue const&) = delete;
+	completion_queue& operator=(completion_queue const&) = delete;
+
+	// an eventfd, or the read end of a pipe where eventfd isn't available,
+	// which is readable while completions are waiting. Only poll it, never
+	// read from it. -1 on Windows, use wait() instead
+	int native_handle() const;
+
+	// move up to max waiting completions to the end of out and return how
+	// many were added. Never blocks
+	std::size_t harvest(std::vector<completion>& out
+		, std::size_t max = (std::numeric_limits<std::size_t>::max)());
+
+	// block until completions are waiting or timeout_ms has passed. A
+	// negative timeout waits forever. Returns false on timeout
+	bool wait(int timeout_ms = -1);
+
+	// called by the session on the network thread
+	void post(completion c);
+
+private:
+	struct impl;
+	std::unique_ptr<impl> m_impl;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,400 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_COROUTINE_HPP
+#define SCOUT_COROUTINE_HPP
+
+// Awaitable versions of the dht_session requests, for C++20 coroutines.
+// Nothing in here is defined unless the compiler supports coroutines
+// (e.g. -std=c++20), the rest of scout only requires C++14.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "scout.hpp"
+
+namespace scout
+{
+
+// Coroutine frames are allocated from per-thread free lists, bucketed by
+// size, so a coroutine calling another in a loop reuses the same block
+// rather than going back to the heap each time. Frames larger than
+// max_size come from operator new.
+struct frame_pool
+{
+	enum
+	{
+		granularity = 64,
+		size_classes = 16,
+		max_size = granularity * size_classes,
+		// blocks kept per size class and thread
+		max_cached = 64,
+	};
+
+	static void* allocate(std::size_t size);
+	static void deallocate(void* p, std::size_t size) noexcept;
+
+private:
+	struct block { block* next; };
+
+	struct cache
+	{
+		block* free[size_classes] = {};
+		int cached[size_classes] = {};
+
+		~cache()
+		{
+			for (block* b : free)
+			{
+				while (b)
+				{
+					block* next = b->next;
+					::operator delete(b);
+					b = next;
+				}
+			}
+		}
+	};
+
+	static cache& local()
+	{
+		thread_local cache c;
+		return c;
+	}
+};
+
+inline void* frame_pool::allocate(std::size_t size)
+{
+	std::size_t const cls = (size + granularity - 1) / granularity - 1;
+	if (cls >= size_classes) return ::operator new(size);
+
+	cache& c = local();
+	if (block* b = c.free[cls])
+	{
+		c.free[cls] = b->next;
+		--c.cached[cls];
+		return b;
+	}
+	return ::operator new((cls + 1) * granularity);
+}
+
+inline void frame_pool::deallocate(void* p, std::size_t size) noexcept
+{
+	std::size_t const cls = (size + granularity - 1) / granularity - 1;
+	if (cls >= size_classes)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	// frames may be freed on another thread than the one which allocated
+	// them, in which case they move to that thread's cache
+	cache& c = local();
+	if (c.cached[cls] == max_cached)
+	{
+		::operator delete(p);
+		return;
+	}
+	block* b = static_cast<block*>(p);
+	b->next = c.free[cls];
+	c.free[cls] = b;
+	++c.cached[cls];
+}
+
+template <typename T = void>
+class task;
+
+namespace detail
+{
+	struct pooled_frame
+	{
+		static void* operator new(std::size_t size) { return frame_pool::allocate(size); }
+		static void operator delete(void* p, std::size_t size) noexcept
+		{ frame_pool::deallocate(p, size); }
+	};
+
+	// resumes whoever awaited the task, if anyone
+	struct final_awaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+		{
+			std::coroutine_handle<> c = h.promise().continuation;
+			return c ? c : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	struct task_promise_base : pooled_frame
+	{
+		std::coroutine_handle<> continuation;
+		std::exception_ptr error;
+
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		final_awaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	template <typename T>
+	struct task_promise : task_promise_base
+	{
+		std::optional<T> value;
+
+		task<T> get_return_object();
+
+		template <typename U>
+		void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+		T result()
+		{
+			if (error) std::rethrow_exception(error);
+			return std::move(*value);
+		}
+	};
+
+	template <>
+	struct task_promise<void> : task_promise_base
+	{
+		task<void> get_return_object();
+		void return_void() {}
+
+		void result()
+		{
+			if (error) std::rethrow_exception(error);
+		}
+	};
+
+	// the coroutine behind spawn(), it runs eagerly and frees itself
+	struct detached
+	{
+		struct promise_type : pooled_frame
+		{
+			detached get_return_object() const noexcept { return {}; }
+			std::suspend_never initial_suspend() const noexcept { return {}; }
+			std::suspend_never final_suspend() const noexcept { return {}; }
+			void return_void() const noexcept {}
+			void unhandled_exception() const noexcept { std::terminate(); }
+		};
+	};
+}
+
+// A lazily started coroutine returning a T. It starts when awaited and
+// resumes the awaiting coroutine when it finishes. Exceptions propagate to
+// the awaiter.
+template <typename T>
+class [[nodiscard]] task
+{
+public:
+	using promise_type = detail::task_promise<T>;
+
+	explicit task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+	task(task&& o) noexcept : m_handle(std::exchange(o.m_handle, nullptr)) {}
+	task& operator=(task&& o) noexcept
+	{
+		if (this != &o)
+		{
+			if (m_handle) m_handle.destroy();
+			m_handle = std::exchange(o.m_handle, nullptr);
+		}
+		return *this;
+	}
+	~task() { if (m_handle) m_handle.destroy(); }
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+	{
+		m_handle.promise().continuation = awaiter;
+		return m_handle;
+	}
+
+	T await_resume() { return m_handle.promise().result(); }
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail
+{
+	template <typename T>
+	task<T> task_promise<T>::get_return_object()
+	{
+		return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+	}
+
+	inline task<void> task_promise<void>::get_return_object()
+	{
+		return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+	}
+}
+
+// start running t on the calling thread. It runs until its first
+// suspension and is freed once it completes. An exception escaping t
+// terminates the program. Beware of passing in a call to a capturing
+// lambda, the captures are gone once the lambda's temporary is destroyed
+inline void spawn(task<void> t)
+{
+	[](task<void> t) -> detail::detached { co_await std::move(t); }(std::move(t));
+}
+
+// The awaitables below issue a request through a dht_session (or anything
+// with the same request functions) and suspend the calling coroutine until
+// it completes. The coroutine is then resumed through the executor's
+// post() function, for example on an io_service of the caller's choosing.
+// Spans passed in must stay valid until the request completes.
+
+template <typename Session, typename Executor>
+class put_awaitable
+{
+public:
+	put_awaitable(Session& ses, Executor& ex, list_token const& token
+		, gsl::span<gsl::byte const> contents)
+		: m_ses(ses), m_ex(ex), m_token(token), m_contents(contents) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		m_ses.put(m_token, m_contents, [this, h] { m_ex.post([h] { h.resume(); }); });
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	Session& m_ses;
+	Executor& m_ex;
+	list_token m_token;
+	gsl::span<gsl::byte const> m_contents;
+};
+
+struct get_result
+{
+	// empty if the item wasn't found
+	std::vector<gsl::byte> contents;
+	// all zeros at the end of the list
+	hash next_hash;
+};
+
+template <typename Session, typename Executor>
+class get_awaitable
+{
+public:
+	get_awaitable(Session& ses, Executor& ex, hash const& address)
+		: m_ses(ses), m_ex(ex), m_address(address) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		m_ses.get(m_address, [this, h](std::vector<gsl::byte> contents, hash const& next_hash)
+		{
+			m_result.contents = std::move(contents);
+			m_result.next_hash = next_hash;
+			m_ex.post([h] { h.resume(); });
+		});
+	}
+
+	get_result await_resume() { return std::move(m_result); }
+
+private:
+	Session& m_ses;
+	Executor& m_ex;
+	hash m_address;
+	get_result m_result;
+};
+
+struct sync_result
+{
+	// the entries received from the DHT which were new or newer than ours,
+	// in the order they arrived
+	std::vector<entry> received;
+	// the entries written back to the DHT
+	std::vector<entry> stored;
+};
+
+template <typename Session, typename Executor>
+class synchronize_awaitable
+{
+public:
+	synchronize_awaitable(Session& ses, Executor& ex, secret_key const& shared_key
+		, std::vector<entry> entries, finalize_entries finalize_cb)
+		: m_ses(ses), m_ex(ex), m_key(shared_key), m_entries(std::move(entries))
+		, m_finalize(std::move(finalize_cb)) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	// the callbacks all run on the network thread before the coroutine is
+	// resumed, so the result needs no locking
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		m_ses.synchronize(m_key, std::move(m_entries)
+			, [this](entry const& e) { m_result.received.push_back(e); }
+			, [this](std::vector<entry>& entries)
+			{
+				if (m_finalize) m_finalize(entries);
+				m_result.stored = entries;
+			}
+			, [this, h] { m_ex.post([h] { h.resume(); }); });
+	}
+
+	sync_result await_resume() { return std::move(m_result); }
+
+private:
+	Session& m_ses;
+	Executor& m_ex;
+	secret_key m_key;
+	std::vector<entry> m_entries;
+	finalize_entries m_finalize;
+	sync_result m_result;
+};
+
+template <typename Session, typename Executor>
+put_awaitable<Session, Executor> async_put(Session& ses, Executor& ex
+	, list_token const& token, gsl::span<gsl::byte const> contents)
+{
+	return { ses, ex, token, contents };
+}
+
+template <typename Session, typename Executor>
+get_awaitable<Session, Executor> async_get(Session& ses, Executor& ex, hash const& address)
+{
+	return { ses, ex, address };
+}
+
+// finalize_cb, if set, may modify the merged list before it is stored, as
+// with dht_session::synchronize
+template <typename Session, typename Executor>
+synchronize_awaitable<Session, Executor> async_synchronize(Session& ses, Executor& ex
+	, secret_key const& shared_key, std::vector<entry> entries
+	, finalize_entries finalize_cb = finalize_entries())
+{
+	return { ses, ex, shared_key, std::move(entries), std::move(finalize_cb) };
+}
+
+} // namespace scout
+
+#endif // __cpp_impl_coroutine
+
+#endif
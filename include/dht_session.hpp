@@ -19,6 +19,8 @@ limitations under the License.
 
 #include <thread>
 #include <future>
+#include <map>
+#include <mutex>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <dht.h>
@@ -26,6 +28,10 @@ limitations under the License.
 #include <libminiupnpc/igd_desc_parse.h>
 #include "udp_socket.hpp"
 #include "scout.hpp"
+#include "session_stats.hpp"
+#include "tracing.hpp"
+#include "packet_capture.hpp"
+#include "completion_queue.hpp"
 
 namespace scout
 {
@@ -42,6 +48,75 @@ struct upnp_mapping
 	char servicetype[MINIUPNPC_URL_MAXSIZE];
 };
 
+// configuration of a dht_session, fixed once the session is constructed
+struct session_settings
+{
+	session_settings();
+
+	// the nodes used to join the DHT, as host name (or IP) and port. Defaults
+	// to the public BitTorrent routers
+	std::vector<std::pair<std::string, int>> bootstrap_nodes;
+
+	// the local address to bind the DHT socket to
+	boost::asio::ip::address bind_address;
+
+	// the port to bind to. 0 picks a random port, trying successive ports if
+	// it is busy. An explicit port is only tried once
+	std::uint16_t port;
+
+	// load the DHT state from and save it to dht.dat in the working directory
+	bool persist_state;
+
+	// map the DHT port on the gateway with NAT-PMP and UPnP
+	bool map_ports;
+
+	// the upload rate limit of the DHT, in bytes per second
+	int rate_limit;
+
+	// when false, packets the DHT tries to send are dropped. This is meant
+	// for replaying captures without answering the nodes in them
+	bool send_packets;
+
+	// the relative share of the send budget, and the maximum number of
+	// requests in flight, for each op_priority
+	std::array<int, num_op_priorities> priority_weights;
+	std::array<int, num_op_priorities> max_outstanding;
+
+	// the send budget requests are admitted against, in bytes per second of
+	// what they are estimated to send. The estimates are rough, so this is
+	// separate from rate_limit, which the DHT enforces on what it actually
+	// sends. 0 disables it, leaving requests only held back by max_outstanding
+	int send_budget;
+
+	// when a get's lookup hasn't answered after this percentile (0 - 1) of
+	// recent lookup times, start a second one and take whichever finds the
+	// item first. 0 disables hedging
+	double hedge_percentile;
+	// the share of lookups which may be hedged, bounding the extra traffic
+	double hedge_budget;
+};
+
+// per-request options for dht_session
+struct op_options
+{
+	op_options() : timeout(0), priority(op_priority::normal) {}
+
+	// end the request with status timed_out if it hasn't completed this long
+	// after it was issued. Zero means no deadline
+	std::chrono::milliseconds timeout;
+
+	// requests are started in priority order, see op_priority
+	op_priority priority;
+};
+
+struct metrics_server;
+struct op_timer;
+struct get_flight;
+struct get_waiter;
+struct sync_flight;
+struct sync_waiter;
+class op_scheduler;
+
 class dht_session
 {
 	friend struct ip_change_observer_session;
@@ -54,11 +129,14 @@ public:
 		QUITTING,
 	};
 
-	dht_session();
+	explicit dht_session(session_settings const& settings = session_settings());
+	// run requests against dht rather than a DHT node of its own. Meant for
+	// tests
+	dht_session(session_settings const& settings, smart_ptr<IDht> dht);
 	~dht_session();
 
 	// start the dht client
-	// the client will start listening on a random port and bootstrap its routing table
+	// the client will start listening on the configured port and bootstrap its routing table
 	// if this function returns zero the session is ready to handle requests
 	// otherwise an error occurred
 	int start();
@@ -69,19 +147,82 @@ public:
 
 	// Note: See the corresponding functions in scout.hpp for more details on
 	// each type of request.
+	//
+	// Every request returns a handle which can cancel it from any thread, as
+	// long as the session is alive. A cancelled or timed out request invokes
+	// its final callback right away on the network thread, and the handle's
+	// status() tells it apart from a completed one
 
 	// synchronize a list of entries with the DHT
 	// this will first update the given vector with any new or updated entries from the DHT
 	// then store the updated list in the DHT
-	void synchronize(secret_key_span shared_key, std::vector<entry> entries
-		, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb);
+	op_handle synchronize(secret_key_span shared_key, std::vector<entry> entries
+		, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb
+		, op_options const& options = op_options());
+	// as above, but the new and updated entries are passed to entries_cb in
+	// a single call before finalize_cb
+	op_handle synchronize(secret_key_span shared_key, std::vector<entry> entries
+		, entries_updated entries_cb, finalize_entries finalize_cb, sync_finished finished_cb
+		, op_options const& options = op_options());
 
 	// store an immutable item in the DHT
-	void put(list_token const& token, gsl::span<gsl::byte const> contents
-		, put_finished finished_cb);
+	op_handle put(list_token const& token, gsl::span<gsl::byte const> contents
+		, put_finished finished_cb, op_options const& options = op_options());
 
 	// retrieve an immutable item from the DHT
-	void get(hash_span address, item_received received_cb);
+	op_handle get(hash_span address, item_received received_cb
+		, op_options const& options = op_options());
+	// the same without copying the contents, which are only valid until
+	// viewed_cb returns
+	op_handle get_view(hash_span address, item_viewed viewed_cb
+		, op_options const& options = op_options());
+
+	// The same requests, but rather than invoking callbacks on the network
+	// thread the result is posted to q, carrying the id of the returned
+	// handle. q must outlive the request.
+	// synchronize doesn't report individual updated entries, its completion
+	// carries the merged list of entries as it was stored
+	op_handle synchronize(secret_key_span shared_key, std::vector<entry> entries
+		, completion_queue& q, op_options const& options = op_options());
+	op_handle put(list_token const& token, gsl::span<gsl::byte const> contents
+		, completion_queue& q, op_options const& options = op_options());
+	op_handle get(hash_span address, completion_queue& q
+		, op_options const& options = op_options());
+
+	// return a snapshot of the session's counters
+	// if reset_histograms is true the latency histograms are cleared, so the next
+	// snapshot only covers the interval since this call
+	// this may be called from any thread
+	session_stats get_stats(bool reset_histograms = false)
+	{ return m_counters.snapshot(reset_histograms); }
+
+	// append the session's statistics to out in the OpenMetrics text format
+	// this may be called from any thread
+	void render_metrics(std::string& out);
+
+	// serve render_metrics() over HTTP at http://127.0.0.1:<port>/metrics
+	// for Prometheus to scrape. Requests are handled by the session's worker
+	// thread, so the endpoint is only live between start() and stop().
+	// Pass 0 to pick a free port. Returns the port on success or -1 on error,
+	// including when the endpoint is already running
+	int serve_metrics(std::uint16_t port);
+
+	// record every DHT packet sent and received to a pcap file, replacing
+	// any capture in progress. Returns false if the file can't be opened
+	bool start_capture(std::string const& filename);
+	void stop_capture();
+
+	// process packets as if they had been received from the network. The
+	// outgoing packets of a capture are skipped. done is called on the
+	// network thread once all of them have been handled
+	void inject_packets(std::vector<captured_packet> packets, std::function<void()> done);
+
+	// report the lifecycle of every subsequent request to tracer, or stop
+	// tracing if it is null. Requests already in flight keep the tracer they
+	// started with. The tracer is called from the calling thread and the
+	// network thread. This has no effect unless scout is built with
+	// tracing=on
+	void set_tracer(std::shared_ptr<op_tracer> tracer);
 
 private:
 	bool is_quitting() const { return m_state == QUITTING; }
@@ -92,7 +233,57 @@ private:
 	void on_natpmp_timer(error_code const& ec);
 	void on_ip_changed(udp::endpoint const& new_ip);
 	void incoming_packet(char* buf, size_t len, udp::endpoint const& ep);
+	void sample_dht_stats();
+	void start_port_mapping();
+	std::shared_ptr<op_timer> make_timer(op_type t);
+	op_handle make_handle(op_timer const& timer);
+	std::shared_ptr<boost::asio::steady_timer> start_deadline(op_handle const& h
+		, std::chrono::steady_clock::time_point deadline);
+	void schedule(op_priority p, int estimated_bytes, op_handle const& h
+		, std::function<void(op_priority)> job);
+	void run_scheduler();
+	void wake_scheduler();
+	void on_schedule_timer(error_code const& ec);
+	void op_done(op_priority p);
+	op_handle start_get(hash_span address, op_options const& options
+		, std::function<void(op_handle const&, gsl::span<gsl::byte const>, hash const&)> deliver);
+	void start_lookup(std::shared_ptr<get_flight> const& flight
+		, std::shared_ptr<get_waiter> const& leader, op_priority p);
+	void join_flight(std::shared_ptr<get_flight> const& flight
+		, std::shared_ptr<get_waiter> const& w, std::chrono::steady_clock::time_point deadline);
+	void leave_flight(std::shared_ptr<get_flight> const& flight
+		, std::shared_ptr<get_waiter> const& w);
+	void end_flight(std::shared_ptr<get_flight> const& flight
+		, gsl::span<gsl::byte const> contents, hash const& next_hash);
+	static void answer(get_waiter& w, op_status s, gsl::span<gsl::byte const> contents
+		, hash const& next_hash);
+	void start_hedge_timer(std::shared_ptr<get_flight> const& flight);
+	void start_hedge(std::shared_ptr<get_flight> const& flight, op_priority p);
+	void lookup_done(std::shared_ptr<get_flight> const& flight, bool hedge
+		, gsl::span<gsl::byte const> contents, hash const& next_hash);
+	void record_get_latency(session_counters::clock::duration d);
+	op_handle start_synchronize(secret_key_span shared_key, std::vector<entry> entries
+		, op_options const& options, entry_updated entry_cb, entries_updated entries_cb
+		, finalize_entries finalize_cb, std::function<void(op_handle const&)> finished);
+	void schedule_sync(std::shared_ptr<sync_flight> const& flight);
+	void join_sync_flight(std::shared_ptr<sync_flight> const& flight
+		, std::shared_ptr<sync_waiter> const& w);
+	void start_sync_flight(std::shared_ptr<sync_flight> const& flight, op_priority p);
+	void leave_sync_flight(std::shared_ptr<sync_flight> const& flight
+		, std::shared_ptr<sync_waiter> const& w);
+	void end_sync_flight(std::shared_ptr<sync_flight> const& flight);
+	static void answer(sync_waiter& w, op_status s);
+	static void deliver_updates(sync_flight& flight);
 
+	// the synchronize running for a key and the one which will follow it,
+	// which every synchronize issued in the meantime is merged into
+	struct sync_chain
+	{
+		std::shared_ptr<sync_flight> running;
+		std::shared_ptr<sync_flight> next;
+	};
+
+	session_settings const m_settings;
 	boost::asio::io_service m_ios;
 	std::uint16_t m_dht_external_port;
 	run_state m_state;
@@ -110,6 +301,31 @@ private:
 	bool m_is_natpmp_mapped;
 	std::vector<std::pair<std::string, int>> m_bootstrap_nodes;
 	int m_dht_rate_limit;
+	session_counters m_counters;
+	std::unique_ptr<op_scheduler> m_scheduler;
+	// wakes up the scheduler when the send budget admits more requests
+	boost::asio::steady_timer m_schedule_timer;
+	std::atomic<std::uint64_t> m_next_op_id{1};
+	// lookups in flight by target, so concurrent gets for the same hash
+	// share one, and synchronizes by target key. Requests join from the
+	// calling thread
+	std::mutex m_flights_mutex;
+	std::map<hash, std::shared_ptr<get_flight>> m_get_flights;
+	std::map<public_key, sync_chain> m_sync_flights;
+
+	// the hedge delay is recomputed every hedge_window lookups. Only used
+	// on the network thread
+	enum { hedge_window = 64, max_hedge_burst = 10 };
+	latency_histogram m_get_latency;
+	int m_get_latency_samples = 0;
+	std::chrono::microseconds m_hedge_delay{0};
+	// earned by each lookup and spent by each hedge
+	double m_hedge_tokens = 0.;
+#if SCOUT_TRACING
+	std::shared_ptr<op_tracer> m_tracer;
+#endif
+	// declared after m_ios_worker so it is destroyed before it
+	std::unique_ptr<metrics_server> m_metrics_server;
 };
 
 } // namespace scout
@@ -0,0 +1,107 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_HISTOGRAM_HPP
+#define SCOUT_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace scout
+{
+
+// Latencies are bucketed log-linearly, in the style of HdrHistogram. Every
+// power of two range of microseconds is split into sub_buckets linear
+// buckets, so a value is reported with a relative error of at most
+// 1/sub_buckets no matter how large it is. Values below sub_buckets
+// microseconds get a bucket each and values above max_value land in the
+// last bucket.
+struct histogram_layout
+{
+	enum
+	{
+		sub_bucket_bits = 4,
+		sub_buckets = 1 << sub_bucket_bits,
+		// the largest tracked value is 2^max_exponent microseconds (~19 hours)
+		max_exponent = 36,
+		num_buckets = sub_buckets * (max_exponent - sub_bucket_bits + 1),
+	};
+
+	static int bucket_for(std::uint64_t us);
+	// the smallest value counted by the given bucket
+	static std::uint64_t bucket_lower(int bucket);
+	// one past the largest value counted by the given bucket
+	static std::uint64_t bucket_upper(int bucket);
+};
+
+// a copy of a latency_histogram at one point in time, all values are in
+// microseconds
+struct histogram_snapshot
+{
+	histogram_snapshot();
+
+	// counts indexed by bucket, see histogram_layout
+	std::vector<std::uint64_t> buckets;
+	std::uint64_t count;
+	std::uint64_t sum;
+	std::uint64_t max;
+
+	// the value at or below which the given fraction (0 - 1) of samples
+	// fall. This is the highest value of the matching bucket, so the result
+	// never under-reports
+	std::uint64_t percentile(double fraction) const;
+	std::uint64_t p50() const { return percentile(0.5); }
+	std::uint64_t p99() const { return percentile(0.99); }
+	std::uint64_t p999() const { return percentile(0.999); }
+	std::uint64_t mean() const { return count == 0 ? 0 : sum / count; }
+
+	// add the samples of another snapshot to this one, for aggregating
+	// histograms from several sessions
+	void merge(histogram_snapshot const& o);
+};
+
+// A fixed size histogram of latencies. Recording is a handful of relaxed
+// atomic operations with no locks or allocations, so it can be left enabled
+// in production and written to from any thread.
+class latency_histogram
+{
+public:
+	latency_histogram();
+
+	latency_histogram(latency_histogram const&) = delete;
+	latency_histogram& operator=(latency_histogram const&) = delete;
+
+	void record(std::chrono::microseconds latency);
+
+	histogram_snapshot snapshot() const;
+
+	// like snapshot() but clears each counter as it is read. Samples recorded
+	// concurrently end up in exactly one of this or the next snapshot
+	histogram_snapshot snapshot_and_reset();
+
+private:
+	std::array<std::atomic<std::uint64_t>, histogram_layout::num_buckets> m_buckets;
+	std::atomic<std::uint64_t> m_count;
+	std::atomic<std::uint64_t> m_sum;
+	std::atomic<std::uint64_t> m_max;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,141 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_INPLACE_FUNCTION_HPP
+#define SCOUT_INPLACE_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace scout
+{
+
+template <typename Signature, std::size_t Capacity>
+class inplace_function;
+
+// A move-only std::function which stores its callable in a fixed size buffer
+// inside the object. It never allocates: a callable larger than Capacity
+// bytes fails to compile rather than falling back to the heap.
+// The converting constructor is explicit so that overloads taking either
+// this or std::function aren't ambiguous for a plain lambda.
+template <typename R, typename... Args, std::size_t Capacity>
+class inplace_function<R(Args...), Capacity>
+{
+public:
+	inplace_function() : m_ops(nullptr) {}
+	inplace_function(std::nullptr_t) : m_ops(nullptr) {}
+
+	template <typename F, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, inplace_function>::value>::type>
+	explicit inplace_function(F&& f)
+	{
+		using T = typename std::decay<F>::type;
+		static_assert(sizeof(T) <= Capacity, "callable doesn't fit in inplace_function");
+		static_assert(alignof(T) <= alignof(storage), "callable is over-aligned for inplace_function");
+		::new (static_cast<void*>(&m_storage)) T(std::forward<F>(f));
+		m_ops = &ops_for<T>::value;
+	}
+
+	inplace_function(inplace_function&& o) : m_ops(o.m_ops)
+	{
+		if (m_ops) m_ops->relocate(&m_storage, &o.m_storage);
+		o.m_ops = nullptr;
+	}
+
+	inplace_function& operator=(inplace_function&& o)
+	{
+		if (this == &o) return *this;
+		reset();
+		m_ops = o.m_ops;
+		if (m_ops) m_ops->relocate(&m_storage, &o.m_storage);
+		o.m_ops = nullptr;
+		return *this;
+	}
+
+	inplace_function& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	inplace_function(inplace_function const&) = delete;
+	inplace_function& operator=(inplace_function const&) = delete;
+
+	~inplace_function() { reset(); }
+
+	explicit operator bool() const { return m_ops != nullptr; }
+
+	// must not be called when empty
+	R operator()(Args... args) const
+	{
+		return m_ops->invoke(&m_storage, std::forward<Args>(args)...);
+	}
+
+private:
+	using storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+
+	struct ops
+	{
+		R (*invoke)(void* f, Args&&... args);
+		// move construct dst from src and destroy src
+		void (*relocate)(void* dst, void* src);
+		void (*destroy)(void* f);
+	};
+
+	template <typename T>
+	struct ops_for
+	{
+		static R invoke(void* f, Args&&... args)
+		{
+			return (*static_cast<T*>(f))(std::forward<Args>(args)...);
+		}
+
+		static void relocate(void* dst, void* src)
+		{
+			T* s = static_cast<T*>(src);
+			::new (dst) T(std::move(*s));
+			s->~T();
+		}
+
+		static void destroy(void* f) { static_cast<T*>(f)->~T(); }
+
+		static constexpr ops value = { &invoke, &relocate, &destroy };
+	};
+
+	void reset()
+	{
+		if (!m_ops) return;
+		ops const* o = m_ops;
+		m_ops = nullptr;
+		o->destroy(&m_storage);
+	}
+
+	ops const* m_ops;
+	// the callable is logically part of the object's value, like the target
+	// of a std::function, so calling it doesn't require a non-const object
+	mutable storage m_storage;
+};
+
+template <typename R, typename... Args, std::size_t Capacity>
+template <typename T>
+constexpr typename inplace_function<R(Args...), Capacity>::ops
+	inplace_function<R(Args...), Capacity>::ops_for<T>::value;
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,126 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_LOGGING_HPP
+#define SCOUT_LOGGING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+
+// messages below this level are compiled out entirely
+// 0 = debug, 1 = info, 2 = warning, 3 = error, 4 = off
+// see the log-level feature in Jamroot.jam
+#ifndef SCOUT_LOG_MIN_LEVEL
+#define SCOUT_LOG_MIN_LEVEL 0
+#endif
+
+namespace scout
+{
+
+enum class log_level : int
+{
+	debug = 0,
+	info = 1,
+	warning = 2,
+	error = 3,
+	off = 4,
+};
+
+struct log_message
+{
+	log_level level;
+	// the time the message was logged, not when it reached the sink
+	std::chrono::system_clock::time_point time;
+	// null terminated, without a trailing newline
+	char const* text;
+	std::size_t length;
+};
+
+// called on the logging thread for every message which passes the level filter
+using log_sink = std::function<void(log_message const& msg)>;
+
+// Messages are formatted by the calling thread into a fixed size lock-free
+// ring buffer and handed to the sink from a background thread, so logging
+// never blocks on I/O. If the ring is full the message is dropped and a
+// count of dropped messages is reported once there is room again.
+
+// set the lowest level which will be logged. May be called at any time
+void set_log_level(log_level level);
+log_level get_log_level();
+
+// route log messages to the given function instead of stderr
+// passing an empty function restores the default stderr sink
+void set_log_sink(log_sink sink);
+
+// block until every message logged before this call has been passed to the sink
+void flush_log();
+
+namespace detail
+{
+	extern std::atomic<int> g_log_level;
+	void log_write(log_level level, char const* fmt, ...);
+}
+
+inline bool should_log(log_level level)
+{
+	return int(level) >= SCOUT_LOG_MIN_LEVEL
+		&& int(level) >= detail::g_log_level.load(std::memory_order_relaxed);
+}
+
+} // namespace scout
+
+// printf-style logging functions
+// the level check is inlined so disabled levels only cost a relaxed load
+
+template <typename... Args>
+inline void log_debug(char const* fmt, Args... args)
+{
+#if SCOUT_LOG_MIN_LEVEL <= 0
+	if (scout::should_log(scout::log_level::debug))
+		scout::detail::log_write(scout::log_level::debug, fmt, args...);
+#endif
+}
+
+template <typename... Args>
+inline void log_info(char const* fmt, Args... args)
+{
+#if SCOUT_LOG_MIN_LEVEL <= 1
+	if (scout::should_log(scout::log_level::info))
+		scout::detail::log_write(scout::log_level::info, fmt, args...);
+#endif
+}
+
+template <typename... Args>
+inline void log_warning(char const* fmt, Args... args)
+{
+#if SCOUT_LOG_MIN_LEVEL <= 2
+	if (scout::should_log(scout::log_level::warning))
+		scout::detail::log_write(scout::log_level::warning, fmt, args...);
+#endif
+}
+
+template <typename... Args>
+inline void log_error(char const* fmt, Args... args)
+{
+#if SCOUT_LOG_MIN_LEVEL <= 3
+	if (scout::should_log(scout::log_level::error))
+		scout::detail::log_write(scout::log_level::error, fmt, args...);
+#endif
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_METRICS_HPP
+#define SCOUT_METRICS_HPP
+
+#include <string>
+#include "session_stats.hpp"
+
+namespace scout
+{
+
+// the content type of the output of render_metrics()
+extern char const* const openmetrics_content_type;
+
+// append the given statistics to out in the OpenMetrics text exposition
+// format, ready to be scraped by Prometheus. Latency histograms are reported
+// in seconds with a fixed set of bucket boundaries; the count for each
+// boundary is rounded down to the resolution of the underlying histogram
+void render_metrics(session_stats const& stats, std::string& out);
+
+} // namespace scout
+
+#endif
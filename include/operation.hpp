@@ -0,0 +1,99 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_OPERATION_HPP
+#define SCOUT_OPERATION_HPP
+
+namespace scout
+{
+
+enum class op_type : int
+{
+	synchronize,
+	put,
+	get,
+};
+
+// the steps an operation goes through. Not every type of operation goes
+// through every phase, and decrypt and callback may occur several times
+enum class op_phase : int
+{
+	// waiting on the network thread's queue
+	queue,
+	// looking up the target in the DHT. For synchronize this is the read
+	// phase, up until the updated entries are about to be written
+	lookup,
+	// decrypting and parsing a response (synchronize only)
+	decrypt,
+	// serializing and encrypting the entries to store (synchronize only)
+	encrypt,
+	// writing to the DHT
+	store,
+	// running an application callback
+	callback,
+};
+
+// how an operation ended
+enum class op_status : int
+{
+	// still running
+	pending,
+	success,
+	// a get found no item at the requested hash
+	not_found,
+	// ended early by op_handle::cancel()
+	cancelled,
+	// ended early because its deadline passed
+	timed_out,
+};
+
+// the scheduling class of a request issued through a dht_session. Higher
+// classes get a larger share of the DHT's send budget and are admitted first
+enum class op_priority : int
+{
+	// the user is waiting on the result
+	interactive,
+	normal,
+	// periodic work such as republishing, which may be delayed
+	background,
+};
+
+enum
+{
+	num_op_types = 3,
+	num_op_phases = 6,
+	num_op_priorities = 3,
+};
+
+char const* op_type_name(op_type t);
+char const* op_phase_name(op_phase p);
+
+// Receives notifications as an operation moves through its phases. All
+// calls are made on the thread driving the DHT.
+struct op_observer
+{
+	virtual void phase_begin(op_phase p) = 0;
+	virtual void phase_end(op_phase p) = 0;
+	// a point of interest within the current phase, such as a response
+	// arriving from a DHT node. name is a string literal
+	virtual void event(char const* name) {}
+protected:
+	~op_observer() {}
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,98 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_PACKET_CAPTURE_HPP
+#define SCOUT_PACKET_CAPTURE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <boost/asio/ip/udp.hpp>
+
+namespace scout
+{
+
+enum class packet_direction : int
+{
+	incoming,
+	outgoing,
+};
+
+struct captured_packet
+{
+	packet_direction direction;
+	std::chrono::system_clock::time_point time;
+	// the other end of the exchange, the sender of incoming packets and the
+	// destination of outgoing ones
+	boost::asio::ip::udp::endpoint remote;
+	boost::asio::ip::udp::endpoint local;
+	std::vector<char> payload;
+};
+
+// Writes datagrams to a pcap file which can be opened in Wireshark or read
+// back with capture_reader. Packets are stored with the Linux cooked link
+// type, whose packet type field records the direction, behind synthesized
+// IPv4 and UDP headers. IPv6 packets are not captured.
+class packet_capture
+{
+public:
+	// the file is truncated. Check is_open() for errors
+	explicit packet_capture(char const* filename);
+	~packet_capture();
+
+	packet_capture(packet_capture const&) = delete;
+	packet_capture& operator=(packet_capture const&) = delete;
+
+	bool is_open() const { return m_file != nullptr; }
+
+	void record(packet_direction dir, char const* buf, std::size_t len
+		, boost::asio::ip::udp::endpoint const& remote
+		, boost::asio::ip::udp::endpoint const& local);
+
+	// the number of packets written
+	std::uint64_t packets() const { return m_packets; }
+
+private:
+	std::FILE* m_file;
+	std::uint64_t m_packets;
+};
+
+// reads back the files written by packet_capture
+class capture_reader
+{
+public:
+	// check is_open() for errors
+	explicit capture_reader(char const* filename);
+	~capture_reader();
+
+	capture_reader(capture_reader const&) = delete;
+	capture_reader& operator=(capture_reader const&) = delete;
+
+	bool is_open() const { return m_file != nullptr; }
+
+	// read the next UDP packet, skipping records in other formats. Returns
+	// false at the end of the file or on a truncated record
+	bool next(captured_packet& p);
+
+private:
+	std::FILE* m_file;
+	std::vector<unsigned char> m_buffer;
+};
+
+} // namespace scout
+
+#endif
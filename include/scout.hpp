@@ -19,10 +19,15 @@ limitations under the License.
 
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <span.h>
 #include <dht.h>
+#include "operation.hpp"
+#include "inplace_function.hpp"
 
 namespace scout
 {
@@ -37,21 +42,46 @@ using hash = std::array<gsl::byte, 20>;
 using hash_span = gsl::span<gsl::byte, 20>;
 using chash_span = gsl::span<gsl::byte const, 20>;
 
+// why data received from the network couldn't be parsed
+enum class parse_error
+{
+	none,
+	// the input ends in the middle of a header
+	truncated,
+	// an offset or length in a header points past the end of the input
+	bad_length
+};
+
 // a mutable blob of data
 // each entry has an id associated with it which must be unique among the entries it is stored with
+// the contents are stored inline, so copying an entry doesn't allocate
 class entry
 {
 public:
-	entry(uint32_t id) : m_seq(0), m_id(id) {}
+	// the most content an entry can hold
+	enum { max_contents = 255 };
+
+	entry(uint32_t id) : m_seq(0), m_id(id), m_size(0) {}
+
+	// only the used part of the contents is copied
+	entry(entry const& o) : m_seq(o.m_seq), m_id(o.m_id), m_size(o.m_size)
+	{
+		std::copy(o.m_contents.begin(), o.m_contents.begin() + m_size, m_contents.begin());
+	}
 
+	// throws std::length_error if the input is malformed
 	static std::pair<entry, gsl::span<gsl::byte const>> parse(gsl::span<gsl::byte const> input);
+	// parse the entry at the start of input into e and advance input past it.
+	// Neither is changed on error
+	static parse_error try_parse(gsl::span<gsl::byte const>& input, entry& e) noexcept;
 	gsl::span<gsl::byte> serialize(gsl::span<gsl::byte> output) const;
 
 	uint32_t id() const { return m_id; }
-	std::vector<gsl::byte> const& value() const { return m_contents; }
+	gsl::span<gsl::byte const> value() const { return{ m_contents.data(), std::ptrdiff_t(m_size) }; }
+	// contents longer than max_contents are truncated
 	void assign(gsl::span<gsl::byte const> contents)
 	{
-		m_contents.assign(contents.begin(), contents.end());
+		update_contents(contents);
 		++m_seq;
 	}
 
@@ -67,29 +97,34 @@ public:
 	{
 		return m_id == o.m_id
 			&& m_seq == o.m_seq
-			&& m_contents == o.m_contents;
+			&& m_size == o.m_size
+			&& std::equal(m_contents.begin(), m_contents.begin() + m_size, o.m_contents.begin());
 	}
 
-	entry& operator=(entry o)
+	entry& operator=(entry const& o)
 	{
 		m_id = o.m_id;
 		m_seq = o.m_seq;
-		m_contents = o.m_contents;
+		m_size = o.m_size;
+		std::copy(o.m_contents.begin(), o.m_contents.begin() + m_size, m_contents.begin());
 		return *this;
 	}
 
 	// for internal use:
 	int64_t seq() const { return m_seq; }
 	void update_seq(int64_t seq) { m_seq = seq; }
-	void update_contents(std::vector<gsl::byte> contents) { m_contents = contents; }
+	void update_contents(gsl::span<gsl::byte const> contents)
+	{
+		assert(contents.size() <= max_contents);
+		m_size = uint8_t((std::min)(std::ptrdiff_t(max_contents), contents.size()));
+		std::copy(contents.begin(), contents.begin() + m_size, m_contents.begin());
+	}
 
 private:
-	entry(int64_t seq, uint32_t id, std::vector<gsl::byte> content)
-		: m_contents(std::move(content)), m_seq(seq), m_id(id) {}
-
-	std::vector<gsl::byte> m_contents;
+	std::array<gsl::byte, max_contents> m_contents;
 	int64_t m_seq;
 	uint32_t m_id;
+	uint8_t m_size;
 };
 
 // a token is associated with each piece of immutable data stored in a list
@@ -99,8 +134,17 @@ class list_token
 public:
 	friend class list_head;
 
+	list_token()
+	{
+		m_next.fill(gsl::byte(0));
+	}
+
 	// input span must be extactly the size of the serialized token
+	// throws std::length_error if it is shorter
 	static list_token parse(gsl::span<gsl::byte const> input);
+	// parse the token at the start of input into t and advance input past it.
+	// Neither is changed on error
+	static parse_error try_parse(gsl::span<gsl::byte const>& input, list_token& t) noexcept;
 	gsl::span<gsl::byte> serialize(gsl::span<gsl::byte> output) const;
 
 	hash const& next() const { return m_next; }
@@ -127,7 +171,11 @@ public:
 	}
 
 	// input span must be extactly the size of the serialized list head
+	// throws std::length_error if it is shorter
 	static list_head parse(gsl::span<gsl::byte const> input);
+	// parse the list head at the start of input into h and advance input past
+	// it. Neither is changed on error
+	static parse_error try_parse(gsl::span<gsl::byte const>& input, list_head& h) noexcept;
 	gsl::span<gsl::byte> serialize(gsl::span<gsl::byte> output) const;
 
 	// add an item to the linked-list
@@ -162,10 +210,17 @@ gsl::span<gsl::byte> serialize(gsl::span<entry const> entries, gsl::span<gsl::by
 
 // parse a list of entries as generated by serialize()
 // returns a span starting at one past the last byte used to store the entries
+// throws std::length_error if the input is malformed
 gsl::span<gsl::byte const> parse(gsl::span<gsl::byte const> input, std::vector<entry>& entries);
+// the same, appending the entries and advancing input past them. Neither is
+// changed on error. Only throws if allocating fails
+parse_error try_parse(gsl::span<gsl::byte const>& input, std::vector<entry>& entries);
 
 // called when a new or updated entry is received from the DHT
 using entry_updated = std::function<void(entry const& e)>;
+// called once, just before finalize_entries, with every entry which was new
+// or updated in the DHT. Not called if there were none
+using entries_updated = std::function<void(gsl::span<entry const> entries)>;
 // called just before the list of entries is stored in the DHT
 using finalize_entries = std::function<void(std::vector<entry>& entries)>;
 // called when storing the current entry list has completed
@@ -174,14 +229,91 @@ using sync_finished = std::function<void()>;
 // the DHT transaction ends after this function is called
 // if no value is found an empty span will be passed
 using item_received = std::function<void(std::vector<gsl::byte> contents, hash const& next_hash)>;
+// the same, but the contents refer to the DHT's buffer and are only valid
+// until the function returns
+using item_viewed = std::function<void(gsl::span<gsl::byte const> contents, hash const& next_hash)>;
 // called when a put has completed
 using put_finished = std::function<void()>;
 
+// Move-only counterparts of the callbacks above which are stored inline, so
+// passing one to synchronize(), put() or get() doesn't allocate. A callable
+// bigger than callback_capacity bytes fails to compile. The std::function
+// overloads are converted to these, a std::function fits.
+enum { callback_capacity = 64 };
+using entry_updated_fn = inplace_function<void(entry const& e), callback_capacity>;
+using entries_updated_fn = inplace_function<void(gsl::span<entry const> entries), callback_capacity>;
+using finalize_entries_fn = inplace_function<void(std::vector<entry>& entries), callback_capacity>;
+using sync_finished_fn = inplace_function<void(), callback_capacity>;
+using item_received_fn = inplace_function<void(std::vector<gsl::byte> contents
+	, hash const& next_hash), callback_capacity>;
+using item_viewed_fn = inplace_function<void(gsl::span<gsl::byte const> contents
+	, hash const& next_hash), callback_capacity>;
+using put_finished_fn = inplace_function<void(), callback_capacity>;
+
+namespace detail
+{
+	struct op_state;
+	struct op_access;
+}
+
+class dht_session;
+
+// refers to an operation started by synchronize(), put() or get(). Copies
+// refer to the same operation
+class op_handle
+{
+public:
+	// a handle for an operation which hasn't been started yet. Passing it to
+	// synchronize(), put() or get() attaches it to the new operation, so the
+	// operation's callbacks can capture it to check its status
+	op_handle();
+
+	// as above, but cancel() hands the cancellation to dispatch, which must
+	// run it on the thread driving the DHT. Without a dispatch function
+	// cancel() may only be called on that thread, and not from the
+	// operation's own entry_cb or finalize_cb
+	explicit op_handle(std::uint64_t id
+		, std::function<void(std::function<void()>)> dispatch);
+
+	// end the operation now, unless it has already completed. Its final
+	// callback is invoked as if nothing was found (get) or as if storing had
+	// finished (synchronize, put), with status() returning cancelled. The
+	// operation's callbacks and entries are released and its DHT traffic is
+	// abandoned where the DHT allows it
+	void cancel() const;
+
+	// pending until just before the final callback is invoked
+	op_status status() const;
+
+	// the id the session assigned the operation, 0 outside a session
+	std::uint64_t id() const;
+
+	// whether both refer to the same operation
+	bool operator==(op_handle const& o) const { return m_state == o.m_state; }
+	bool operator!=(op_handle const& o) const { return m_state != o.m_state; }
+
+private:
+	friend struct detail::op_access;
+	friend class dht_session;
+
+	// end the operation with status s. Only on the DHT thread
+	void abort(op_status s) const;
+
+	// set f to be called by abort(), once the status has been set
+	void set_abort(std::function<void()> f) const;
+	// the operation is about to invoke its final callback with status s
+	void complete(op_status s) const;
+
+	std::shared_ptr<detail::op_state> m_state;
+};
+
 // Synchronize a list of entries with the DHT. First entries are read from the
 // DHT then an updated list is written back.
 //
 // entry_cb will be called for any entries retrived from the DHT which are not in
-// the passed in entries vector or are newer than the entry found there
+// the passed in entries vector or are newer than the entry found there, as
+// each response arrives. The overloads taking entries_cb instead collect them
+// and make a single call with all of them once the read is complete
 //
 // finalize_cb will be called once the get operation has completed. It is passed a vector
 // containing the passed in entries merged with any new or updated entries retrived from the DHT.
@@ -189,8 +321,23 @@ using put_finished = std::function<void()>;
 //
 // All entries in the vector passed to finalize_cb are written to the DHT. Once the put operation
 // is complete finished_cb is invoked
-void synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> const& entries
-	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb);
+//
+// if an observer is passed it is notified as the operation moves through each op_phase
+// it must outlive the operation, which ends when finished_cb is destroyed
+//
+// the returned handle is the one passed in, now attached to the operation
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entry_updated_fn entry_cb, finalize_entries_fn finalize_cb, sync_finished_fn finished_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entries_updated entries_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entries_updated_fn entries_cb, finalize_entries_fn finalize_cb, sync_finished_fn finished_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
 
 // store an immutable item in the DHT
 //
@@ -198,8 +345,12 @@ void synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> const
 // the contents
 //
 // finished_cb will be called once the put operation has completed
-void put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents
-	, put_finished finished_cb);
+op_handle put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents
+	, put_finished finished_cb, op_observer* observer = nullptr
+	, op_handle handle = op_handle());
+op_handle put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents
+	, put_finished_fn finished_cb, op_observer* observer = nullptr
+	, op_handle handle = op_handle());
 
 // retrieve an immutable item from the DHT identified by the given hash
 //
@@ -208,7 +359,17 @@ void put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents
 //
 // the next hash will be all zeros if it is the last message in the list
 // if the message is not found then received_cb will be called with empty contents
-void get(IDht& dht, chash_span address, item_received received_cb);
+op_handle get(IDht& dht, chash_span address, item_received received_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+op_handle get(IDht& dht, chash_span address, item_received_fn received_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+
+// the same without copying the message contents out of the DHT's buffer.
+// They may only be used until viewed_cb returns
+op_handle get_view(IDht& dht, chash_span address, item_viewed viewed_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
+op_handle get_view(IDht& dht, chash_span address, item_viewed_fn viewed_cb
+	, op_observer* observer = nullptr, op_handle handle = op_handle());
 
 }
 
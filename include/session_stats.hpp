@@ -0,0 +1,140 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_SESSION_STATS_HPP
+#define SCOUT_SESSION_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "histogram.hpp"
+#include "operation.hpp"
+
+namespace scout
+{
+
+struct op_stats
+{
+	// requests issued through the dht_session
+	std::uint64_t started;
+	// requests whose callback has been invoked. A get which found nothing
+	// counts as a failure
+	std::uint64_t succeeded;
+	std::uint64_t failed;
+	// started but not completed, including requests still queued
+	std::uint64_t outstanding;
+	// requests which were served by another request's DHT operation rather
+	// than starting their own: gets which joined a lookup of the same hash and
+	// synchronizes merged into the next store of the same key. Divided by
+	// started this is the share of DHT operations saved
+	std::uint64_t coalesced;
+	// from the call into dht_session until the completion callback
+	histogram_snapshot latency;
+	// time spent in each phase, indexed by op_phase
+	std::array<histogram_snapshot, num_op_phases> phases;
+};
+
+// a snapshot of a dht_session's counters, see dht_session::get_stats()
+struct session_stats
+{
+	std::array<op_stats, num_op_types> ops;
+
+	op_stats const& operator[](op_type t) const { return ops[int(t)]; }
+
+	std::uint64_t packets_in;
+	std::uint64_t packets_out;
+	std::uint64_t bytes_in;
+	std::uint64_t bytes_out;
+	// packets the socket failed to send
+	std::uint64_t send_failures;
+
+	// requests posted to the DHT thread which have not started yet
+	std::uint64_t queued;
+
+	// get lookups which were slow enough to start a second lookup, and how
+	// many of those the second one answered first
+	std::uint64_t gets_hedged;
+	std::uint64_t hedges_won;
+
+	// the following are sampled from the DHT once per tick
+	// number of nodes in the routing table
+	int routing_table_size;
+	// the DHT's current send rate and remaining quota, in bytes
+	int dht_rate;
+	int dht_quota;
+};
+
+// the live counters behind session_stats. All members may be updated from
+// any thread
+struct session_counters
+{
+	session_counters();
+
+	session_counters(session_counters const&) = delete;
+	session_counters& operator=(session_counters const&) = delete;
+
+	using clock = std::chrono::steady_clock;
+
+	// a request was issued and posted to the DHT thread
+	void op_queued(op_type t);
+	// a posted request started running on the DHT thread
+	void op_dequeued();
+	void op_finished(op_type t, bool success, clock::time_point start);
+	void record_phase(op_type t, op_phase p, std::chrono::microseconds duration);
+	// a request was merged into another request's DHT operation
+	void op_coalesced(op_type t);
+	void get_hedged();
+	void hedge_won();
+
+	void packet_in(std::size_t bytes);
+	void packet_out(std::size_t bytes, bool success);
+
+	// the histograms in the snapshot only cover samples recorded since the
+	// previous call with reset_histograms set. Counters are never reset
+	session_stats snapshot(bool reset_histograms = false);
+
+	struct op_counters
+	{
+		op_counters() : started(0), succeeded(0), failed(0), coalesced(0) {}
+		std::atomic<std::uint64_t> started;
+		std::atomic<std::uint64_t> succeeded;
+		std::atomic<std::uint64_t> failed;
+		std::atomic<std::uint64_t> coalesced;
+		latency_histogram latency;
+		std::array<latency_histogram, num_op_phases> phases;
+	};
+
+	std::array<op_counters, num_op_types> ops;
+
+	std::atomic<std::uint64_t> packets_in;
+	std::atomic<std::uint64_t> packets_out;
+	std::atomic<std::uint64_t> bytes_in;
+	std::atomic<std::uint64_t> bytes_out;
+	std::atomic<std::uint64_t> send_failures;
+	std::atomic<std::uint64_t> queued;
+	std::atomic<std::uint64_t> gets_hedged;
+	std::atomic<std::uint64_t> hedges_won;
+
+	std::atomic<int> routing_table_size;
+	std::atomic<int> dht_rate;
+	std::atomic<int> dht_quota;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,88 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_TRACING_HPP
+#define SCOUT_TRACING_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include "operation.hpp"
+
+// the trace hooks in dht_session are only compiled in when this is set
+// see the tracing feature in Jamroot.jam
+#ifndef SCOUT_TRACING
+#define SCOUT_TRACING 0
+#endif
+
+namespace scout
+{
+
+// Receives the lifecycle of every operation issued through a dht_session.
+// Each operation is identified by an id which is unique within the session.
+// Operations begin on the thread issuing them and continue on the network
+// thread, so implementations must be thread safe.
+struct op_tracer
+{
+	// the operation was issued
+	virtual void op_begin(std::uint64_t id, op_type t) = 0;
+	// the operation's final callback has returned
+	virtual void op_end(std::uint64_t id, op_type t) = 0;
+
+	virtual void phase_begin(std::uint64_t id, op_type t, op_phase p) = 0;
+	virtual void phase_end(std::uint64_t id, op_type t, op_phase p) = 0;
+
+	// a point of interest within an operation, such as a response from a
+	// DHT node. name is a string literal
+	virtual void event(std::uint64_t id, op_type t, char const* name) = 0;
+
+	virtual ~op_tracer() {}
+};
+
+// Writes trace events in the Chrome trace event format, which can be loaded
+// into chrome://tracing or Perfetto. Each operation is an async track with
+// its phases nested inside it.
+class chrome_trace_writer : public op_tracer
+{
+public:
+	// the file is truncated. Check is_open() for errors
+	explicit chrome_trace_writer(char const* filename);
+	~chrome_trace_writer();
+
+	chrome_trace_writer(chrome_trace_writer const&) = delete;
+	chrome_trace_writer& operator=(chrome_trace_writer const&) = delete;
+
+	bool is_open() const { return m_file != nullptr; }
+
+	void op_begin(std::uint64_t id, op_type t) override;
+	void op_end(std::uint64_t id, op_type t) override;
+	void phase_begin(std::uint64_t id, op_type t, op_phase p) override;
+	void phase_end(std::uint64_t id, op_type t, op_phase p) override;
+	void event(std::uint64_t id, op_type t, char const* name) override;
+
+private:
+	void write(std::uint64_t id, op_type t, char const* name, char phase);
+
+	std::mutex m_mutex;
+	std::FILE* m_file;
+	std::chrono::steady_clock::time_point const m_start;
+	bool m_first;
+};
+
+} // namespace scout
+
+#endif
@@ -25,6 +25,7 @@ limitations under the License.
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/signal_set.hpp>
 #include "utils.hpp" // for log_debug
+#include "packet_capture.hpp"
 
 // for _1, _2 etc.
 using namespace std::placeholders;
@@ -61,6 +62,7 @@ struct udp_socket : public std::enable_shared_from_this<udp_socket>
 		, m_sender(std::move(o.m_sender))
 		, m_handler(std::move(o.m_handler))
 		, m_abort(std::move(o.m_abort))
+		, m_capture(std::move(o.m_capture))
 	{
 		std::memcpy(m_receive_buffer, o.m_receive_buffer, sizeof(m_receive_buffer));
 	}
@@ -93,9 +95,20 @@ struct udp_socket : public std::enable_shared_from_this<udp_socket>
 
 			ret = m_socket.send_to(asio::buffer(buf, len), ep, 0, ec);
 		}
+		if (m_capture && !ec)
+			m_capture->record(scout::packet_direction::outgoing, buf, len, ep, m_local_ep);
 		return ret;
 	}
 
+	// record every datagram sent and received from now on to c, or stop
+	// recording if it's null. Must be called from the thread running the
+	// socket's io_service
+	void set_capture(std::shared_ptr<scout::packet_capture> c)
+	{
+		m_capture = std::move(c);
+		m_local_ep = local_endpoint();
+	}
+
 	udp::endpoint local_endpoint() const
 	{
 		error_code ec;
@@ -175,6 +188,11 @@ private:
 			return;
 		}
 
+		if (!ec && m_capture) {
+			m_capture->record(scout::packet_direction::incoming, (char const*)m_receive_buffer
+				, bytes_transferred, m_sender, m_local_ep);
+		}
+
 		// pass on the packet to the handler
 		if (!ec) m_handler((char *)m_receive_buffer, bytes_transferred, m_sender);
 		else log_debug("udp_socket::on_receive ignoring error: %s", ec.message().c_str());
@@ -201,6 +219,10 @@ private:
 
 	// set to true if it's time to quit
 	bool m_abort;
+
+	// if set, all traffic is recorded here
+	std::shared_ptr<scout::packet_capture> m_capture;
+	udp::endpoint m_local_ep;
 };
 
 typedef std::shared_ptr<udp_socket> udp_socket_ptr;
@@ -18,15 +18,49 @@ limitations under the License.
 # define UTILS_HPP
 
 #include <scout.hpp>
+#include <logging.hpp>
 #include <sha1_hash.h>
 #include <boost/endian/arithmetic.hpp>
 #include <sodium/crypto_box.h>
 #include <sodium/randombytes.h>
 #include <cstring>
+#include <cstddef>
+#include <type_traits>
 
 namespace be = boost::endian;
 using namespace scout;
 
+// a field of a header as it is laid out on the wire
+struct wire_field
+{
+	std::size_t offset;
+	std::size_t size;
+};
+
+// true if fields cover the first size bytes of a header in order, with no
+// gaps and no overlap. A header laid out like this can be copied to and from
+// the wire as a whole with extract() and flatten()
+template <std::size_t N>
+constexpr bool is_packed(wire_field const (&fields)[N], std::size_t size)
+{
+	std::size_t end = 0;
+	for (std::size_t i = 0; i < N; ++i)
+	{
+		if (fields[i].offset != end) return false;
+		end += fields[i].size;
+	}
+	return end == size;
+}
+
+#define SCOUT_WIRE_FIELD(header, field) \
+	wire_field{ offsetof(header, field), sizeof(header::field) }
+
+#define SCOUT_CHECK_WIRE_LAYOUT(header, wire_size) \
+	static_assert(std::is_trivial<header>::value, #header " must be a trivial type"); \
+	static_assert(alignof(header) == 1, #header " must not be padded"); \
+	static_assert(sizeof(header) == wire_size, #header " has the wrong size"); \
+	static_assert(is_packed(header##_fields, wire_size), #header " fields are not packed")
+
 struct entry_header
 {
 	be::big_int64_t seq;
@@ -40,12 +74,27 @@ struct entry_header
 	uint8_t content_offset;
 };
 
+constexpr wire_field entry_header_fields[] = {
+	SCOUT_WIRE_FIELD(entry_header, seq),
+	SCOUT_WIRE_FIELD(entry_header, id),
+	SCOUT_WIRE_FIELD(entry_header, reserved),
+	SCOUT_WIRE_FIELD(entry_header, content_length),
+	SCOUT_WIRE_FIELD(entry_header, content_offset),
+};
+SCOUT_CHECK_WIRE_LAYOUT(entry_header, 16);
+
 struct entries_header
 {
 	uint8_t entry_count;
 	uint8_t entries_offset; // offset from this field to the first entry
 };
 
+constexpr wire_field entries_header_fields[] = {
+	SCOUT_WIRE_FIELD(entries_header, entry_count),
+	SCOUT_WIRE_FIELD(entries_header, entries_offset),
+};
+SCOUT_CHECK_WIRE_LAYOUT(entries_header, 2);
+
 struct dht_msg_header
 {
 	hash next_hash;
@@ -53,38 +102,82 @@ struct dht_msg_header
 	uint8_t msg_offset;
 };
 
+constexpr wire_field dht_msg_header_fields[] = {
+	SCOUT_WIRE_FIELD(dht_msg_header, next_hash),
+	SCOUT_WIRE_FIELD(dht_msg_header, msg_length),
+	SCOUT_WIRE_FIELD(dht_msg_header, msg_offset),
+};
+SCOUT_CHECK_WIRE_LAYOUT(dht_msg_header, 23);
+
 sha1_hash sha1_fun(const byte* buf, int len);
 
+// copy the start of src into dest and advance src past it. Returns false,
+// changing nothing, if src is too short
 template <typename T, std::ptrdiff_t... Dimensions>
-gsl::span<gsl::byte const> extract(gsl::span<T, Dimensions...> dest, gsl::span<gsl::byte const> src)
+bool try_extract(gsl::span<T, Dimensions...> dest, gsl::span<gsl::byte const>& src) noexcept
 {
 	static_assert(std::is_trivial<std::decay_t<T>>::value, "Target type must be a trivial type");
 
 	if (src.size_bytes() < dest.size_bytes())
-		throw std::length_error("bytes span smaller than destination");
+		return false;
 	std::memcpy(dest.data(), src.data(), dest.size_bytes());
-	return{ src.data() + dest.size_bytes(), src.size_bytes() - dest.size_bytes() };
+	src = { src.data() + dest.size_bytes(), src.size_bytes() - dest.size_bytes() };
+	return true;
 }
 
+// copy src to the start of dest and advance dest past it. Returns false,
+// changing nothing, if dest is too short
 template <typename T, std::ptrdiff_t... Dimensions>
-gsl::span<gsl::byte> flatten(gsl::span<gsl::byte> dest, gsl::span<T const, Dimensions...> src)
+bool try_flatten(gsl::span<gsl::byte>& dest, gsl::span<T const, Dimensions...> src) noexcept
 {
 	static_assert(std::is_trivial<std::decay_t<T>>::value, "Target type must be a trivial type");
 
 	if (dest.size_bytes() < src.size_bytes())
-		throw std::length_error("source span larger than destination");
+		return false;
 	std::memcpy(dest.data(), src.data(), src.size_bytes());
-	return{ dest.data() + src.size_bytes(), dest.size_bytes() - src.size_bytes() };
+	dest = { dest.data() + src.size_bytes(), dest.size_bytes() - src.size_bytes() };
+	return true;
+}
+
+template <typename T, std::ptrdiff_t... Dimensions>
+gsl::span<gsl::byte const> extract(gsl::span<T, Dimensions...> dest, gsl::span<gsl::byte const> src)
+{
+	if (!try_extract(dest, src))
+		throw std::length_error("bytes span smaller than destination");
+	return src;
+}
+
+template <typename T, std::ptrdiff_t... Dimensions>
+gsl::span<gsl::byte> flatten(gsl::span<gsl::byte> dest, gsl::span<T const, Dimensions...> src)
+{
+	if (!try_flatten(dest, src))
+		throw std::length_error("source span larger than destination");
+	return dest;
 }
 
 std::vector<gsl::byte> message_dht_blob_write(gsl::span<gsl::byte const> msg_data, chash_span next_msg_hash);
+// throws std::length_error if dht_blob is too short for the header, the
+// contents are empty if it's too short for them
 std::vector<gsl::byte> message_dht_blob_read(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash);
-
-void log_debug(char const* fmt, ...);
-void log_error(char const* fmt, ...);
+// the same, returning the part of dht_blob holding the message contents,
+// which is empty if dht_blob is malformed
+gsl::span<gsl::byte const> message_dht_blob_view(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash) noexcept;
+// the same, setting msg to the message contents
+parse_error message_dht_blob_parse(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash
+	, gsl::span<gsl::byte const>& msg) noexcept;
 
 // crypto helper functions:
 std::vector<char> decrypt_buffer(std::vector<char> buffer, secret_key_span secret);
 std::vector<char> encrypt_buffer(std::vector<char> buffer, secret_key_span secret, const unsigned char* nonce_in = nullptr);
 
+// the same, into caller provided buffers. ciphertext must be
+// encrypted_size(plaintext.size()) bytes and plaintext at least
+// decrypted_size(buffer.size()). decrypt_buffer returns the part of plaintext
+// holding the message, which is empty if it couldn't be decrypted
+std::size_t encrypted_size(std::size_t plaintext_size);
+std::size_t decrypted_size(std::size_t ciphertext_size);
+gsl::span<char> decrypt_buffer(gsl::span<char const> buffer, gsl::span<char> plaintext, secret_key_span secret);
+void encrypt_buffer(gsl::span<char const> plaintext, gsl::span<char> ciphertext, secret_key_span secret
+	, const unsigned char* nonce_in = nullptr);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace scout
+{
+
+namespace
+{
+	// blocks start with their header, padded so the data which follows it
+	// is aligned for anything
+	std::size_t const header_size = (sizeof(void*) + sizeof(std::size_t)
+		+ alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	// arenas kept for reuse, more than this are freed when released
+	std::size_t const max_pooled = 64;
+
+	struct arena_pool
+	{
+		arena_pool() { arenas.reserve(max_pooled); }
+		~arena_pool()
+		{
+			for (arena* a : arenas) delete a;
+		}
+
+		std::mutex mutex;
+		std::vector<arena*> arenas;
+	};
+
+	arena_pool& pool()
+	{
+		static arena_pool p;
+		return p;
+	}
+}
+
+arena::arena(std::size_t block_size)
+	: m_head(nullptr), m_cur(nullptr), m_end(nullptr), m_block_size(block_size)
+{
+	new_block(0);
+}
+
+arena::~arena()
+{
+	while (m_head)
+	{
+		block* next = m_head->next;
+		std::free(m_head);
+		m_head = next;
+	}
+}
+
+void* arena::allocate(std::size_t size, std::size_t align)
+{
+	std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(m_cur) + align - 1) & ~std::uintptr_t(align - 1);
+	if (p + size > reinterpret_cast<std::uintptr_t>(m_end))
+	{
+		new_block(size + align);
+		p = (reinterpret_cast<std::uintptr_t>(m_cur) + align - 1) & ~std::uintptr_t(align - 1);
+	}
+	m_cur = reinterpret_cast<char*>(p + size);
+	return reinterpret_cast<void*>(p);
+}
+
+void arena::reset()
+{
+	// free every block but the first
+	while (m_head->next)
+	{
+		block* next = m_head->next;
+		std::free(m_head);
+		m_head = next;
+	}
+	m_cur = reinterpret_cast<char*>(m_head) + header_size;
+	m_end = m_cur + m_head->size;
+}
+
+std::size_t arena::capacity() const
+{
+	std::size_t ret = 0;
+	for (block* b = m_head; b; b = b->next) ret += b->size;
+	return ret;
+}
+
+arena::block* arena::new_block(std::size_t min_size)
+{
+	std::size_t const size = (std::max)(m_block_size, min_size);
+	void* mem = std::malloc(header_size + size);
+	if (mem == nullptr) throw std::bad_alloc();
+	block* b = static_cast<block*>(mem);
+	b->next = m_head;
+	b->size = size;
+	m_head = b;
+	m_cur = static_cast<char*>(mem) + header_size;
+	m_end = m_cur + size;
+	return b;
+}
+
+arena* acquire_arena()
+{
+	arena_pool& p = pool();
+	{
+		std::lock_guard<std::mutex> l(p.mutex);
+		if (!p.arenas.empty())
+		{
+			arena* a = p.arenas.back();
+			p.arenas.pop_back();
+			return a;
+		}
+	}
+	return new arena();
+}
+
+void release_arena(arena* a)
+{
+	a->reset();
+	arena_pool& p = pool();
+	{
+		std::lock_guard<std::mutex> l(p.mutex);
+		if (p.arenas.size() < max_pooled)
+		{
+			p.arenas.push_back(a);
+			return;
+		}
+	}
+	delete a;
+}
+
+} // namespace scout
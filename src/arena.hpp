@@ -0,0 +1,99 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+
+namespace scout
+{
+
+// A monotonic allocator for the memory of a single operation. Allocations
+// are carved out of large blocks and never freed individually; reset()
+// releases all of them at once, keeping the first block for the next user.
+// Not thread safe.
+class arena
+{
+public:
+	enum { default_block_size = 4096 };
+
+	explicit arena(std::size_t block_size = default_block_size);
+	~arena();
+
+	arena(arena const&) = delete;
+	arena& operator=(arena const&) = delete;
+
+	void* allocate(std::size_t size, std::size_t align);
+
+	// everything allocated so far is released
+	void reset();
+
+	// the number of bytes held in blocks, used or not
+	std::size_t capacity() const;
+
+private:
+	struct block
+	{
+		block* next;
+		std::size_t size;
+	};
+
+	block* new_block(std::size_t min_size);
+
+	// the block being allocated from. The first block is at the end of the
+	// list
+	block* m_head;
+	char* m_cur;
+	char* m_end;
+	std::size_t m_block_size;
+};
+
+// take an empty arena from the pool shared by all operations, or make a new
+// one if it's empty. May be called from any thread
+arena* acquire_arena();
+
+// reset a and return it to the pool. May be called from any thread
+void release_arena(arena* a);
+
+// a standard allocator drawing from an arena. deallocate() does nothing, the
+// memory is reclaimed when the arena is reset
+template <typename T>
+struct arena_allocator
+{
+	using value_type = T;
+
+	explicit arena_allocator(arena& a) : m_arena(&a) {}
+	template <typename U>
+	arena_allocator(arena_allocator<U> const& o) : m_arena(o.m_arena) {}
+
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, std::size_t) {}
+
+	template <typename U>
+	bool operator==(arena_allocator<U> const& o) const { return m_arena == o.m_arena; }
+	template <typename U>
+	bool operator!=(arena_allocator<U> const& o) const { return m_arena != o.m_arena; }
+
+	arena* m_arena;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,236 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "completion_queue.hpp"
+#include "ring_buffer.hpp"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <boost/system/system_error.hpp>
+
+#ifdef _WIN32
+#include <chrono>
+#include <condition_variable>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#if defined __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+namespace scout
+{
+
+namespace
+{
+	enum
+	{
+		ring_size = 1024,
+	};
+
+#ifndef _WIN32
+	[[noreturn]] void throw_errno()
+	{
+		throw boost::system::system_error(boost::system::error_code(errno
+			, boost::system::system_category()));
+	}
+#endif
+}
+
+struct completion_queue::impl
+{
+	impl()
+	{
+#if defined _WIN32
+#elif defined __linux__
+		read_fd = write_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (read_fd < 0) throw_errno();
+#else
+		int fds[2];
+		if (::pipe(fds) != 0) throw_errno();
+		read_fd = fds[0];
+		write_fd = fds[1];
+		for (int fd : fds)
+		{
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			::fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+#endif
+	}
+
+	~impl()
+	{
+#ifndef _WIN32
+		::close(read_fd);
+		if (write_fd != read_fd) ::close(write_fd);
+#endif
+	}
+
+	// wake up the harvesting thread, unless it has already been woken up
+	// since its last harvest
+	void signal()
+	{
+		if (signalled.exchange(true, std::memory_order_acq_rel)) return;
+#ifdef _WIN32
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			ready = true;
+		}
+		cv.notify_one();
+#elif defined __linux__
+		std::uint64_t const one = 1;
+		// the only possible failure is the counter overflowing, which
+		// leaves it readable anyway
+		ssize_t const ignore = ::write(write_fd, &one, sizeof(one));
+		(void)ignore;
+#else
+		char const one = 1;
+		// a full pipe is readable anyway
+		ssize_t const ignore = ::write(write_fd, &one, 1);
+		(void)ignore;
+#endif
+	}
+
+	// called by the harvesting thread before it pops completions. The handle
+	// is drained before the flag is cleared, so a post which sets the flag
+	// again always leaves the handle readable. A post which still finds it
+	// set is popped by the caller; the exchange makes its completion visible
+	void clear()
+	{
+#ifdef _WIN32
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			ready = false;
+		}
+#else
+		char buf[64];
+		while (::read(read_fd, buf, sizeof(buf)) > 0);
+#endif
+		signalled.exchange(false, std::memory_order_acq_rel);
+	}
+
+	bool pending() const
+	{
+		return !ring.empty() || has_overflow.load(std::memory_order_acquire);
+	}
+
+	ring_buffer<completion, ring_size> ring;
+
+	// completions which didn't fit in the ring
+	std::mutex overflow_mutex;
+	std::deque<completion> overflow;
+	std::atomic<bool> has_overflow{false};
+
+	std::atomic<bool> signalled{false};
+#ifdef _WIN32
+	std::mutex mutex;
+	std::condition_variable cv;
+	// protected by mutex
+	bool ready = false;
+#else
+	int read_fd = -1;
+	int write_fd = -1;
+#endif
+};
+
+completion_queue::completion_queue()
+	: m_impl(new impl)
+{}
+
+completion_queue::~completion_queue() = default;
+
+int completion_queue::native_handle() const
+{
+#ifdef _WIN32
+	return -1;
+#else
+	return m_impl->read_fd;
+#endif
+}
+
+void completion_queue::post(completion c)
+{
+	bool const pushed = m_impl->ring.push([&](completion& slot) { slot = std::move(c); });
+	if (!pushed)
+	{
+		std::lock_guard<std::mutex> l(m_impl->overflow_mutex);
+		m_impl->overflow.push_back(std::move(c));
+		m_impl->has_overflow.store(true, std::memory_order_release);
+	}
+	m_impl->signal();
+}
+
+std::size_t completion_queue::harvest(std::vector<completion>& out, std::size_t max)
+{
+	m_impl->clear();
+
+	std::size_t n = 0;
+	while (n < max && m_impl->ring.pop([&](completion& slot)
+		{
+			out.push_back(std::move(slot));
+			// don't hold on to the payload's memory until the slot is reused
+			slot.contents = std::vector<gsl::byte>();
+			slot.entries = std::vector<entry>();
+		}))
+	{
+		++n;
+	}
+
+	if (n < max && m_impl->has_overflow.load(std::memory_order_acquire))
+	{
+		std::lock_guard<std::mutex> l(m_impl->overflow_mutex);
+		while (n < max && !m_impl->overflow.empty())
+		{
+			out.push_back(std::move(m_impl->overflow.front()));
+			m_impl->overflow.pop_front();
+			++n;
+		}
+		m_impl->has_overflow.store(!m_impl->overflow.empty(), std::memory_order_release);
+	}
+
+	// keep the handle readable for whatever was left behind
+	if (m_impl->pending()) m_impl->signal();
+	return n;
+}
+
+bool completion_queue::wait(int timeout_ms)
+{
+	if (m_impl->pending()) return true;
+#ifdef _WIN32
+	std::unique_lock<std::mutex> l(m_impl->mutex);
+	if (timeout_ms < 0)
+	{
+		m_impl->cv.wait(l, [&] { return m_impl->ready; });
+		return true;
+	}
+	return m_impl->cv.wait_for(l, std::chrono::milliseconds(timeout_ms)
+		, [&] { return m_impl->ready; });
+#else
+	pollfd p;
+	p.fd = m_impl->read_fd;
+	p.events = POLLIN;
+	p.revents = 0;
+	int r;
+	do r = ::poll(&p, 1, timeout_ms);
+	while (r < 0 && errno == EINTR);
+	return r > 0;
+#endif
+}
+
+} // namespace scout
@@ -16,12 +16,17 @@ limitations under the License.
 
 #include "dht_session.hpp"
 
+#include <algorithm>
 #include <random>
 #include <sodium/crypto_sign.h>
+#include <sodium/utils.h>
 #include <udp_utils.h>
 #include "sockaddr.hpp"
 #include "bencoding.h"
 #include "file.hpp"
+#include "metrics.hpp"
+#include "metrics_server.hpp"
+#include "op_scheduler.hpp"
 
 #include "libnatpmp/natpmp.h"
 #include "libminiupnpc/miniupnpc.h"
@@ -85,7 +90,8 @@ namespace
 	// adaptor is DHT traffic.
 	struct udp_socket_adaptor : UDPSocketInterface
 	{
-		udp_socket_adaptor(udp_socket* s) : m_socket(s), m_enabled(true) {}
+		udp_socket_adaptor(udp_socket* s, scout::session_counters& c)
+			: m_socket(s), m_counters(c), m_enabled(true) {}
 
 		void set_enabled(bool e) { m_enabled = e; }
 
@@ -108,6 +114,7 @@ namespace
 #endif
 
 			m_socket->send_to((char const*)p, len, ep, ec);
+			m_counters.packet_out(len, !ec);
 		}
 
 		const SockAddr &GetBindAddr() const
@@ -121,6 +128,7 @@ namespace
 
 		mutable SockAddr m_bind_address;
 		udp_socket* m_socket;
+		scout::session_counters& m_counters;
 		bool m_enabled;
 	};
 
@@ -219,6 +227,10 @@ namespace
 		log_error("failed to load DHT state: %s", e.what());
 	}
 
+	// used in place of the above when the session doesn't persist its state
+	void discard_dht_state(const byte* buf, int len) {}
+	void skip_load_dht_state(BencEntity* ent) {}
+
 	bool ed25519_verify(const unsigned char *signature,
 		const unsigned char *message, size_t message_len,
 		const unsigned char *key)
@@ -548,6 +560,88 @@ namespace
 namespace scout
 {
 
+// records how long an operation spends in each phase into the session's
+// histograms, and forwards its lifecycle to the session's tracer, if any
+struct op_timer : op_observer
+{
+	op_timer(session_counters& c, op_type t, std::uint64_t id
+		, std::shared_ptr<op_tracer> tracer)
+		: m_counters(c), m_type(t), m_id(id), m_queued(session_counters::clock::now())
+#if SCOUT_TRACING
+		, m_tracer(std::move(tracer))
+#endif
+	{
+#if SCOUT_TRACING
+		if (m_tracer)
+		{
+			m_tracer->op_begin(m_id, m_type);
+			m_tracer->phase_begin(m_id, m_type, op_phase::queue);
+		}
+#endif
+	}
+
+	// called once the operation has left the queue of the network thread
+	void dequeued()
+	{
+		m_counters.op_dequeued();
+		phase_end_at(op_phase::queue, m_queued);
+	}
+
+	void phase_begin(op_phase p) override
+	{
+		m_begin[int(p)] = session_counters::clock::now();
+#if SCOUT_TRACING
+		if (m_tracer) m_tracer->phase_begin(m_id, m_type, p);
+#endif
+	}
+
+	void phase_end(op_phase p) override
+	{
+		phase_end_at(p, m_begin[int(p)]);
+	}
+
+	void event(char const* name) override
+	{
+#if SCOUT_TRACING
+		if (m_tracer) m_tracer->event(m_id, m_type, name);
+#endif
+	}
+
+	void finished(bool success)
+	{
+		m_counters.op_finished(m_type, success, m_queued);
+	}
+
+	std::uint64_t id() const { return m_id; }
+
+	~op_timer()
+	{
+		// the timer is destroyed along with the operation's final callback
+#if SCOUT_TRACING
+		if (m_tracer) m_tracer->op_end(m_id, m_type);
+#endif
+	}
+
+private:
+	void phase_end_at(op_phase p, session_counters::clock::time_point begin)
+	{
+		m_counters.record_phase(m_type, p, std::chrono::duration_cast<std::chrono::microseconds>(
+			session_counters::clock::now() - begin));
+#if SCOUT_TRACING
+		if (m_tracer) m_tracer->phase_end(m_id, m_type, p);
+#endif
+	}
+
+	session_counters& m_counters;
+	op_type m_type;
+	std::uint64_t m_id;
+	session_counters::clock::time_point m_queued;
+	std::array<session_counters::clock::time_point, num_op_phases> m_begin;
+#if SCOUT_TRACING
+	std::shared_ptr<op_tracer> m_tracer;
+#endif
+};
+
 struct ip_change_observer_session : ip_change_observer
 {
 	dht_session * m_ses;
@@ -559,18 +653,48 @@ struct ip_change_observer_session : ip_change_observer
 	}
 };
 
-dht_session::dht_session()
-	: m_socket(udp_socket::construct(m_ios))
-	, m_dht_external_port(32768 + std::random_device()() % 16384)
+session_settings::session_settings()
+	: bind_address(address_v4::any())
+	, port(0)
+	, persist_state(true)
+	, map_ports(true)
+	, rate_limit(8000)
+	, send_packets(true)
+	, priority_weights{ { 16, 4, 1 } }
+	, max_outstanding{ { 32, 16, 4 } }
+	, send_budget(0)
+	, hedge_percentile(0.)
+	, hedge_budget(0.05)
+{
+	bootstrap_nodes.push_back(std::pair<std::string, int>("router.utorrent.com", 6881));
+	bootstrap_nodes.push_back(std::pair<std::string, int>("router.bittorrent.com", 6881));
+}
+
+dht_session::dht_session(session_settings const& settings)
+	: m_settings(settings)
+	, m_socket(udp_socket::construct(m_ios))
+	, m_dht_external_port(settings.port != 0 ? settings.port
+		: 32768 + std::random_device()() % 16384)
 	, m_state(INITIAL)
 	, m_external_ip(&sha1_fun)
 	, m_dht_timer(m_ios)
 	, m_natpmp_timer(m_ios_worker)
 	, m_is_natpmp_mapped(false)
-	, m_dht_rate_limit(8000)
+	, m_bootstrap_nodes(settings.bootstrap_nodes)
+	, m_dht_rate_limit(settings.rate_limit)
+	, m_schedule_timer(m_ios)
 {
-	m_bootstrap_nodes.push_back(std::pair<std::string, int>("router.utorrent.com", 6881));
-	m_bootstrap_nodes.push_back(std::pair<std::string, int>("router.bittorrent.com", 6881));
+	std::array<op_scheduler::class_limits, num_op_priorities> limits;
+	for (int i = 0; i < num_op_priorities; ++i)
+		limits[i] = { settings.priority_weights[i], settings.max_outstanding[i] };
+	m_scheduler.reset(new op_scheduler(limits, settings.send_budget
+		, op_scheduler::clock::now()));
+}
+
+dht_session::dht_session(session_settings const& settings, smart_ptr<IDht> dht)
+	: dht_session(settings)
+{
+	m_dht = dht;
 }
 
 dht_session::~dht_session()
@@ -593,36 +717,861 @@ void dht_session::stop()
 	m_state = QUITTING;
 	m_dht->Shutdown();
 	m_dht_timer.cancel();
+	m_schedule_timer.cancel();
 	m_ios.stop();
 	m_thread.join();
 }
 
-void dht_session::synchronize(secret_key_span shared_key, std::vector<entry> entries
-	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb)
+namespace
+{
+	std::chrono::steady_clock::time_point deadline_of(op_options const& options)
+	{
+		if (options.timeout.count() <= 0) return std::chrono::steady_clock::time_point();
+		return std::chrono::steady_clock::now() + options.timeout;
+	}
+
+	// rough estimates of what the DHT sends for each kind of request, used to
+	// admit requests against the rate limit. A lookup sends about 8 rounds of
+	// queries to 4 nodes, and items are stored at the 8 closest nodes
+	enum
+	{
+		query_bytes = 100,
+		lookup_bytes = 32 * query_bytes,
+		store_nodes = 8,
+		// the key, signature, sequence number and token of a store
+		store_overhead = 250,
+		// the largest item the DHT stores
+		max_item_size = 1000,
+	};
+
+	int get_cost() { return lookup_bytes; }
+
+	int put_cost(std::size_t size)
+	{
+		return lookup_bytes + store_nodes * (store_overhead + int(size));
+	}
+
+	int synchronize_cost() { return put_cost(max_item_size); }
+}
+
+op_handle dht_session::synchronize(secret_key_span shared_key, std::vector<entry> entries
+	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_options const& options)
+{
+	return start_synchronize(shared_key, std::move(entries), options, entry_cb, nullptr
+		, finalize_cb, [finished_cb](op_handle const&) { finished_cb(); });
+}
+
+op_handle dht_session::synchronize(secret_key_span shared_key, std::vector<entry> entries
+	, entries_updated entries_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_options const& options)
 {
-	m_ios.post([=, captured_entries = std::move(entries)]()
+	return start_synchronize(shared_key, std::move(entries), options, nullptr, entries_cb
+		, finalize_cb, [finished_cb](op_handle const&) { finished_cb(); });
+}
+
+op_handle dht_session::put(list_token const& token, gsl::span<gsl::byte const> contents
+	, put_finished finished_cb, op_options const& options)
+{
+	auto timer = make_timer(op_type::put);
+	op_handle h = make_handle(*timer);
+	m_counters.op_queued(op_type::put);
+	// the deadline runs while the request is queued too
+	auto expiry = start_deadline(h, deadline_of(options));
+	schedule(options.priority, put_cost(contents.size()), h, [=](op_priority p)
 	{
-		::synchronize(*m_dht, shared_key, captured_entries, entry_cb, finalize_cb, finished_cb);
+		timer->dequeued();
+		::put(*m_dht, token, contents, [=]()
+		{
+			if (expiry) expiry->cancel();
+			timer->finished(h.status() == op_status::success);
+			op_done(p);
+			finished_cb();
+		}, timer.get(), h);
 	});
+	return h;
 }
 
-void dht_session::put(list_token const& token, gsl::span<gsl::byte const> contents
-	, put_finished finished_cb)
+op_handle dht_session::get(hash_span address, item_received received_cb
+	, op_options const& options)
 {
-	m_ios.post([=]()
+	return start_get(address, options
+		, [received_cb](op_handle const&, gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		received_cb(std::vector<gsl::byte>(contents.begin(), contents.end()), next_hash);
+	});
+}
+
+op_handle dht_session::get_view(hash_span address, item_viewed viewed_cb
+	, op_options const& options)
+{
+	return start_get(address, options
+		, [viewed_cb](op_handle const&, gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		viewed_cb(contents, next_hash);
+	});
+}
+
+op_handle dht_session::synchronize(secret_key_span shared_key, std::vector<entry> entries
+	, completion_queue& q, op_options const& options)
+{
+	// filled in just before the entries are stored
+	auto stored = std::make_shared<std::vector<entry>>();
+	return start_synchronize(shared_key, std::move(entries), options, nullptr, nullptr
+		, [=](std::vector<entry>& e) { *stored = e; }
+		, [=, &q](op_handle const& h)
+	{
+		completion c;
+		c.id = h.id();
+		c.type = op_type::synchronize;
+		c.status = h.status();
+		c.entries = std::move(*stored);
+		q.post(std::move(c));
+	});
+}
+
+op_handle dht_session::put(list_token const& token, gsl::span<gsl::byte const> contents
+	, completion_queue& q, op_options const& options)
+{
+	auto timer = make_timer(op_type::put);
+	op_handle h = make_handle(*timer);
+	m_counters.op_queued(op_type::put);
+	// the deadline runs while the request is queued too
+	auto expiry = start_deadline(h, deadline_of(options));
+	schedule(options.priority, put_cost(contents.size()), h, [=, &q](op_priority p)
 	{
-		::put(*m_dht, token, contents, finished_cb);
+		timer->dequeued();
+		::put(*m_dht, token, contents, [=, &q]()
+		{
+			if (expiry) expiry->cancel();
+			timer->finished(h.status() == op_status::success);
+			op_done(p);
+			completion c;
+			c.id = h.id();
+			c.type = op_type::put;
+			c.status = h.status();
+			q.post(std::move(c));
+		}, timer.get(), h);
 	});
+	return h;
 }
 
-void dht_session::get(hash_span address, item_received received_cb)
+op_handle dht_session::get(hash_span address, completion_queue& q, op_options const& options)
 {
+	return start_get(address, options
+		, [&q](op_handle const& h, gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		completion c;
+		c.id = h.id();
+		c.type = op_type::get;
+		c.status = h.status();
+		c.contents.assign(contents.begin(), contents.end());
+		c.next_hash = next_hash;
+		q.post(std::move(c));
+	});
+}
+
+// a get waiting for the result of a lookup, possibly one shared with other
+// gets for the same hash
+struct get_waiter
+{
+	op_handle handle;
+	std::shared_ptr<op_timer> timer;
+	std::shared_ptr<boost::asio::steady_timer> expiry;
+	// the contents are only valid during the call
+	std::function<void(op_handle const&, gsl::span<gsl::byte const>, hash const&)> deliver;
+};
+
+// a lookup and the gets which haven't been answered yet. Once the last of
+// them is cancelled the lookup is too
+struct get_flight
+{
+	hash target;
+	// the highest class of the gets which joined it. The lookup is moved to
+	// it while it is queued
+	op_priority priority;
+	op_handle lookup;
+	// a second lookup started when the first is slow, see hedge_percentile
+	op_handle hedge;
+	std::shared_ptr<boost::asio::steady_timer> hedge_timer;
+	session_counters::clock::time_point started;
+	// lookups which haven't called back yet
+	int running = 0;
+	bool answered = false;
+	// the first get's timer observes the phases of the lookup
+	std::shared_ptr<op_timer> leader;
+	std::vector<std::shared_ptr<get_waiter>> waiters;
+};
+
+void dht_session::answer(get_waiter& w, op_status s, gsl::span<gsl::byte const> contents
+	, hash const& next_hash)
+{
+	// a waiter cancelled before it joined already has its status
+	if (w.handle.status() == op_status::pending) w.handle.complete(s);
+	if (w.expiry) w.expiry->cancel();
+	w.timer->finished(w.handle.status() == op_status::success);
+	if (w.handle.status() != op_status::success) contents = gsl::span<gsl::byte const>();
+	w.deliver(w.handle, contents, next_hash);
+}
+
+op_handle dht_session::start_get(hash_span address, op_options const& options
+	, std::function<void(op_handle const&, gsl::span<gsl::byte const>, hash const&)> deliver)
+{
+	auto w = std::make_shared<get_waiter>();
+	w->timer = make_timer(op_type::get);
+	w->handle = make_handle(*w->timer);
+	w->deliver = std::move(deliver);
+	auto const deadline = deadline_of(options);
+	m_counters.op_queued(op_type::get);
+
+	hash target;
+	std::copy(address.begin(), address.end(), target.begin());
+
+	std::shared_ptr<get_flight> flight;
+	bool joined = false;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		auto& f = m_get_flights[target];
+		if (f)
+		{
+			joined = true;
+			// a get doesn't wait for a lookup of a lower class than its own,
+			// as long as the lookup hasn't been started
+			if (options.priority < f->priority)
+			{
+				f->priority = options.priority;
+				if (m_scheduler->requeue(f->lookup, f->priority))
+					m_ios.post([this]() { run_scheduler(); });
+			}
+			f->waiters.push_back(w);
+			flight = f;
+		}
+		else
+		{
+			f = std::make_shared<get_flight>();
+			f->target = target;
+			f->priority = options.priority;
+			f->leader = w->timer;
+			f->lookup.set_abort([this]() { wake_scheduler(); });
+			f->hedge.set_abort([this]() { wake_scheduler(); });
+			f->waiters.push_back(w);
+			flight = f;
+			// queued under the lock, so the gets which join it find it queued
+			schedule(f->priority, get_cost(), f->lookup
+				, [this, flight, w](op_priority p) { start_lookup(flight, w, p); });
+		}
+	}
+
+	// the deadline runs while the lookup is queued too. A joined get skips
+	// the scheduler, the lookup has already been paid for
+	if (joined) m_counters.op_coalesced(op_type::get);
 	m_ios.post([=]()
 	{
-		::get(*m_dht, address, received_cb);
+		if (joined) w->timer->dequeued();
+		join_flight(flight, w, deadline);
+	});
+	return w->handle;
+}
+
+// the scheduler started flight's lookup, in class p. leader is the get which
+// queued it. Only on the network thread
+void dht_session::start_lookup(std::shared_ptr<get_flight> const& flight
+	, std::shared_ptr<get_waiter> const& leader, op_priority p)
+{
+	leader->timer->dequeued();
+	// everyone waiting for it left while it was queued
+	if (flight->lookup.status() != op_status::pending)
+	{
+		op_done(p);
+		return;
+	}
+	flight->started = session_counters::clock::now();
+	flight->running = 1;
+	start_hedge_timer(flight);
+	::get_view(*m_dht, flight->target, item_viewed_fn(
+		[=](gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		op_done(p);
+		lookup_done(flight, false, contents, next_hash);
+	}), flight->leader.get(), flight->lookup);
+}
+
+// arm flight's hedge timer, if hedging is enabled and there's enough
+// history to tell what a slow lookup is. Only on the network thread
+void dht_session::start_hedge_timer(std::shared_ptr<get_flight> const& flight)
+{
+	if (m_settings.hedge_percentile <= 0.) return;
+	m_hedge_tokens = std::min(m_hedge_tokens + m_settings.hedge_budget, double(max_hedge_burst));
+	if (m_hedge_delay.count() == 0) return;
+	flight->hedge_timer = std::make_shared<boost::asio::steady_timer>(m_ios);
+	flight->hedge_timer->expires_at(flight->started + m_hedge_delay);
+	flight->hedge_timer->async_wait([this, flight](error_code const& ec)
+	{
+		if (ec || flight->answered || flight->lookup.status() != op_status::pending) return;
+		// over budget, keep waiting for the first lookup
+		if (m_hedge_tokens < 1.) return;
+		// the hedge is a lookup like any other, and waits for its turn and
+		// the send budget in the class of the gets waiting on it
+		schedule(flight->priority, get_cost(), flight->hedge
+			, [this, flight](op_priority p) { start_hedge(flight, p); });
 	});
 }
 
+// the scheduler started flight's hedge, in class p. Only on the network
+// thread
+void dht_session::start_hedge(std::shared_ptr<get_flight> const& flight, op_priority p)
+{
+	// the first lookup answered while the hedge was queued, or other hedges
+	// spent the budget
+	if (flight->hedge.status() != op_status::pending || m_hedge_tokens < 1.)
+	{
+		op_done(p);
+		return;
+	}
+	m_hedge_tokens -= 1.;
+	m_counters.get_hedged();
+	++flight->running;
+	::get_view(*m_dht, flight->target, item_viewed_fn(
+		[=](gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		op_done(p);
+		lookup_done(flight, true, contents, next_hash);
+	}), nullptr, flight->hedge);
+}
+
+// one of flight's lookups called back. The first to find the item answers
+// the gets and cancels the other. Only on the network thread
+void dht_session::lookup_done(std::shared_ptr<get_flight> const& flight, bool hedge
+	, gsl::span<gsl::byte const> contents, hash const& next_hash)
+{
+	--flight->running;
+	if (flight->answered) return;
+	// the other lookup may still find it
+	if (contents.empty() && flight->running > 0) return;
+	flight->answered = true;
+	if (flight->hedge_timer) flight->hedge_timer->cancel();
+
+	if (!contents.empty())
+	{
+		if (hedge) m_counters.hedge_won();
+		record_get_latency(session_counters::clock::now() - flight->started);
+	}
+	(hedge ? flight->lookup : flight->hedge).abort(op_status::cancelled);
+	end_flight(flight, contents, next_hash);
+}
+
+// the hedge delay tracks the latency of the last hedge_window successful
+// lookups
+void dht_session::record_get_latency(session_counters::clock::duration d)
+{
+	if (m_settings.hedge_percentile <= 0.) return;
+	m_get_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(d));
+	if (++m_get_latency_samples < hedge_window) return;
+	m_get_latency_samples = 0;
+	// never 0, which means there's no history yet
+	m_hedge_delay = std::chrono::microseconds(std::max(std::uint64_t(1)
+		, m_get_latency.snapshot_and_reset().percentile(m_settings.hedge_percentile)));
+}
+
+// start w's deadline and let it be cancelled. Only on the network thread
+void dht_session::join_flight(std::shared_ptr<get_flight> const& flight
+	, std::shared_ptr<get_waiter> const& w, std::chrono::steady_clock::time_point deadline)
+{
+	if (w->handle.status() != op_status::pending)
+	{
+		leave_flight(flight, w);
+		return;
+	}
+	w->expiry = start_deadline(w->handle, deadline);
+	std::weak_ptr<get_waiter> weak = w;
+	w->handle.set_abort([this, flight, weak]()
+	{
+		if (auto w = weak.lock()) leave_flight(flight, w);
+	});
+}
+
+// answer an ended waiter without waiting for the lookup. Only on the
+// network thread
+void dht_session::leave_flight(std::shared_ptr<get_flight> const& flight
+	, std::shared_ptr<get_waiter> const& w)
+{
+	bool last = false;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		auto i = std::find(flight->waiters.begin(), flight->waiters.end(), w);
+		// the lookup has already answered it
+		if (i == flight->waiters.end()) return;
+		flight->waiters.erase(i);
+		if (flight->waiters.empty())
+		{
+			last = true;
+			auto f = m_get_flights.find(flight->target);
+			if (f != m_get_flights.end() && f->second == flight) m_get_flights.erase(f);
+		}
+	}
+	answer(*w, op_status::cancelled, gsl::span<gsl::byte const>(), hash());
+	if (last)
+	{
+		flight->lookup.abort(op_status::cancelled);
+		flight->hedge.abort(op_status::cancelled);
+	}
+}
+
+// the lookup is done, answer everyone waiting on it. Only on the network thread
+void dht_session::end_flight(std::shared_ptr<get_flight> const& flight
+	, gsl::span<gsl::byte const> contents, hash const& next_hash)
+{
+	std::vector<std::shared_ptr<get_waiter>> waiters;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		auto f = m_get_flights.find(flight->target);
+		if (f != m_get_flights.end() && f->second == flight) m_get_flights.erase(f);
+		waiters.swap(flight->waiters);
+	}
+	op_status const s = contents.empty() ? op_status::not_found : op_status::success;
+	// the contents are only copied for the waiters which keep them
+	for (auto const& w : waiters) answer(*w, s, contents, next_hash);
+}
+
+// a synchronize waiting for the store of its target which it was merged into
+struct sync_waiter
+{
+	op_handle handle;
+	std::shared_ptr<op_timer> timer;
+	std::chrono::steady_clock::time_point deadline;
+	std::shared_ptr<boost::asio::steady_timer> expiry;
+	// released once merged into the flight's entries
+	std::vector<entry> entries;
+	// at most one of these is set
+	entry_updated entry_cb;
+	entries_updated entries_cb;
+	finalize_entries finalize_cb;
+	std::function<void(op_handle const&)> finished;
+};
+
+// one DHT synchronize on behalf of every synchronize merged into it
+struct sync_flight
+{
+	~sync_flight() { sodium_memzero(key.data(), key.size()); }
+
+	public_key target;
+	secret_key key;
+	// the highest class of the synchronizes merged into it. It is moved to
+	// it while it is queued
+	op_priority priority;
+	// set once it has been handed to the scheduler
+	bool scheduled = false;
+	// set once the scheduler has started it
+	bool started = false;
+	op_handle op;
+	// the first synchronize's timer observes the phases of the DHT operation
+	std::shared_ptr<op_timer> leader;
+	std::vector<std::shared_ptr<sync_waiter>> waiters;
+	// entries updated by the DHT, for waiters with an entries_cb, when others
+	// take them one at a time
+	std::map<std::uint32_t, entry> updated;
+};
+
+op_handle dht_session::start_synchronize(secret_key_span shared_key, std::vector<entry> entries
+	, op_options const& options, entry_updated entry_cb, entries_updated entries_cb
+	, finalize_entries finalize_cb, std::function<void(op_handle const&)> finished)
+{
+	auto w = std::make_shared<sync_waiter>();
+	w->timer = make_timer(op_type::synchronize);
+	w->handle = make_handle(*w->timer);
+	w->deadline = deadline_of(options);
+	w->entries = std::move(entries);
+	w->entry_cb = std::move(entry_cb);
+	w->entries_cb = std::move(entries_cb);
+	w->finalize_cb = std::move(finalize_cb);
+	w->finished = std::move(finished);
+	m_counters.op_queued(op_type::synchronize);
+
+	// the same key pair synchronize() stores under
+	public_key target;
+	std::array<unsigned char, crypto_sign_SECRETKEYBYTES> target_private;
+	crypto_sign_seed_keypair((unsigned char*)target.data(), target_private.data()
+		, (unsigned char const*)shared_key.data());
+	sodium_memzero(target_private.data(), target_private.size());
+
+	std::shared_ptr<sync_flight> flight;
+	bool merged = false;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		sync_chain& chain = m_sync_flights[target];
+		std::shared_ptr<sync_flight>& f = chain.next;
+		if (f)
+		{
+			merged = true;
+			// a synchronize doesn't wait for a store of a lower class than
+			// its own, as long as the store hasn't been started
+			if (options.priority < f->priority)
+			{
+				f->priority = options.priority;
+				if (f->scheduled && m_scheduler->requeue(f->op, f->priority))
+					m_ios.post([this]() { run_scheduler(); });
+			}
+		}
+		else
+		{
+			f = std::make_shared<sync_flight>();
+			f->target = target;
+			std::copy(shared_key.begin(), shared_key.end(), f->key.begin());
+			f->priority = options.priority;
+			f->leader = w->timer;
+			f->op.set_abort([this]() { wake_scheduler(); });
+			// otherwise it follows the running one
+			if (!chain.running) schedule_sync(f);
+		}
+		f->waiters.push_back(w);
+		flight = f;
+	}
+
+	// the deadline runs while waiting for the store to start too
+	if (merged) m_counters.op_coalesced(op_type::synchronize);
+	m_ios.post([=]() { join_sync_flight(flight, w); });
+	return w->handle;
+}
+
+// queue flight to be started. Called with m_flights_mutex held, so a
+// synchronize merged into it finds it queued
+void dht_session::schedule_sync(std::shared_ptr<sync_flight> const& flight)
+{
+	flight->scheduled = true;
+	schedule(flight->priority, synchronize_cost(), flight->op
+		, [this, flight](op_priority p) { start_sync_flight(flight, p); });
+}
+
+// start w's deadline and let it be cancelled, whether or not flight has been
+// started. Only on the network thread
+void dht_session::join_sync_flight(std::shared_ptr<sync_flight> const& flight
+	, std::shared_ptr<sync_waiter> const& w)
+{
+	if (w->handle.status() != op_status::pending)
+	{
+		leave_sync_flight(flight, w);
+		return;
+	}
+	w->expiry = start_deadline(w->handle, w->deadline);
+	std::weak_ptr<sync_waiter> weak = w;
+	w->handle.set_abort([this, flight, weak]()
+	{
+		if (auto w = weak.lock()) leave_sync_flight(flight, w);
+	});
+}
+
+// store the entries of every synchronize merged into flight, started by the
+// scheduler in class p. Only on the network thread
+void dht_session::start_sync_flight(std::shared_ptr<sync_flight> const& flight, op_priority p)
+{
+	std::vector<std::shared_ptr<sync_waiter>> waiters;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		// everyone left while it was queued, and it has been taken off the
+		// chain already
+		if (flight->waiters.empty())
+		{
+			op_done(p);
+			return;
+		}
+		sync_chain& chain = m_sync_flights[flight->target];
+		chain.running = flight;
+		chain.next = nullptr;
+		flight->started = true;
+		waiters.swap(flight->waiters);
+	}
+	// from here on only the network thread touches flight->waiters
+
+	for (auto const& w : waiters)
+	{
+		w->timer->dequeued();
+		// ended before it could be let go of, see join_sync_flight()
+		if (w->handle.status() != op_status::pending)
+		{
+			answer(*w, w->handle.status());
+			continue;
+		}
+		flight->waiters.push_back(w);
+	}
+
+	// later synchronizes win over earlier ones with the same sequence number
+	std::vector<entry> entries;
+	for (auto const& w : flight->waiters)
+	{
+		for (entry& e : w->entries)
+		{
+			auto i = std::find_if(entries.begin(), entries.end()
+				, [&](entry const& x) { return x.id() == e.id(); });
+			if (i == entries.end()) entries.push_back(std::move(e));
+			else if (e.seq() >= i->seq()) *i = std::move(e);
+		}
+		w->entries.clear();
+	}
+
+	// everyone left, end it without storing anything
+	if (flight->waiters.empty()) flight->op.abort(op_status::cancelled);
+
+	finalize_entries_fn finalize([flight](std::vector<entry>& e)
+	{
+		deliver_updates(*flight);
+		for (auto const& w : flight->waiters) w->finalize_cb(e);
+	});
+	sync_finished_fn finished([this, flight, p]()
+	{
+		op_done(p);
+		end_sync_flight(flight);
+	});
+
+	// entries are only reported one at a time if someone asked for that
+	bool const per_entry = std::any_of(flight->waiters.begin(), flight->waiters.end()
+		, [](std::shared_ptr<sync_waiter> const& w) { return bool(w->entry_cb); });
+	if (per_entry)
+	{
+		::synchronize(*m_dht, flight->key, std::move(entries)
+			, entry_updated_fn([flight](entry const& e)
+		{
+			bool batch = false;
+			for (auto const& w : flight->waiters)
+			{
+				if (w->entry_cb) w->entry_cb(e);
+				else if (w->entries_cb) batch = true;
+			}
+			if (!batch) return;
+			auto i = flight->updated.emplace(e.id(), e);
+			if (!i.second) i.first->second = e;
+		}), std::move(finalize), std::move(finished), flight->leader.get(), flight->op);
+	}
+	else
+	{
+		::synchronize(*m_dht, flight->key, std::move(entries)
+			, entries_updated_fn([flight](gsl::span<entry const> updated)
+		{
+			for (auto const& w : flight->waiters)
+				if (w->entries_cb) w->entries_cb(updated);
+		}), std::move(finalize), std::move(finished), flight->leader.get(), flight->op);
+	}
+}
+
+// pass the entries collected for waiters with an entries_cb. Only on the
+// network thread
+void dht_session::deliver_updates(sync_flight& flight)
+{
+	if (flight.updated.empty()) return;
+	std::vector<entry> updated;
+	updated.reserve(flight.updated.size());
+	for (auto& u : flight.updated) updated.push_back(std::move(u.second));
+	flight.updated.clear();
+	for (auto const& w : flight.waiters)
+		if (w->entries_cb) w->entries_cb(updated);
+}
+
+// answer an ended synchronize without waiting for the store. Its entries
+// are only stored if the store has already been started. Only on the
+// network thread
+void dht_session::leave_sync_flight(std::shared_ptr<sync_flight> const& flight
+	, std::shared_ptr<sync_waiter> const& w)
+{
+	bool last = false;
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		auto i = std::find(flight->waiters.begin(), flight->waiters.end(), w);
+		if (i == flight->waiters.end()) return;
+		flight->waiters.erase(i);
+		last = flight->waiters.empty();
+		queued = !flight->started;
+		if (last && queued)
+		{
+			// there's nothing left to store. Synchronizes issued from now on
+			// start a store of their own
+			auto c = m_sync_flights.find(flight->target);
+			if (c != m_sync_flights.end() && c->second.next == flight)
+			{
+				c->second.next = nullptr;
+				if (!c->second.running) m_sync_flights.erase(c);
+			}
+		}
+	}
+	if (queued) w->timer->dequeued();
+	answer(*w, w->handle.status());
+	if (last) flight->op.abort(op_status::cancelled);
+}
+
+// the store is done, answer everyone merged into it and start the one which
+// follows it, if any. Only on the network thread
+void dht_session::end_sync_flight(std::shared_ptr<sync_flight> const& flight)
+{
+	{
+		std::lock_guard<std::mutex> l(m_flights_mutex);
+		auto i = m_sync_flights.find(flight->target);
+		if (i->second.next)
+		{
+			i->second.running = nullptr;
+			schedule_sync(i->second.next);
+		}
+		else
+		{
+			m_sync_flights.erase(i);
+		}
+	}
+
+	// the DHT may give up without ever asking for the data to store
+	if (flight->op.status() == op_status::success) deliver_updates(*flight);
+	std::vector<std::shared_ptr<sync_waiter>> waiters;
+	waiters.swap(flight->waiters);
+	for (auto const& w : waiters) answer(*w, flight->op.status());
+}
+
+void dht_session::answer(sync_waiter& w, op_status s)
+{
+	if (w.handle.status() == op_status::pending) w.handle.complete(s);
+	if (w.expiry) w.expiry->cancel();
+	w.timer->finished(w.handle.status() == op_status::success);
+	w.finished(w.handle);
+	// release whatever the callbacks captured
+	w.entry_cb = nullptr;
+	w.entries_cb = nullptr;
+	w.finalize_cb = nullptr;
+	w.finished = nullptr;
+}
+
+void dht_session::schedule(op_priority p, int estimated_bytes, op_handle const& h
+	, std::function<void(op_priority)> job)
+{
+	if (m_scheduler->push(p, estimated_bytes, h, std::move(job)))
+		m_ios.post([this]() { run_scheduler(); });
+}
+
+// start the queued requests the scheduler admits, and wake up again when
+// the send budget allows more
+void dht_session::run_scheduler()
+{
+	auto const wait = m_scheduler->run(op_scheduler::clock::now());
+	if (wait == op_scheduler::clock::duration::zero()) return;
+	m_schedule_timer.expires_from_now(wait);
+	m_schedule_timer.async_wait(std::bind(&dht_session::on_schedule_timer, this, _1));
+}
+
+// a queued request has ended. Let the scheduler start it now, so it
+// invokes its callback rather than waiting for its turn
+void dht_session::wake_scheduler()
+{
+	if (m_scheduler->wake())
+		m_ios.post([this]() { run_scheduler(); });
+}
+
+void dht_session::on_schedule_timer(error_code const& ec)
+{
+	if (ec) return;
+	run_scheduler();
+}
+
+// called on the network thread when a request started by the scheduler ends
+void dht_session::op_done(op_priority p)
+{
+	if (m_scheduler->finished(p))
+		m_ios.post([this]() { run_scheduler(); });
+}
+
+op_handle dht_session::make_handle(op_timer const& timer)
+{
+	op_handle h(timer.id(), [this](std::function<void()> f) { m_ios.post(std::move(f)); });
+	// replaced once the request is started
+	h.set_abort([this]() { wake_scheduler(); });
+	return h;
+}
+
+// end h with timed_out when the deadline passes. The returned timer is
+// cancelled by the operation's final callback
+std::shared_ptr<boost::asio::steady_timer> dht_session::start_deadline(op_handle const& h
+	, std::chrono::steady_clock::time_point deadline)
+{
+	if (deadline == std::chrono::steady_clock::time_point()) return nullptr;
+	if (h.status() != op_status::pending) return nullptr;
+	auto t = std::make_shared<boost::asio::steady_timer>(m_ios);
+	t->expires_at(deadline);
+	t->async_wait([h](error_code const& ec)
+	{
+		if (ec) return;
+		h.abort(op_status::timed_out);
+	});
+	return t;
+}
+
+std::shared_ptr<op_timer> dht_session::make_timer(op_type t)
+{
+	std::uint64_t const id = m_next_op_id.fetch_add(1, std::memory_order_relaxed);
+#if SCOUT_TRACING
+	return std::make_shared<op_timer>(m_counters, t, id, std::atomic_load(&m_tracer));
+#else
+	return std::make_shared<op_timer>(m_counters, t, id, nullptr);
+#endif
+}
+
+bool dht_session::start_capture(std::string const& filename)
+{
+	auto capture = std::make_shared<packet_capture>(filename.c_str());
+	if (!capture->is_open()) return false;
+	m_ios.post([=]() { m_socket->set_capture(capture); });
+	return true;
+}
+
+void dht_session::stop_capture()
+{
+	m_ios.post([=]() { m_socket->set_capture(nullptr); });
+}
+
+void dht_session::inject_packets(std::vector<captured_packet> packets, std::function<void()> done)
+{
+	m_ios.post([=, captured_packets = std::move(packets)]() mutable
+	{
+		for (captured_packet& p : captured_packets)
+		{
+			if (p.direction != packet_direction::incoming) continue;
+			incoming_packet(p.payload.data(), p.payload.size(), p.remote);
+		}
+		done();
+	});
+}
+
+void dht_session::set_tracer(std::shared_ptr<op_tracer> tracer)
+{
+#if SCOUT_TRACING
+	std::atomic_store(&m_tracer, std::move(tracer));
+#else
+	if (tracer) log_warning("scout was built without tracing support, the tracer is ignored");
+#endif
+}
+
+void dht_session::render_metrics(std::string& out)
+{
+	scout::render_metrics(get_stats(), out);
+}
+
+int dht_session::serve_metrics(std::uint16_t port)
+{
+	if (m_metrics_server)
+	{
+		log_error("the metrics endpoint is already running on port %d"
+			, int(m_metrics_server->port()));
+		return -1;
+	}
+
+	m_metrics_server.reset(new metrics_server(m_ios_worker
+		, [this](std::string& out) { render_metrics(out); }));
+
+	error_code ec;
+	m_metrics_server->listen(port, ec);
+	if (ec)
+	{
+		log_error("failed to listen for metrics requests on port %d: (%d) %s"
+			, int(port), ec.value(), ec.message().c_str());
+		m_metrics_server.reset();
+		return -1;
+	}
+	return m_metrics_server->port();
+}
+
 void dht_session::resolve_bootstrap_servers()
 {
 	// add router node to DHT, used for bootstrapping if no other nodes are known
@@ -682,9 +1631,15 @@ void dht_session::network_thread_fun(std::promise<int>& promise)
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	udp_socket_adaptor socket_adaptor(m_socket.get());
-	m_dht = create_dht(&socket_adaptor, &socket_adaptor
-		, &save_dht_state, &load_dht_state, &m_external_ip);
+	udp_socket_adaptor socket_adaptor(m_socket.get(), m_counters);
+	socket_adaptor.set_enabled(m_settings.send_packets);
+	if (!m_dht)
+	{
+		m_dht = create_dht(&socket_adaptor, &socket_adaptor
+			, m_settings.persist_state ? &save_dht_state : &discard_dht_state
+			, m_settings.persist_state ? &load_dht_state : &skip_load_dht_state
+			, &m_external_ip);
+	}
 	m_dht->SetSHACallback(&sha1_fun);
 	m_dht->SetEd25519SignCallback(&ed25519_sign);
 	m_dht->SetEd25519VerifyCallback(&ed25519_verify);
@@ -693,7 +1648,7 @@ void dht_session::network_thread_fun(std::promise<int>& promise)
 	m_dht->SetPingBatching(6);
 
 	error_code ec;
-	int num_attempts = 10;
+	int num_attempts = m_settings.port != 0 ? 1 : 10;
 	do
 	{
 		// try to bind the externally facing port to 'external_port'. Retry 'num_attempts'
@@ -701,7 +1656,7 @@ void dht_session::network_thread_fun(std::promise<int>& promise)
 		// the 'incoming_packet' is the handler that will be called every time
 		// a new packet arrives
 		m_socket->start(std::bind(&dht_session::incoming_packet, this, _1, _2, _3)
-			, udp::endpoint(udp::v4(), m_dht_external_port), ec);
+			, udp::endpoint(m_settings.bind_address, m_dht_external_port), ec);
 
 		if (!ec)
 		{
@@ -722,16 +1677,13 @@ void dht_session::network_thread_fun(std::promise<int>& promise)
 	resolve_bootstrap_servers();
 
 	m_dht->Enable(true, m_dht_rate_limit);
+	sample_dht_stats();
 
 	// the DHT timer calls the tick function on the DHT to keep it alive
 	m_dht_timer.expires_from_now(std::chrono::seconds(1));
 	m_dht_timer.async_wait(std::bind(&dht_session::on_dht_timer, this, _1));
 
-	// update port mappings
-	update_mappings();
-
-	m_natpmp_timer.expires_from_now(std::chrono::seconds(natpmp_interval));
-	m_natpmp_timer.async_wait(std::bind(&dht_session::on_natpmp_timer, this, _1));
+	if (m_settings.map_ports) start_port_mapping();
 
 	std::unique_ptr<io_service::work> work_ios(new io_service::work(m_ios_worker));
 	m_worker_thread = std::move(std::thread([&]() { m_ios_worker.run(); }));
@@ -755,13 +1707,31 @@ void dht_session::network_thread_fun(std::promise<int>& promise)
 	m_worker_thread.join();
 }
 
+void dht_session::start_port_mapping()
+{
+	update_mappings();
+
+	m_natpmp_timer.expires_from_now(std::chrono::seconds(natpmp_interval));
+	m_natpmp_timer.async_wait(std::bind(&dht_session::on_natpmp_timer, this, _1));
+}
+
 void dht_session::on_dht_timer(error_code const& ec)
 {
 	m_dht->Tick();
+	sample_dht_stats();
 	m_dht_timer.expires_from_now(std::chrono::seconds(1));
 	m_dht_timer.async_wait(std::bind(&dht_session::on_dht_timer, this, _1));
 }
 
+// the DHT may only be accessed from the network thread, so we copy the values
+// get_stats() reports into atomics once per tick
+void dht_session::sample_dht_stats()
+{
+	m_counters.routing_table_size.store(m_dht->GetNumPeers(), std::memory_order_relaxed);
+	m_counters.dht_rate.store(m_dht->GetRate(), std::memory_order_relaxed);
+	m_counters.dht_quota.store(m_dht->GetQuota(), std::memory_order_relaxed);
+}
+
 void dht_session::on_natpmp_timer(error_code const& ec)
 {
 	if (ec)
@@ -787,11 +1757,13 @@ void dht_session::on_natpmp_timer(error_code const& ec)
 
 void dht_session::on_ip_changed(udp::endpoint const& new_ip)
 {
-	update_mappings();
+	if (m_settings.map_ports) update_mappings();
 }
 
 void dht_session::incoming_packet(char* buf, size_t len, udp::endpoint const& ep) try
 {
+	m_counters.packet_in(len);
+
 	BencodedDict msg;
 	if (!BencEntity::ParseInPlace((unsigned char*)buf, msg
 		, (unsigned char*)buf + len)) {
@@ -803,7 +1775,8 @@ void dht_session::incoming_packet(char* buf, size_t len, udp::endpoint const& ep
 	// don't forward packets to the DHT if we have disabled it.
 	// don't tempt it to do things
 	if (m_dht->IsEnabled()) {
-		udp_socket_adaptor adaptor(m_socket.get());
+		udp_socket_adaptor adaptor(m_socket.get(), m_counters);
+		adaptor.set_enabled(m_settings.send_packets);
 		if (m_dht->handleReadEvent(&adaptor, (byte*)buf, len, src))
 		{
 #if g_log_dht
@@ -0,0 +1,138 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "histogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace scout
+{
+
+namespace
+{
+	auto const relaxed = std::memory_order_relaxed;
+
+	int most_significant_bit(std::uint64_t v)
+	{
+		int ret = 0;
+		while (v >>= 1) ++ret;
+		return ret;
+	}
+}
+
+int histogram_layout::bucket_for(std::uint64_t us)
+{
+	if (us < sub_buckets) return int(us);
+	if (us >= (std::uint64_t(1) << max_exponent)) return num_buckets - 1;
+
+	// the leading bit selects the power of two range and the next
+	// sub_bucket_bits bits select the linear bucket within it
+	int const exponent = most_significant_bit(us);
+	int const shift = exponent - sub_bucket_bits;
+	int const sub = int(us >> shift) & (sub_buckets - 1);
+	return (shift + 1) * sub_buckets + sub;
+}
+
+std::uint64_t histogram_layout::bucket_lower(int bucket)
+{
+	if (bucket < sub_buckets) return std::uint64_t(bucket);
+	int const shift = bucket / sub_buckets - 1;
+	int const sub = bucket % sub_buckets;
+	return std::uint64_t(sub_buckets + sub) << shift;
+}
+
+std::uint64_t histogram_layout::bucket_upper(int bucket)
+{
+	if (bucket < sub_buckets) return std::uint64_t(bucket) + 1;
+	int const shift = bucket / sub_buckets - 1;
+	return bucket_lower(bucket) + (std::uint64_t(1) << shift);
+}
+
+histogram_snapshot::histogram_snapshot()
+	: buckets(histogram_layout::num_buckets, 0)
+	, count(0)
+	, sum(0)
+	, max(0)
+{}
+
+std::uint64_t histogram_snapshot::percentile(double fraction) const
+{
+	if (count == 0) return 0;
+
+	std::uint64_t const target = (std::max)(std::uint64_t(1)
+		, std::uint64_t(std::ceil(fraction * double(count))));
+
+	std::uint64_t seen = 0;
+	for (int i = 0; i < int(buckets.size()); ++i)
+	{
+		seen += buckets[i];
+		if (seen >= target)
+			return (std::min)(histogram_layout::bucket_upper(i) - 1, max);
+	}
+	return max;
+}
+
+void histogram_snapshot::merge(histogram_snapshot const& o)
+{
+	for (int i = 0; i < int(buckets.size()); ++i)
+		buckets[i] += o.buckets[i];
+	count += o.count;
+	sum += o.sum;
+	max = (std::max)(max, o.max);
+}
+
+latency_histogram::latency_histogram()
+	: m_count(0)
+	, m_sum(0)
+	, m_max(0)
+{
+	for (auto& b : m_buckets) b.store(0, relaxed);
+}
+
+void latency_histogram::record(std::chrono::microseconds latency)
+{
+	std::uint64_t const us = latency.count() < 0 ? 0 : std::uint64_t(latency.count());
+	m_buckets[histogram_layout::bucket_for(us)].fetch_add(1, relaxed);
+	m_count.fetch_add(1, relaxed);
+	m_sum.fetch_add(us, relaxed);
+
+	std::uint64_t prev = m_max.load(relaxed);
+	while (prev < us && !m_max.compare_exchange_weak(prev, us, relaxed));
+}
+
+histogram_snapshot latency_histogram::snapshot() const
+{
+	histogram_snapshot ret;
+	for (int i = 0; i < histogram_layout::num_buckets; ++i)
+		ret.buckets[i] = m_buckets[i].load(relaxed);
+	ret.count = m_count.load(relaxed);
+	ret.sum = m_sum.load(relaxed);
+	ret.max = m_max.load(relaxed);
+	return ret;
+}
+
+histogram_snapshot latency_histogram::snapshot_and_reset()
+{
+	histogram_snapshot ret;
+	for (int i = 0; i < histogram_layout::num_buckets; ++i)
+		ret.buckets[i] = m_buckets[i].exchange(0, relaxed);
+	ret.count = m_count.exchange(0, relaxed);
+	ret.sum = m_sum.exchange(0, relaxed);
+	ret.max = m_max.exchange(0, relaxed);
+	return ret;
+}
+
+} // namespace scout
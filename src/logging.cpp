@@ -0,0 +1,235 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "logging.hpp"
+#include "ring_buffer.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace scout
+{
+
+namespace detail
+{
+	std::atomic<int> g_log_level(int(log_level::debug));
+}
+
+namespace
+{
+	enum
+	{
+		// longer messages are truncated
+		max_line_length = 512,
+		ring_size = 1024,
+	};
+
+	struct log_record
+	{
+		log_level level;
+		std::chrono::system_clock::time_point time;
+		std::size_t length;
+		char text[max_line_length];
+	};
+
+	void stderr_sink(log_message const& msg)
+	{
+		// write the message and newline with a single call so lines from
+		// different processes sharing stderr don't get interleaved
+		char line[max_line_length + 1];
+		std::memcpy(line, msg.text, msg.length);
+		line[msg.length] = '\n';
+		std::fwrite(line, 1, msg.length + 1, stderr);
+	}
+
+	class log_backend
+	{
+	public:
+		log_backend()
+			: m_sink(&stderr_sink)
+			, m_produced(0)
+			, m_consumed(0)
+			, m_dropped(0)
+			, m_sleeping(false)
+			, m_quit(false)
+		{
+			m_thread = std::thread(&log_backend::thread_fun, this);
+		}
+
+		~log_backend()
+		{
+			{
+				std::lock_guard<std::mutex> l(m_mutex);
+				m_quit = true;
+			}
+			m_wakeup.notify_one();
+			m_thread.join();
+		}
+
+		void write(log_level level, char const* fmt, va_list vl)
+		{
+			bool const pushed = m_ring.push([&](log_record& r)
+			{
+				r.level = level;
+				r.time = std::chrono::system_clock::now();
+				int const len = std::vsnprintf(r.text, sizeof(r.text), fmt, vl);
+				r.length = len < 0 ? 0 : (std::min)(std::size_t(len), sizeof(r.text) - 1);
+				r.text[r.length] = '\0';
+			});
+
+			if (pushed) m_produced.fetch_add(1);
+			else m_dropped.fetch_add(1);
+
+			// the logging thread sets m_sleeping before it checks for messages
+			// and we check it after counting ours. Both are sequentially
+			// consistent, so at least one of us sees the other. Taking the
+			// mutex makes sure it has started waiting before we notify it
+			if (m_sleeping.load())
+			{
+				{ std::lock_guard<std::mutex> l(m_mutex); }
+				m_wakeup.notify_one();
+			}
+		}
+
+		void set_sink(log_sink sink)
+		{
+			std::lock_guard<std::mutex> l(m_sink_mutex);
+			if (sink) m_sink = std::move(sink);
+			else m_sink = &stderr_sink;
+		}
+
+		void flush()
+		{
+			std::uint64_t const target = m_produced.load(std::memory_order_acquire);
+			std::unique_lock<std::mutex> l(m_mutex);
+			m_flushed.wait(l, [&] { return m_consumed >= target; });
+		}
+
+	private:
+
+		void thread_fun()
+		{
+			std::unique_lock<std::mutex> l(m_mutex);
+			for (;;)
+			{
+				l.unlock();
+				std::uint64_t const n = drain();
+				l.lock();
+
+				m_consumed += n;
+				m_flushed.notify_all();
+				if (n > 0) continue;
+
+				if (m_quit) break;
+
+				// producers only signal us when this flag is set, so a message
+				// counted before it was set must be picked up now
+				m_sleeping.store(true);
+				if (m_produced.load() == m_consumed && m_dropped.load() == 0)
+					m_wakeup.wait(l);
+				m_sleeping.store(false, std::memory_order_relaxed);
+			}
+		}
+
+		std::uint64_t drain()
+		{
+			std::lock_guard<std::mutex> l(m_sink_mutex);
+			std::uint64_t n = 0;
+			while (m_ring.pop([&](log_record& r)
+				{
+					log_message const msg = { r.level, r.time, r.text, r.length };
+					m_sink(msg);
+				}))
+			{
+				++n;
+			}
+
+			std::uint64_t const dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+			if (dropped > 0)
+			{
+				char text[100];
+				int const len = std::snprintf(text, sizeof(text)
+					, "logging: dropped %llu messages", (unsigned long long)dropped);
+				log_message const msg = { log_level::warning, std::chrono::system_clock::now()
+					, text, std::size_t(len) };
+				m_sink(msg);
+			}
+			return n;
+		}
+
+		ring_buffer<log_record, ring_size> m_ring;
+
+		std::mutex m_sink_mutex;
+		log_sink m_sink;
+
+		std::atomic<std::uint64_t> m_produced;
+		// protected by m_mutex
+		std::uint64_t m_consumed;
+		std::atomic<std::uint64_t> m_dropped;
+		std::atomic<bool> m_sleeping;
+		bool m_quit;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wakeup;
+		std::condition_variable m_flushed;
+		std::thread m_thread;
+	};
+
+	log_backend& backend()
+	{
+		static log_backend b;
+		return b;
+	}
+}
+
+void set_log_level(log_level level)
+{
+	detail::g_log_level.store(int(level), std::memory_order_relaxed);
+}
+
+log_level get_log_level()
+{
+	return log_level(detail::g_log_level.load(std::memory_order_relaxed));
+}
+
+void set_log_sink(log_sink sink)
+{
+	backend().set_sink(std::move(sink));
+}
+
+void flush_log()
+{
+	backend().flush();
+}
+
+namespace detail
+{
+	void log_write(log_level level, char const* fmt, ...)
+	{
+		va_list vl;
+		va_start(vl, fmt);
+		backend().write(level, fmt, vl);
+		va_end(vl);
+	}
+}
+
+} // namespace scout
@@ -0,0 +1,180 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "metrics.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+
+namespace scout
+{
+
+char const* const openmetrics_content_type
+	= "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+namespace
+{
+	// bucket boundaries of the exported histograms, in microseconds
+	std::uint64_t const latency_bounds[] =
+	{
+		1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+		1000000, 2500000, 5000000, 10000000, 30000000, 60000000,
+	};
+
+	void append(std::string& out, char const* fmt, ...)
+	{
+		char buf[300];
+		va_list vl;
+		va_start(vl, fmt);
+		int const len = std::vsnprintf(buf, sizeof(buf), fmt, vl);
+		va_end(vl);
+		if (len > 0) out.append(buf, (std::min)(std::size_t(len), sizeof(buf) - 1));
+	}
+
+	void family(std::string& out, char const* name, char const* type, char const* help)
+	{
+		append(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+	}
+
+	// the seconds representation of a number of microseconds
+	std::string seconds(std::uint64_t us)
+	{
+		char buf[40];
+		int len = std::snprintf(buf, sizeof(buf), "%" PRIu64 ".%06" PRIu64, us / 1000000, us % 1000000);
+		// trim trailing zeros, but keep one digit after the decimal point
+		while (len > 2 && buf[len - 1] == '0' && buf[len - 2] != '.') --len;
+		return std::string(buf, len);
+	}
+
+	void histogram(std::string& out, char const* name, char const* labels
+		, histogram_snapshot const& h)
+	{
+		char const* sep = labels[0] == '\0' ? "" : ",";
+		std::uint64_t cumulative = 0;
+		int bucket = 0;
+		for (std::uint64_t bound : latency_bounds)
+		{
+			// count every bucket which lies entirely at or below the boundary
+			while (bucket < int(h.buckets.size())
+				&& histogram_layout::bucket_upper(bucket) - 1 <= bound)
+			{
+				cumulative += h.buckets[bucket];
+				++bucket;
+			}
+			append(out, "%s_bucket{%s%sle=\"%s\"} %" PRIu64 "\n"
+				, name, labels, sep, seconds(bound).c_str(), cumulative);
+		}
+		append(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, h.count);
+		append(out, "%s_count{%s} %" PRIu64 "\n", name, labels, h.count);
+		append(out, "%s_sum{%s} %s\n", name, labels, seconds(h.sum).c_str());
+	}
+}
+
+void render_metrics(session_stats const& stats, std::string& out)
+{
+	family(out, "scout_operations_started", "counter"
+		, "Requests issued through the session.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		append(out, "scout_operations_started_total{op=\"%s\"} %" PRIu64 "\n"
+			, op_type_name(op_type(i)), stats.ops[i].started);
+	}
+
+	family(out, "scout_operations_completed", "counter"
+		, "Requests which have invoked their completion callback.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		char const* op = op_type_name(op_type(i));
+		append(out, "scout_operations_completed_total{op=\"%s\",result=\"success\"} %" PRIu64 "\n"
+			, op, stats.ops[i].succeeded);
+		append(out, "scout_operations_completed_total{op=\"%s\",result=\"failure\"} %" PRIu64 "\n"
+			, op, stats.ops[i].failed);
+	}
+
+	family(out, "scout_operations_outstanding", "gauge"
+		, "Requests which have been issued but not completed.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		append(out, "scout_operations_outstanding{op=\"%s\"} %" PRIu64 "\n"
+			, op_type_name(op_type(i)), stats.ops[i].outstanding);
+	}
+
+	family(out, "scout_operations_coalesced", "counter"
+		, "Requests served by another request's DHT operation.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		append(out, "scout_operations_coalesced_total{op=\"%s\"} %" PRIu64 "\n"
+			, op_type_name(op_type(i)), stats.ops[i].coalesced);
+	}
+
+	family(out, "scout_operation_latency_seconds", "histogram"
+		, "Time from issuing a request until its completion callback.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		char labels[100];
+		std::snprintf(labels, sizeof(labels), "op=\"%s\"", op_type_name(op_type(i)));
+		histogram(out, "scout_operation_latency_seconds", labels, stats.ops[i].latency);
+	}
+
+	family(out, "scout_operation_phase_seconds", "histogram"
+		, "Time spent in each phase of a request.");
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		for (int p = 0; p < num_op_phases; ++p)
+		{
+			char labels[100];
+			std::snprintf(labels, sizeof(labels), "op=\"%s\",phase=\"%s\""
+				, op_type_name(op_type(i)), op_phase_name(op_phase(p)));
+			histogram(out, "scout_operation_phase_seconds", labels, stats.ops[i].phases[p]);
+		}
+	}
+
+	family(out, "scout_udp_packets", "counter", "DHT packets sent and received.");
+	append(out, "scout_udp_packets_total{direction=\"in\"} %" PRIu64 "\n", stats.packets_in);
+	append(out, "scout_udp_packets_total{direction=\"out\"} %" PRIu64 "\n", stats.packets_out);
+
+	family(out, "scout_udp_bytes", "counter", "DHT payload bytes sent and received.");
+	append(out, "scout_udp_bytes_total{direction=\"in\"} %" PRIu64 "\n", stats.bytes_in);
+	append(out, "scout_udp_bytes_total{direction=\"out\"} %" PRIu64 "\n", stats.bytes_out);
+
+	family(out, "scout_udp_send_failures", "counter", "DHT packets which failed to send.");
+	append(out, "scout_udp_send_failures_total %" PRIu64 "\n", stats.send_failures);
+
+	family(out, "scout_queued_operations", "gauge"
+		, "Requests waiting to run on the network thread.");
+	append(out, "scout_queued_operations %" PRIu64 "\n", stats.queued);
+
+	family(out, "scout_get_hedges", "counter", "Second lookups started for slow gets.");
+	append(out, "scout_get_hedges_total %" PRIu64 "\n", stats.gets_hedged);
+
+	family(out, "scout_get_hedges_won", "counter"
+		, "Second lookups which found the item before the first.");
+	append(out, "scout_get_hedges_won_total %" PRIu64 "\n", stats.hedges_won);
+
+	family(out, "scout_dht_routing_table_nodes", "gauge", "Nodes in the DHT routing table.");
+	append(out, "scout_dht_routing_table_nodes %d\n", stats.routing_table_size);
+
+	family(out, "scout_dht_rate_bytes", "gauge", "Current DHT send rate.");
+	append(out, "scout_dht_rate_bytes %d\n", stats.dht_rate);
+
+	family(out, "scout_dht_quota_bytes", "gauge", "Remaining DHT send quota.");
+	append(out, "scout_dht_quota_bytes %d\n", stats.dht_quota);
+
+	out += "# EOF\n";
+}
+
+} // namespace scout
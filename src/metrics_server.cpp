@@ -0,0 +1,190 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "metrics_server.hpp"
+#include "metrics.hpp"
+#include "utils.hpp" // for log_debug
+
+#include <cstdio>
+#include <istream>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+namespace scout
+{
+
+using boost::asio::ip::tcp;
+using boost::system::error_code;
+
+namespace
+{
+	enum
+	{
+		// requests larger than this are dropped
+		max_request_size = 4096
+	};
+}
+
+struct metrics_server::connection : std::enable_shared_from_this<connection>
+{
+	connection(boost::asio::io_service& ios, render_fun const& r)
+		: socket(ios), timer(ios), request(max_request_size), render(r)
+		, received(false)
+	{}
+
+	void start(std::chrono::milliseconds timeout)
+	{
+		timer.expires_from_now(timeout);
+		timer.async_wait(std::bind(&connection::on_timeout, shared_from_this()
+			, std::placeholders::_1));
+		boost::asio::async_read_until(socket, request, "\r\n\r\n"
+			, std::bind(&connection::on_request, shared_from_this()
+				, std::placeholders::_1));
+	}
+
+	void on_timeout(error_code const& ec)
+	{
+		// the timer may have expired just as the request arrived
+		if (received || ec == boost::asio::error::operation_aborted) return;
+		log_debug("metrics: timed out waiting for a request");
+		// the read fails, which releases the connection
+		error_code ignore;
+		socket.close(ignore);
+	}
+
+	void on_request(error_code const& ec)
+	{
+		received = true;
+		error_code ignore;
+		timer.cancel(ignore);
+		if (ec)
+		{
+			log_debug("metrics: failed to read request: %s", ec.message().c_str());
+			return;
+		}
+
+		std::istream is(&request);
+		std::string method, target;
+		is >> method >> target;
+
+		std::string body;
+		char const* status = "200 OK";
+		char const* content_type = openmetrics_content_type;
+		if (method != "GET")
+		{
+			status = "405 Method Not Allowed";
+			content_type = "text/plain";
+		}
+		else if (target != "/metrics")
+		{
+			status = "404 Not Found";
+			content_type = "text/plain";
+		}
+		else
+		{
+			render(body);
+		}
+
+		char header[300];
+		int const len = std::snprintf(header, sizeof(header)
+			, "HTTP/1.0 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %d\r\n"
+			"Connection: close\r\n\r\n"
+			, status, content_type, int(body.size()));
+		response.assign(header, len);
+		response += body;
+
+		boost::asio::async_write(socket, boost::asio::buffer(response)
+			, std::bind(&connection::on_written, shared_from_this(), std::placeholders::_1));
+	}
+
+	void on_written(error_code const& ec)
+	{
+		error_code ignore;
+		socket.shutdown(tcp::socket::shutdown_both, ignore);
+		socket.close(ignore);
+	}
+
+	tcp::socket socket;
+	boost::asio::steady_timer timer;
+	boost::asio::streambuf request;
+	std::string response;
+	render_fun render;
+	bool received;
+};
+
+metrics_server::metrics_server(boost::asio::io_service& ios, render_fun render
+	, std::chrono::milliseconds request_timeout)
+	: m_ios(ios)
+	, m_acceptor(ios)
+	, m_render(std::move(render))
+	, m_request_timeout(request_timeout)
+	, m_port(0)
+{}
+
+metrics_server::~metrics_server()
+{
+	close();
+}
+
+void metrics_server::listen(std::uint16_t port, error_code& ec)
+{
+	tcp::endpoint const ep(boost::asio::ip::address_v4::loopback(), port);
+	m_acceptor.open(ep.protocol(), ec);
+	if (ec) return;
+	m_acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+	if (ec) return;
+	m_acceptor.bind(ep, ec);
+	if (ec) return;
+	m_acceptor.listen(boost::asio::socket_base::max_connections, ec);
+	if (ec) return;
+	// the acceptor belongs to the io_service's thread once it is accepting,
+	// so the port is read here rather than in port()
+	m_port = m_acceptor.local_endpoint(ec).port();
+	if (ec) return;
+	start_accept();
+}
+
+void metrics_server::close()
+{
+	error_code ignore;
+	m_acceptor.close(ignore);
+}
+
+std::uint16_t metrics_server::port() const
+{
+	return m_port;
+}
+
+void metrics_server::start_accept()
+{
+	auto c = std::make_shared<connection>(m_ios, m_render);
+	m_acceptor.async_accept(c->socket, std::bind(&metrics_server::on_accept, this, c
+		, std::placeholders::_1));
+}
+
+void metrics_server::on_accept(std::shared_ptr<connection> c, error_code const& ec)
+{
+	if (ec == boost::asio::error::operation_aborted || !m_acceptor.is_open()) return;
+	if (!ec) c->start(m_request_timeout);
+	else log_debug("metrics: accept failed: %s", ec.message().c_str());
+	start_accept();
+}
+
+} // namespace scout
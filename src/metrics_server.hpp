@@ -0,0 +1,71 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace scout
+{
+
+// A minimal HTTP/1.0 server which answers GET /metrics with the output of
+// a render function. It only binds to the loopback interface and serves one
+// request per connection.
+struct metrics_server
+{
+	using render_fun = std::function<void(std::string&)>;
+
+	// connections which haven't sent a whole request within request_timeout
+	// are closed
+	metrics_server(boost::asio::io_service& ios, render_fun render
+		, std::chrono::milliseconds request_timeout = std::chrono::seconds(5));
+	~metrics_server();
+
+	metrics_server(metrics_server const&) = delete;
+	metrics_server& operator=(metrics_server const&) = delete;
+
+	// bind to 127.0.0.1:port and start accepting connections
+	void listen(std::uint16_t port, boost::system::error_code& ec);
+
+	// stop accepting connections. Connections in progress are completed
+	void close();
+
+	// the port bound by listen(). May be called from any thread
+	std::uint16_t port() const;
+
+private:
+	struct connection;
+
+	void start_accept();
+	void on_accept(std::shared_ptr<connection> c, boost::system::error_code const& ec);
+
+	boost::asio::io_service& m_ios;
+	boost::asio::ip::tcp::acceptor m_acceptor;
+	render_fun m_render;
+	std::chrono::milliseconds m_request_timeout;
+	std::uint16_t m_port;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,258 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "op_scheduler.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace scout
+{
+
+namespace
+{
+	enum
+	{
+		// fixed point scale of the virtual time, so small costs divided by
+		// large weights still advance it
+		stride_scale = 1 << 16,
+	};
+}
+
+op_scheduler::op_scheduler(std::array<class_limits, num_op_priorities> const& limits
+	, int rate_limit, clock::time_point now)
+	: m_run_pending(false)
+	, m_running(false)
+	, m_sweep(false)
+	, m_virtual_time(0)
+	, m_rate(rate_limit)
+	, m_tokens(rate_limit > 0 ? rate_limit : 0)
+	, m_last_refill(now)
+{
+	for (int i = 0; i < num_op_priorities; ++i)
+	{
+		m_classes[i].weight = (std::max)(1, limits[i].weight);
+		m_classes[i].max_outstanding = (std::max)(1, limits[i].max_outstanding);
+		m_classes[i].outstanding = 0;
+		m_classes[i].pass = 0;
+	}
+}
+
+bool op_scheduler::push(op_priority p, int estimated_bytes, op_handle h, job j)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	op_class& c = m_classes[int(p)];
+	// a class which has been idle rejoins at the current virtual time, it
+	// doesn't get to make up for the time it had nothing to send
+	if (c.queue.empty()) c.pass = (std::max)(c.pass, m_virtual_time);
+	if (h.status() != op_status::pending) m_sweep = true;
+	c.queue.push_back(queued_op{ (std::max)(estimated_bytes, 0), std::move(h), std::move(j) });
+	if (m_run_pending) return false;
+	m_run_pending = true;
+	return true;
+}
+
+bool op_scheduler::requeue(op_handle const& h, op_priority p)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	for (int i = 0; i < num_op_priorities; ++i)
+	{
+		if (i == int(p)) continue;
+		std::deque<queued_op>& q = m_classes[i].queue;
+		auto op = std::find_if(q.begin(), q.end()
+			, [&](queued_op const& o) { return o.handle == h; });
+		if (op == q.end()) continue;
+
+		op_class& c = m_classes[int(p)];
+		if (c.queue.empty()) c.pass = (std::max)(c.pass, m_virtual_time);
+		c.queue.push_back(std::move(*op));
+		q.erase(op);
+		if (m_run_pending) return false;
+		m_run_pending = true;
+		return true;
+	}
+	return false;
+}
+
+bool op_scheduler::wake()
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	m_sweep = true;
+	if (m_run_pending) return false;
+	m_run_pending = true;
+	return true;
+}
+
+op_scheduler::clock::duration op_scheduler::run(clock::time_point now)
+{
+	std::unique_lock<std::mutex> l(m_mutex);
+	m_run_pending = false;
+	m_running = true;
+	refill(now);
+
+	for (;;)
+	{
+		// requests which ended while queued are started out of turn, and
+		// without being charged, wherever they are in their queue
+		if (m_sweep)
+		{
+			m_sweep = false;
+			std::vector<std::pair<int, queued_op>> ended;
+			for (int i = 0; i < num_op_priorities; ++i)
+			{
+				std::deque<queued_op>& q = m_classes[i].queue;
+				auto const first = std::stable_partition(q.begin(), q.end()
+					, [](queued_op const& op) { return op.handle.status() == op_status::pending; });
+				for (auto j = first; j != q.end(); ++j)
+					ended.emplace_back(i, std::move(*j));
+				q.erase(first, q.end());
+			}
+			for (auto& e : ended)
+			{
+				++m_classes[e.first].outstanding;
+				l.unlock();
+				e.second.fun(op_priority(e.first));
+				l.lock();
+			}
+			continue;
+		}
+
+		int best = -1;
+		bool ended = false;
+		for (int i = 0; i < num_op_priorities; ++i)
+		{
+			op_class const& c = m_classes[i];
+			if (c.queue.empty()) continue;
+			// a handle without a hook to wake() us is only noticed at the front
+			if (c.queue.front().handle.status() != op_status::pending)
+			{
+				best = i;
+				ended = true;
+				break;
+			}
+			if (c.outstanding >= c.max_outstanding) continue;
+			if (m_rate > 0 && !admitted(i)) continue;
+			if (best < 0 || c.pass < m_classes[best].pass) best = i;
+		}
+		if (best < 0) break;
+
+		op_class& c = m_classes[best];
+		queued_op op = std::move(c.queue.front());
+		c.queue.pop_front();
+		if (!ended)
+		{
+			m_virtual_time = c.pass;
+			c.pass += std::uint64_t(op.cost + 1) * stride_scale / c.weight;
+			m_tokens -= op.cost;
+		}
+		++c.outstanding;
+
+		// the request may complete, or issue new ones, right away
+		l.unlock();
+		op.fun(op_priority(best));
+		l.lock();
+	}
+	m_running = false;
+
+	if (m_rate <= 0) return clock::duration::zero();
+
+	// how long until the budget admits a request which is only held back by
+	// it. A class which may borrow but is waiting for its turn is admitted
+	// once the bucket is out of debt
+	std::int64_t needed = (std::numeric_limits<std::int64_t>::max)();
+	for (int i = 0; i < num_op_priorities; ++i)
+	{
+		op_class const& c = m_classes[i];
+		if (c.queue.empty() || c.outstanding >= c.max_outstanding) continue;
+		std::int64_t const t = threshold(op_priority(i));
+		std::int64_t const target = m_tokens < t ? t : 0;
+		if (target <= m_tokens) continue;
+		needed = (std::min)(needed, target - m_tokens);
+	}
+	if (needed == (std::numeric_limits<std::int64_t>::max)())
+		return clock::duration::zero();
+	return std::chrono::microseconds(needed * 1000000 / m_rate + 1);
+}
+
+bool op_scheduler::finished(op_priority p)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	op_class& c = m_classes[int(p)];
+	--c.outstanding;
+	// run() is already looking at the queues
+	if (m_running) return false;
+	if (c.queue.empty() || m_run_pending) return false;
+	m_run_pending = true;
+	return true;
+}
+
+std::size_t op_scheduler::queued(op_priority p) const
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	return m_classes[int(p)].queue.size();
+}
+
+void op_scheduler::refill(clock::time_point now)
+{
+	if (m_rate <= 0) return;
+	std::int64_t const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+		now - m_last_refill).count();
+	std::int64_t const added = elapsed * m_rate / 1000000;
+	if (added <= 0) return;
+	// at most one second worth of budget is saved up
+	if (m_tokens + added >= m_rate)
+	{
+		m_tokens = m_rate;
+		m_last_refill = now;
+		return;
+	}
+	m_tokens += added;
+	// keep the time the fraction of a byte left over took for the next refill
+	m_last_refill += std::chrono::microseconds((added * 1000000 + m_rate - 1) / m_rate);
+}
+
+// whether the budget allows a request of class i to start now
+bool op_scheduler::admitted(int i) const
+{
+	if (m_tokens < threshold(op_priority(i))) return false;
+	if (m_tokens >= 0) return true;
+
+	// a class may only borrow on its turn. Otherwise it would keep the bucket
+	// in debt and starve the classes which wait for it to be paid back
+	for (int j = 0; j < num_op_priorities; ++j)
+	{
+		op_class const& c = m_classes[j];
+		if (j == i || c.queue.empty() || c.outstanding >= c.max_outstanding) continue;
+		if (threshold(op_priority(j)) > 0) continue;
+		if (c.pass < m_classes[i].pass) return false;
+	}
+	return true;
+}
+
+// the least budget which must be available to start a request of class p
+std::int64_t op_scheduler::threshold(op_priority p) const
+{
+	switch (p)
+	{
+		case op_priority::interactive: return -std::int64_t(m_rate);
+		case op_priority::normal: return 0;
+		case op_priority::background: return m_rate / 2;
+	}
+	return 0;
+}
+
+} // namespace scout
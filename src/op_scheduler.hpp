@@ -0,0 +1,140 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef OP_SCHEDULER_HPP
+#define OP_SCHEDULER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include "scout.hpp"
+
+namespace scout
+{
+
+// Decides which queued requests a dht_session starts next.
+//
+// Each op_priority class has its own FIFO. Classes are served in proportion
+// to their weights, measured in estimated bytes sent (stride scheduling), so
+// a class with twice the weight gets twice the send budget while both have
+// work queued. A class never has more than its cap of requests outstanding.
+//
+// Requests may also be admitted against a token bucket, which refills at
+// the session's send budget. Interactive requests may borrow up to one second of
+// budget when it's their turn, normal ones wait until the bucket isn't in
+// debt and background ones until it is half full, which keeps room for
+// interactive requests under bulk load.
+//
+// push(), requeue() and wake() may be called from any thread, everything else only
+// from the network thread.
+class op_scheduler
+{
+public:
+	using clock = std::chrono::steady_clock;
+	// called with the class the request was started in, which is what
+	// finished() must be passed
+	using job = std::function<void(op_priority)>;
+
+	struct class_limits
+	{
+		// relative share of the send budget
+		int weight;
+		// maximum number of requests started but not finished
+		int max_outstanding;
+	};
+
+	// rate_limit is in bytes per second, 0 or less disables the budget
+	op_scheduler(std::array<class_limits, num_op_priorities> const& limits
+		, int rate_limit, clock::time_point now);
+
+	op_scheduler(op_scheduler const&) = delete;
+	op_scheduler& operator=(op_scheduler const&) = delete;
+
+	// queue j to be started. estimated_bytes is what it's expected to send.
+	// A request whose handle has already ended is started right away, out of
+	// turn and without being charged. Returns true if the caller must arrange
+	// for run() to be called, false if a call is already pending
+	bool push(op_priority p, int estimated_bytes, op_handle h, job j);
+
+	// move the queued request h to the back of class p's queue, unless it
+	// has been started already. Returns true if the caller must arrange for
+	// run() to be called
+	bool requeue(op_handle const& h, op_priority p);
+
+	// a queued request has ended, so run() should start it right away to
+	// invoke its callback. Returns true if the caller must arrange for run()
+	// to be called, false if a call is already pending
+	bool wake();
+
+	// start every queued request which is admitted now. Returns how long to
+	// wait before calling run() again for requests held back by the budget,
+	// or zero if there are none. Requests held back by their class cap are
+	// reconsidered when finished() is called
+	clock::duration run(clock::time_point now);
+
+	// a request started by run() of class p has finished. Returns true if
+	// run() should be called to start more requests
+	bool finished(op_priority p);
+
+	std::size_t queued(op_priority p) const;
+	int outstanding(op_priority p) const { return m_classes[int(p)].outstanding; }
+
+private:
+	struct queued_op
+	{
+		int cost;
+		op_handle handle;
+		job fun;
+	};
+
+	struct op_class
+	{
+		std::deque<queued_op> queue;
+		int weight;
+		int max_outstanding;
+		// only touched on the network thread
+		int outstanding;
+		// the class' position in virtual time, advanced by cost / weight
+		// every time one of its requests is started
+		std::uint64_t pass;
+	};
+
+	void refill(clock::time_point now);
+	bool admitted(int i) const;
+	std::int64_t threshold(op_priority p) const;
+
+	mutable std::mutex m_mutex;
+	std::array<op_class, num_op_priorities> m_classes;
+	// set while a call to run() is due
+	bool m_run_pending;
+	// set while run() is starting requests
+	bool m_running;
+	// set when a queued request may have ended, anywhere in the queues
+	bool m_sweep;
+	std::uint64_t m_virtual_time;
+
+	int m_rate;
+	// bytes which may be sent right now, negative when in debt
+	std::int64_t m_tokens;
+	clock::time_point m_last_refill;
+};
+
+} // namespace scout
+
+#endif
@@ -0,0 +1,239 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "packet_capture.hpp"
+#include "utils.hpp" // for log_error
+#include <cerrno>
+#include <cstring>
+
+namespace scout
+{
+
+namespace
+{
+	std::uint32_t const pcap_magic = 0xa1b2c3d4;
+	std::uint32_t const linktype_linux_sll = 113;
+	std::uint32_t const snap_length = 65535;
+
+	// the packet types of the Linux cooked header
+	std::uint16_t const sll_host = 0;
+	std::uint16_t const sll_outgoing = 4;
+
+	enum
+	{
+		sll_header_size = 16,
+		ip_header_size = 20,
+		udp_header_size = 8,
+		headers_size = sll_header_size + ip_header_size + udp_header_size,
+	};
+
+	struct pcap_file_header
+	{
+		std::uint32_t magic;
+		std::uint16_t version_major;
+		std::uint16_t version_minor;
+		std::int32_t thiszone;
+		std::uint32_t sigfigs;
+		std::uint32_t snaplen;
+		std::uint32_t linktype;
+	};
+
+	struct pcap_record_header
+	{
+		std::uint32_t ts_sec;
+		std::uint32_t ts_usec;
+		std::uint32_t incl_len;
+		std::uint32_t orig_len;
+	};
+
+	// the headers in the captured data are in network byte order
+	unsigned char* write16(unsigned char* p, std::uint16_t v)
+	{
+		p[0] = v >> 8;
+		p[1] = v & 0xff;
+		return p + 2;
+	}
+
+	unsigned char* write32(unsigned char* p, std::uint32_t v)
+	{
+		p = write16(p, v >> 16);
+		return write16(p, v & 0xffff);
+	}
+
+	std::uint16_t read16(unsigned char const* p)
+	{
+		return std::uint16_t((p[0] << 8) | p[1]);
+	}
+
+	std::uint32_t read32(unsigned char const* p)
+	{
+		return (std::uint32_t(read16(p)) << 16) | read16(p + 2);
+	}
+
+	std::uint16_t ip_checksum(unsigned char const* p, int len)
+	{
+		std::uint32_t sum = 0;
+		for (int i = 0; i < len; i += 2) sum += read16(p + i);
+		while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+		return std::uint16_t(~sum);
+	}
+}
+
+packet_capture::packet_capture(char const* filename)
+	: m_file(std::fopen(filename, "wb"))
+	, m_packets(0)
+{
+	if (m_file == nullptr)
+	{
+		log_error("failed to open capture file \"%s\": %s", filename, strerror(errno));
+		return;
+	}
+
+	pcap_file_header const h = { pcap_magic, 2, 4, 0, 0, snap_length, linktype_linux_sll };
+	std::fwrite(&h, sizeof(h), 1, m_file);
+}
+
+packet_capture::~packet_capture()
+{
+	if (m_file) std::fclose(m_file);
+}
+
+void packet_capture::record(packet_direction dir, char const* buf, std::size_t len
+	, boost::asio::ip::udp::endpoint const& remote
+	, boost::asio::ip::udp::endpoint const& local)
+{
+	if (m_file == nullptr) return;
+	if (!remote.address().is_v4() || !local.address().is_v4()) return;
+	if (len > snap_length - headers_size) return;
+
+	bool const in = dir == packet_direction::incoming;
+	auto const& src = in ? remote : local;
+	auto const& dst = in ? local : remote;
+
+	unsigned char headers[headers_size];
+	unsigned char* p = headers;
+
+	// Linux cooked header
+	p = write16(p, in ? sll_host : sll_outgoing);
+	p = write16(p, 772); // ARPHRD_LOOPBACK, there is no link layer address
+	p = write16(p, 0);
+	std::memset(p, 0, 8);
+	p += 8;
+	p = write16(p, 0x0800); // IPv4
+
+	// IPv4 header
+	unsigned char* ip = p;
+	*p++ = 0x45;
+	*p++ = 0;
+	p = write16(p, std::uint16_t(ip_header_size + udp_header_size + len));
+	p = write32(p, 0); // id and fragmentation
+	*p++ = 64; // ttl
+	*p++ = 17; // UDP
+	p = write16(p, 0);
+	p = write32(p, src.address().to_v4().to_ulong());
+	p = write32(p, dst.address().to_v4().to_ulong());
+	write16(ip + 10, ip_checksum(ip, ip_header_size));
+
+	// UDP header, the checksum is optional over IPv4
+	p = write16(p, src.port());
+	p = write16(p, dst.port());
+	p = write16(p, std::uint16_t(udp_header_size + len));
+	p = write16(p, 0);
+
+	auto const now = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	std::uint32_t const total = std::uint32_t(headers_size + len);
+	pcap_record_header const r = { std::uint32_t(now / 1000000)
+		, std::uint32_t(now % 1000000), total, total };
+
+	std::fwrite(&r, sizeof(r), 1, m_file);
+	std::fwrite(headers, sizeof(headers), 1, m_file);
+	std::fwrite(buf, 1, len, m_file);
+	++m_packets;
+}
+
+capture_reader::capture_reader(char const* filename)
+	: m_file(std::fopen(filename, "rb"))
+{
+	if (m_file == nullptr)
+	{
+		log_error("failed to open capture file \"%s\": %s", filename, strerror(errno));
+		return;
+	}
+
+	pcap_file_header h;
+	if (std::fread(&h, sizeof(h), 1, m_file) != 1
+		|| h.magic != pcap_magic
+		|| h.linktype != linktype_linux_sll)
+	{
+		log_error("\"%s\" is not a capture written by scout", filename);
+		std::fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+capture_reader::~capture_reader()
+{
+	if (m_file) std::fclose(m_file);
+}
+
+bool capture_reader::next(captured_packet& pkt)
+{
+	if (m_file == nullptr) return false;
+
+	for (;;)
+	{
+		pcap_record_header r;
+		if (std::fread(&r, sizeof(r), 1, m_file) != 1) return false;
+		if (r.incl_len > snap_length) return false;
+		m_buffer.resize(r.incl_len);
+		if (r.incl_len > 0 && std::fread(m_buffer.data(), r.incl_len, 1, m_file) != 1)
+			return false;
+
+		unsigned char const* p = m_buffer.data();
+		if (r.incl_len < headers_size
+			|| read16(p + 14) != 0x0800
+			|| (p[sll_header_size] >> 4) != 4
+			|| p[sll_header_size + 9] != 17)
+		{
+			continue;
+		}
+
+		using boost::asio::ip::address_v4;
+		using boost::asio::ip::udp;
+
+		bool const in = read16(p) != sll_outgoing;
+		unsigned char const* ip = p + sll_header_size;
+		int const ihl = (ip[0] & 0xf) * 4;
+		if (ihl < ip_header_size || sll_header_size + ihl + udp_header_size > int(r.incl_len))
+			continue;
+		unsigned char const* udp_header = ip + ihl;
+		udp::endpoint const src(address_v4(read32(ip + 12)), read16(udp_header));
+		udp::endpoint const dst(address_v4(read32(ip + 16)), read16(udp_header + 2));
+
+		pkt.direction = in ? packet_direction::incoming : packet_direction::outgoing;
+		pkt.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<
+			std::chrono::system_clock::duration>(std::chrono::microseconds(
+				std::uint64_t(r.ts_sec) * 1000000 + r.ts_usec)));
+		pkt.remote = in ? src : dst;
+		pkt.local = in ? dst : src;
+		char const* payload = (char const*)udp_header + udp_header_size;
+		pkt.payload.assign(payload, (char const*)m_buffer.data() + r.incl_len);
+		return true;
+	}
+}
+
+} // namespace scout
@@ -0,0 +1,127 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace scout
+{
+
+// A bounded, lock-free multi-producer queue of fixed size slots.
+// Each slot carries a sequence number which tells producers and consumers
+// whether it is free to be written or ready to be read. Slots are filled
+// and drained in place through callbacks so large records never have to
+// be copied in or out of the ring.
+template <typename T, std::size_t Capacity>
+class ring_buffer
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0
+		, "ring_buffer capacity must be a power of two");
+
+public:
+	ring_buffer()
+		: m_slots(new slot[Capacity])
+		, m_head(0)
+		, m_tail(0)
+	{
+		for (std::size_t i = 0; i < Capacity; ++i)
+			m_slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	ring_buffer(ring_buffer const&) = delete;
+	ring_buffer& operator=(ring_buffer const&) = delete;
+
+	// claim a free slot and call fill(T&) to populate it
+	// returns false, without calling fill, if the ring is full
+	template <typename F>
+	bool push(F&& fill)
+	{
+		std::size_t pos = m_head.load(std::memory_order_relaxed);
+		slot* s;
+		for (;;)
+		{
+			s = &m_slots[pos & (Capacity - 1)];
+			std::size_t const seq = s->seq.load(std::memory_order_acquire);
+			std::ptrdiff_t const diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+			if (diff == 0)
+			{
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// the consumer hasn't released this slot yet
+				return false;
+			}
+			else
+			{
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+
+		fill(s->value);
+		s->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// call consume(T&) on the oldest filled slot and release it
+	// returns false if there was nothing to consume
+	// only one thread may pop at a time
+	template <typename F>
+	bool pop(F&& consume)
+	{
+		std::size_t const pos = m_tail.load(std::memory_order_relaxed);
+		slot& s = m_slots[pos & (Capacity - 1)];
+		std::size_t const seq = s.seq.load(std::memory_order_acquire);
+		if (std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1) < 0) return false;
+
+		m_tail.store(pos + 1, std::memory_order_relaxed);
+		consume(s.value);
+		s.seq.store(pos + Capacity, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		std::size_t const pos = m_tail.load(std::memory_order_relaxed);
+		slot const& s = m_slots[pos & (Capacity - 1)];
+		return std::ptrdiff_t(s.seq.load(std::memory_order_acquire)) - std::ptrdiff_t(pos + 1) < 0;
+	}
+
+	static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+	struct slot
+	{
+		std::atomic<std::size_t> seq;
+		T value;
+	};
+
+	std::unique_ptr<slot[]> m_slots;
+	// producers and the consumer spin on different cache lines. Padding
+	// rather than alignas keeps the ring usable from plain new before C++17
+	std::atomic<std::size_t> m_head;
+	char m_padding[64];
+	std::atomic<std::size_t> m_tail;
+};
+
+} // namespace scout
+
+#endif
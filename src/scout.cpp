@@ -17,50 +17,354 @@ limitations under the License.
 #include "utils.hpp"
 #include "scout.hpp"
 #include "DhtImpl.h"
+#include "arena.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <sodium/crypto_generichash.h>
 #include <sodium/crypto_sign.h>
 #include <sodium/crypto_scalarmult.h>
+#include <sodium/utils.h>
 
 namespace scout
 {
 
+namespace detail
+{
+	struct op_state
+	{
+		op_state(std::uint64_t i, std::function<void(std::function<void()>)> d)
+			: status(int(op_status::pending)), id(i), dispatch(std::move(d)) {}
+
+		std::atomic<int> status;
+		std::uint64_t const id;
+		std::function<void(std::function<void()>)> const dispatch;
+		// ends the operation early, once status has been set. Only set while
+		// the operation is running
+		std::function<void()> abort;
+	};
+
+	struct op_access
+	{
+		static void set_abort(op_handle const& h, std::function<void()> f)
+		{ h.set_abort(std::move(f)); }
+		static void complete(op_handle const& h, op_status s) { h.complete(s); }
+	};
+}
+
 namespace
 {
-	// context for the DHT put callbacks: 
-	struct dht_put_context {
+	// notifies an (optional) observer of the beginning and end of a phase
+	struct phase_scope
+	{
+		phase_scope(op_observer* observer, op_phase phase)
+			: m_observer(observer), m_phase(phase)
+		{
+			if (m_observer) m_observer->phase_begin(m_phase);
+		}
 
-		entry_updated entry_cb;
-		finalize_entries finalize_cb;
-		sync_finished finished_cb;
-		secret_key secret;
-		std::map<uint32_t, entry> entries_map;
+		~phase_scope()
+		{
+			if (m_observer) m_observer->phase_end(m_phase);
+		}
+
+		phase_scope(phase_scope const&) = delete;
+		phase_scope& operator=(phase_scope const&) = delete;
+
+	private:
+		op_observer* m_observer;
+		op_phase m_phase;
+	};
+
+	void notify(op_observer* observer, char const* name)
+	{
+		if (observer) observer->event(name);
+	}
+
+	void complete(op_handle const& handle, op_status s)
+	{
+		detail::op_access::complete(handle, s);
+	}
+
+	void set_abort(op_handle const& handle, std::function<void()> f)
+	{
+		detail::op_access::set_abort(handle, std::move(f));
+	}
+
+	using blob_digest = std::array<unsigned char, crypto_generichash_BYTES_MIN>;
 
-		dht_put_context(std::vector<entry> const& entries
+	// context for the DHT put callbacks. It lives in its own arena, which
+	// everything else the operation allocates is drawn from too
+	struct dht_put_context {
+		using entry_map = std::map<uint32_t, entry, std::less<uint32_t>
+			, arena_allocator<std::pair<uint32_t const, entry>>>;
+
+		arena& memory;
+		// one of these is set
+		entry_updated_fn entry_cb;
+		entries_updated_fn entries_cb;
+		finalize_entries_fn finalize_cb;
+		sync_finished_fn finished_cb;
+		secret_key secret;
+		entry_map entries_map;
+		// entries updated since entries_cb was last called, by id
+		std::vector<uint32_t, arena_allocator<uint32_t>> updated_ids;
+		// reused for decrypting every response and encrypting the result
+		gsl::span<char> scratch;
+		// the highest sequence number of a response which was decrypted
+		int64 max_seq;
+		// digests of the last responses which were decrypted
+		std::array<blob_digest, 8> seen_blobs;
+		int num_seen_blobs;
+		op_observer* observer;
+		op_handle handle;
+		// set once put_callback has been called and the lookup phase is over
+		bool lookup_done;
+
+		dht_put_context(arena& a
+			, std::vector<entry> entries
 			, secret_key_span key
-			, entry_updated e_cb
-			, finalize_entries f_cb
-			, sync_finished s_cb)
-			: entry_cb(std::move(e_cb))
+			, entry_updated_fn e_cb
+			, entries_updated_fn es_cb
+			, finalize_entries_fn f_cb
+			, sync_finished_fn s_cb
+			, op_observer* obs
+			, op_handle h)
+			: memory(a)
+			, entry_cb(std::move(e_cb))
+			, entries_cb(std::move(es_cb))
 			, finalize_cb(std::move(f_cb))
 			, finished_cb(std::move(s_cb))
+			, entries_map(std::less<uint32_t>(), entry_map::allocator_type(a))
+			, updated_ids(arena_allocator<uint32_t>(a))
+			, max_seq((std::numeric_limits<int64>::min)())
+			, num_seen_blobs(0)
+			, observer(obs)
+			, handle(std::move(h))
+			, lookup_done(false)
 		{
 			std::copy(key.begin(), key.end(), secret.data());
 			// build a map of entries, indexed by id, based on the vector of entries:
-			for (entry const& e : entries)
-				entries_map.emplace(e.id(), e);
+			for (entry& e : entries)
+				entries_map.emplace(e.id(), std::move(e));
 		}
 	};
+
+	dht_put_context* new_sync_context(std::vector<entry> entries, secret_key_span key
+		, entry_updated_fn e_cb, entries_updated_fn es_cb, finalize_entries_fn f_cb
+		, sync_finished_fn s_cb, op_observer* obs, op_handle h)
+	{
+		arena* a = acquire_arena();
+		void* mem = a->allocate(sizeof(dht_put_context), alignof(dht_put_context));
+		return new (mem) dht_put_context(*a, std::move(entries), key, std::move(e_cb)
+			, std::move(es_cb), std::move(f_cb), std::move(s_cb), obs, std::move(h));
+	}
+
+	gsl::span<char> scratch_buffer(dht_put_context& c, std::size_t size)
+	{
+		if (std::size_t(c.scratch.size()) < size)
+			c.scratch = gsl::as_span(static_cast<char*>(c.memory.allocate(size, 1)), size);
+		return c.scratch.subspan(0, std::ptrdiff_t(size));
+	}
+
+	// free the context and everything allocated from its arena
+	void delete_sync_context(dht_put_context* c)
+	{
+		arena& a = c->memory;
+		c->~dht_put_context();
+		release_arena(&a);
+	}
+
+	// context for the immutable put and get callbacks
+	struct put_context
+	{
+		put_finished_fn finished_cb;
+		op_observer* observer;
+		op_handle handle;
+	};
+
+	struct get_context
+	{
+		// one of these is set until the get ends
+		item_received_fn received_cb;
+		item_viewed_fn viewed_cb;
+		op_observer* observer;
+		op_handle handle;
+
+		bool ended() const { return !received_cb && !viewed_cb; }
+	};
+
+	// Invoke the final callback of an operation and release everything but
+	// the context itself, which the DHT still refers to. An operation which
+	// ends early does this when it's aborted, and its context is freed once
+	// the DHT calls back with a cleared callback
+
+	void end_sync(dht_put_context& c)
+	{
+		if (c.observer)
+		{
+			// the DHT may give up without ever asking for the data to store
+			c.observer->phase_end(c.lookup_done ? op_phase::store : op_phase::lookup);
+		}
+		{
+			phase_scope callback_phase(c.observer, op_phase::callback);
+			c.finished_cb();
+		}
+		// the observer may be destroyed along with the callbacks
+		c.observer = nullptr;
+		c.entry_cb = nullptr;
+		c.entries_cb = nullptr;
+		c.finalize_cb = nullptr;
+		c.finished_cb = nullptr;
+		c.entries_map.clear();
+		sodium_memzero(c.secret.data(), c.secret.size());
+	}
+
+	// report a new or updated entry now, or along with the rest of the read
+	// phase
+	void entry_changed(dht_put_context& c, entry const& e)
+	{
+		if (c.entry_cb) c.entry_cb(e);
+		else c.updated_ids.push_back(e.id());
+	}
+
+	// most nodes respond with the same blob. One which is the same as a
+	// response already decrypted can't change anything. The blob's digest is
+	// left in digest
+	bool seen_response(dht_put_context const& c, gsl::span<char const> ciphertext
+		, blob_digest& digest)
+	{
+		crypto_generichash(digest.data(), digest.size()
+			, (unsigned char const*)ciphertext.data(), ciphertext.size(), nullptr, 0);
+		int const n = (std::min)(c.num_seen_blobs, int(c.seen_blobs.size()));
+		return std::find(c.seen_blobs.begin(), c.seen_blobs.begin() + n, digest)
+			!= c.seen_blobs.begin() + n;
+	}
+
+	void record_response(dht_put_context& c, int64 seq, blob_digest const& digest)
+	{
+		c.max_seq = (std::max)(c.max_seq, seq);
+		// the oldest is forgotten
+		c.seen_blobs[c.num_seen_blobs % c.seen_blobs.size()] = digest;
+		++c.num_seen_blobs;
+	}
+
+	// hand the entries updated during the read phase to entries_cb in one call
+	void deliver_updates(dht_put_context& c)
+	{
+		if (!c.entries_cb || c.updated_ids.empty()) return;
+		std::sort(c.updated_ids.begin(), c.updated_ids.end());
+		c.updated_ids.erase(std::unique(c.updated_ids.begin(), c.updated_ids.end()), c.updated_ids.end());
+		std::vector<entry, arena_allocator<entry>> batch{ arena_allocator<entry>(c.memory) };
+		batch.reserve(c.updated_ids.size());
+		for (uint32_t id : c.updated_ids)
+			batch.push_back(c.entries_map.find(id)->second);
+		c.updated_ids.clear();
+		c.entries_cb(gsl::as_span(batch.data(), batch.size()));
+	}
+
+	void end_put(put_context& c)
+	{
+		if (c.observer) c.observer->phase_end(op_phase::store);
+		{
+			phase_scope callback_phase(c.observer, op_phase::callback);
+			c.finished_cb();
+		}
+		c.observer = nullptr;
+		c.finished_cb = nullptr;
+	}
+
+	// contents is only copied if the callback takes a vector
+	void end_get(get_context& c, gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		if (c.observer) c.observer->phase_end(op_phase::lookup);
+		if (contents.empty()) notify(c.observer, "not_found");
+		{
+			phase_scope callback_phase(c.observer, op_phase::callback);
+			if (c.viewed_cb) c.viewed_cb(contents, next_hash);
+			else c.received_cb(std::vector<gsl::byte>(contents.begin(), contents.end()), next_hash);
+		}
+		c.observer = nullptr;
+		c.received_cb = nullptr;
+		c.viewed_cb = nullptr;
+	}
+}
+
+op_handle::op_handle()
+	: m_state(std::make_shared<detail::op_state>(0, nullptr))
+{}
+
+op_handle::op_handle(std::uint64_t id, std::function<void(std::function<void()>)> dispatch)
+	: m_state(std::make_shared<detail::op_state>(id, std::move(dispatch)))
+{}
+
+void op_handle::cancel() const
+{
+	if (!m_state->dispatch)
+	{
+		abort(op_status::cancelled);
+		return;
+	}
+	op_handle self(*this);
+	m_state->dispatch([self]() { self.abort(op_status::cancelled); });
+}
+
+op_status op_handle::status() const
+{
+	return op_status(m_state->status.load(std::memory_order_acquire));
+}
+
+std::uint64_t op_handle::id() const
+{
+	return m_state->id;
+}
+
+void op_handle::set_abort(std::function<void()> f) const
+{
+	m_state->abort = std::move(f);
+}
+
+void op_handle::complete(op_status s) const
+{
+	m_state->status.store(int(s), std::memory_order_release);
+	m_state->abort = nullptr;
+}
+
+void op_handle::abort(op_status s) const
+{
+	if (status() != op_status::pending) return;
+	m_state->status.store(int(s), std::memory_order_release);
+	// an operation which hasn't been started yet ends as soon as it is
+	if (!m_state->abort) return;
+	auto f = std::move(m_state->abort);
+	m_state->abort = nullptr;
+	f();
 }
 
 std::pair<entry, gsl::span<gsl::byte const>> entry::parse(gsl::span<gsl::byte const> input)
 {
-	entry_header header;
-	input = extract(gsl::span<entry_header, 1>(header), input);
-	input = input.subspan(header.content_offset);
-	entry e(header.seq, header.id, { input.begin(), input.begin() + header.content_length });
-	input = input.subspan(header.content_length);
+	entry e(0);
+	if (try_parse(input, e) != parse_error::none)
+		throw std::length_error("malformed entry");
 	return{ std::move(e), input };
 }
 
+parse_error entry::try_parse(gsl::span<gsl::byte const>& input, entry& e) noexcept
+{
+	auto in = input;
+	entry_header header;
+	if (!try_extract(gsl::span<entry_header, 1>(header), in))
+		return parse_error::truncated;
+	std::ptrdiff_t const size = header.content_offset + header.content_length;
+	if (in.size() < size)
+		return parse_error::bad_length;
+	e.m_seq = header.seq;
+	e.m_id = header.id;
+	e.update_contents(in.subspan(header.content_offset, header.content_length));
+	input = in.subspan(size);
+	return parse_error::none;
+}
+
 gsl::span<gsl::byte> entry::serialize(gsl::span<gsl::byte> output) const
 {
 	entry_header header;
@@ -72,7 +376,7 @@ gsl::span<gsl::byte> entry::serialize(gsl::span<gsl::byte> output) const
 	header.content_offset = 0;
 
 	output = flatten(output, gsl::span<entry_header const, 1>(header));
-	output = flatten(output, gsl::as_span(value()));
+	output = flatten(output, value());
 	return output;
 }
 
@@ -84,9 +388,17 @@ gsl::span<gsl::byte> list_token::serialize(gsl::span<gsl::byte> output) const
 
 list_token list_token::parse(gsl::span<gsl::byte const> input)
 {
-	hash h;
-	input = extract(gsl::as_span(h), input);
-	return{ h };
+	list_token ret;
+	if (try_parse(input, ret) != parse_error::none)
+		throw std::length_error("malformed list token");
+	return ret;
+}
+
+parse_error list_token::try_parse(gsl::span<gsl::byte const>& input, list_token& t) noexcept
+{
+	if (!try_extract(gsl::as_span(t.m_next), input))
+		return parse_error::truncated;
+	return parse_error::none;
 }
 
 gsl::span<gsl::byte> list_head::serialize(gsl::span<gsl::byte> output) const
@@ -97,9 +409,17 @@ gsl::span<gsl::byte> list_head::serialize(gsl::span<gsl::byte> output) const
 
 list_head list_head::parse(gsl::span<gsl::byte const> input)
 {
-	hash h;
-	input = extract(gsl::as_span(h), input);
-	return{ h };
+	list_head ret;
+	if (try_parse(input, ret) != parse_error::none)
+		throw std::length_error("malformed list head");
+	return ret;
+}
+
+parse_error list_head::try_parse(gsl::span<gsl::byte const>& input, list_head& h) noexcept
+{
+	if (!try_extract(gsl::as_span(h.m_head), input))
+		return parse_error::truncated;
+	return parse_error::none;
 }
 
 std::pair<secret_key, public_key> generate_keypair()
@@ -134,25 +454,43 @@ gsl::span<gsl::byte> serialize(gsl::span<entry const> entries, gsl::span<gsl::by
 
 gsl::span<gsl::byte const> parse(gsl::span<gsl::byte const> input, std::vector<entry>& entries)
 {
+	if (try_parse(input, entries) != parse_error::none)
+		throw std::length_error("malformed entry list");
+	return input;
+}
+
+parse_error try_parse(gsl::span<gsl::byte const>& input, std::vector<entry>& entries)
+{
+	auto in = input;
 	entries_header header;
-	input = extract(gsl::span<entries_header, 1>(header), input);
-	input = input.subspan(header.entries_offset);
+	if (!try_extract(gsl::span<entries_header, 1>(header), in))
+		return parse_error::truncated;
+	if (in.size() < header.entries_offset)
+		return parse_error::bad_length;
+	in = in.subspan(header.entries_offset);
 
+	std::size_t const old_size = entries.size();
 	for (int i = 0; i < header.entry_count; ++i)
 	{
-		auto entry = entry::parse(input);
-		input = entry.second;
-		entries.emplace_back(std::move(entry.first));
+		entry e(0);
+		parse_error const ec = entry::try_parse(in, e);
+		if (ec != parse_error::none)
+		{
+			entries.erase(entries.begin() + old_size, entries.end());
+			return ec;
+		}
+		entries.push_back(e);
 	}
 
-	return input;
+	input = in;
+	return parse_error::none;
 }
 
 
 list_token list_head::push_front(gsl::span<gsl::byte const> contents)
 {
 	// create a new list token which hash points to the old head:
-	list_token *token = new list_token(m_head);
+	list_token token(m_head);
 
 	// build the dht blob for the offline msg with the current head as the next hash:
 	std::vector<gsl::byte> blob = message_dht_blob_write(contents, m_head);
@@ -169,91 +507,177 @@ list_token list_head::push_front(gsl::span<gsl::byte const> contents)
 	// update the head of the linked list with the new hash:
 	std::memcpy(m_head.data(), new_hash.value, m_head.size());
 
-	return *token;
+	return token;
 }
 
 
-void put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents, put_finished finished_cb)
+op_handle put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents, put_finished finished_cb
+	, op_observer* observer, op_handle handle)
+{
+	return put(dht, token, contents, put_finished_fn(std::move(finished_cb)), observer, std::move(handle));
+}
+
+op_handle put(IDht& dht, list_token const& token, gsl::span<gsl::byte const> contents, put_finished_fn finished_cb
+	, op_observer* observer, op_handle handle)
 {
+	if (handle.status() != op_status::pending)
+	{
+		// ended before it was started
+		finished_cb();
+		return handle;
+	}
+
 	// build the dht blob for the offline message:
 	std::vector<gsl::byte> blob = message_dht_blob_write(contents, token.next());
 
-	// allocate a new put_finished callback which we'll pass in as context 
+	// allocate a new context which we'll pass in
 	// for the C-style put_completed_callback:
-	put_finished *callback_ctx = new put_finished(std::move(finished_cb));
+	put_context *callback_ctx = new put_context{ std::move(finished_cb), observer, handle };
+	set_abort(handle, [callback_ctx]() { end_put(*callback_ctx); });
 
 	auto put_completed_callback = [](void *ctx) {
-		// cast the context pointer to a put_finished callback and call it:
-		put_finished callback = *((put_finished *)ctx);
-		callback();
-		delete (put_finished *)ctx;
+		put_context *context = (put_context *)ctx;
+		if (context->finished_cb)
+		{
+			complete(context->handle, op_status::success);
+			end_put(*context);
+		}
+		delete context;
 	};
 
+	if (observer) observer->phase_begin(op_phase::store);
+
 	// call immutablePut:
 	dht.ImmutablePut((const byte *)blob.data(), blob.size(), put_completed_callback, (void*)callback_ctx);
+	return handle;
 }
 
-void get(IDht& dht, chash_span address, item_received received_cb)
+op_handle get(IDht& dht, chash_span address, item_received received_cb, op_observer* observer
+	, op_handle handle)
 {
-	// allocate a new put_finished callback which we'll pass in as context 
-	// for the C-style put_completed_callback:
-	item_received *callback_ctx = new item_received(std::move(received_cb));
-
-	// define a lambda function for handling the get callback:
-	auto get_callback = [](void *ctx, std::vector<char> const& buffer) {
-		hash next_hash;
-		// create a span of gsl::byte from the dht buffer:
-		gsl::span<gsl::byte const> buffer_span = gsl::as_bytes(gsl::as_span(buffer.data(), buffer.size()));
-
-		// skip the bencode length prefix
-		while (buffer_span.size() > 0) {
-			gsl::byte first = *buffer_span.begin();
-			buffer_span = buffer_span.subspan(1);
-			if (char(first) == ':') break;
+	return get(dht, address, item_received_fn(std::move(received_cb)), observer, std::move(handle));
+}
+
+namespace
+{
+	op_handle start_get(IDht& dht, chash_span address, item_received_fn received_cb
+		, item_viewed_fn viewed_cb, op_observer* observer, op_handle handle)
+	{
+		if (handle.status() != op_status::pending)
+		{
+			// ended before it was started
+			if (viewed_cb) viewed_cb(gsl::span<gsl::byte const>(), hash());
+			else received_cb(std::vector<gsl::byte>(), hash());
+			return handle;
 		}
 
-		// extract the message contents and the next hash from the DHT blob:
-		auto msg_contents = message_dht_blob_read(buffer_span, next_hash);
-		// cast the context pointer to an item_received callback and call it:
-		item_received callback = *((item_received *)ctx);
-		callback(std::move(msg_contents), next_hash);
-		delete (item_received *)ctx;
-	};
+		// allocate a new context which we'll pass in
+		// for the C-style get_callback:
+		get_context *callback_ctx = new get_context{ std::move(received_cb), std::move(viewed_cb)
+			, observer, handle };
+		set_abort(handle, [callback_ctx]() { end_get(*callback_ctx, gsl::span<gsl::byte const>(), hash()); });
+
+		// define a lambda function for handling the get callback:
+		auto get_callback = [](void *ctx, std::vector<char> const& buffer) {
+			get_context *context = (get_context *)ctx;
+			if (context->ended())
+			{
+				// ended early
+				delete context;
+				return;
+			}
+
+			hash next_hash;
+			// create a span of gsl::byte from the dht buffer:
+			gsl::span<gsl::byte const> buffer_span = gsl::as_bytes(gsl::as_span(buffer.data(), buffer.size()));
+
+			// skip the bencode length prefix
+			while (buffer_span.size() > 0) {
+				gsl::byte first = *buffer_span.begin();
+				buffer_span = buffer_span.subspan(1);
+				if (char(first) == ':') break;
+			}
+
+			// find the message contents and the next hash in the DHT blob:
+			auto msg_contents = message_dht_blob_view(buffer_span, next_hash);
+			complete(context->handle, msg_contents.empty() ? op_status::not_found : op_status::success);
+			end_get(*context, msg_contents, next_hash);
+			delete context;
+		};
+
+		sha1_hash target_hash((const byte *)address.data());
+
+		if (observer) observer->phase_begin(op_phase::lookup);
+
+		dht.ImmutableGet(target_hash, get_callback, (void*)callback_ctx);
+		return handle;
+	}
+}
 
-	sha1_hash target_hash((const byte *)address.data());
+op_handle get(IDht& dht, chash_span address, item_received_fn received_cb, op_observer* observer
+	, op_handle handle)
+{
+	return start_get(dht, address, std::move(received_cb), nullptr, observer, std::move(handle));
+}
+
+op_handle get_view(IDht& dht, chash_span address, item_viewed viewed_cb, op_observer* observer
+	, op_handle handle)
+{
+	return get_view(dht, address, item_viewed_fn(std::move(viewed_cb)), observer, std::move(handle));
+}
 
-	dht.ImmutableGet(target_hash, get_callback, (void*)callback_ctx);
+op_handle get_view(IDht& dht, chash_span address, item_viewed_fn viewed_cb, op_observer* observer
+	, op_handle handle)
+{
+	return start_get(dht, address, nullptr, std::move(viewed_cb), observer, std::move(handle));
 }
 
 int put_callback(void* ctx, std::vector<char>& buffer, int64& seq, SockAddr src)
 {
 	dht_put_context* context = static_cast<dht_put_context*>(ctx);
 
-	if (!context) {
+	// a synchronize which has ended early doesn't store anything
+	if (!context || !context->finished_cb) {
 		// TODO: log an error
 		buffer.assign({ '0', ':' });
 		return 1;
 	}
 
+	if (!context->lookup_done && context->observer)
+		context->observer->phase_end(op_phase::lookup);
+	context->lookup_done = true;
+
 	std::vector<entry> entries;
+	entries.reserve(context->entries_map.size());
 	// populate the vector with entries we saved in the context's map:
 	for (auto &map_entry : context->entries_map)
 		entries.push_back(map_entry.second);
 
-	// call the finalize callback to let the client perform
-	// a final update on the vector of entries:
-	context->finalize_cb(entries);
+	{
+		// call the finalize callback to let the client perform
+		// a final update on the vector of entries:
+		phase_scope callback_phase(context->observer, op_phase::callback);
+		deliver_updates(*context);
+		context->finalize_cb(entries);
+	}
 
-	// serialize the entries:
-	std::vector<char> final_buffer(1000);
-	auto residue = serialize(entries, gsl::as_writeable_bytes(gsl::as_span(final_buffer)));
-	final_buffer.resize(final_buffer.size() - residue.size());
+	{
+		phase_scope encrypt_phase(context->observer, op_phase::encrypt);
+
+		// serialize the entries:
+		gsl::span<char> plaintext = scratch_buffer(*context, 1000);
+		auto residue = serialize(entries, gsl::as_writeable_bytes(plaintext));
+		plaintext = plaintext.subspan(0, plaintext.size() - residue.size());
+
+		// encrypt the buffer straight into the DHT's, after the length prefix:
+		std::size_t const size = encrypted_size(plaintext.size());
+		std::string const prefix = std::to_string(size) + ":";
+		buffer.resize(prefix.size() + size);
+		std::copy(prefix.begin(), prefix.end(), buffer.begin());
+		encrypt_buffer(plaintext, gsl::as_span(buffer.data() + prefix.size(), size), context->secret);
+	}
 
-	// encrypt the buffer:
-	buffer = encrypt_buffer(final_buffer, context->secret);
-	// add the length prefix:
-	std::string prefix = std::to_string(buffer.size()) + ":";
-	buffer.insert(buffer.begin(), prefix.begin(), prefix.end());
+	if (context->observer) context->observer->phase_begin(op_phase::store);
 	return 0;
 }
 
@@ -261,79 +685,166 @@ int put_data_callback(void* ctx, std::vector<char> const& buffer, int64 seq, Soc
 {
 	dht_put_context* context = static_cast<dht_put_context*>(ctx);
 
-	if (!context) {
+	if (!context || !context->finished_cb) {
 		// TODO: log an error
 		return 1;
 	}
 
+	notify(context->observer, "response");
+
 	// skip the length prefix
 	int skip = 0;
 	while (skip < int(buffer.size())) {
 		++skip;
 		if (buffer[skip - 1] == ':') break;
 	}
-	std::vector<char> buffer2(buffer.begin() + skip, buffer.end());
+	auto const ciphertext = gsl::as_span(buffer.data() + skip, buffer.size() - skip);
 
-	// decrypt the buffer:
-	std::vector<char> plaintext = decrypt_buffer(buffer2, context->secret);
-
-	if (plaintext.empty() && !buffer2.empty()) {
-		// TODO: log an error
+	// a response which is an older version than one already decrypted can't
+	// change anything, and is skipped before it is hashed
+	blob_digest digest;
+	if (seq < context->max_seq || seen_response(*context, ciphertext, digest)) {
+		notify(context->observer, "response_skipped");
 		return 0;
 	}
 
-	// parse the blob into a vector of entries:
-	std::vector<entry> blob_entries;
-	parse(gsl::as_bytes(gsl::as_span(plaintext)), blob_entries);
-	
+	gsl::span<gsl::byte const> blob;
+	{
+		phase_scope decrypt_phase(context->observer, op_phase::decrypt);
+
+		// decrypt the buffer:
+		std::size_t const size = decrypted_size(ciphertext.size());
+		auto const plaintext = decrypt_buffer(ciphertext, scratch_buffer(*context, size), context->secret);
+
+		if (plaintext.empty() && !ciphertext.empty()) {
+			// TODO: log an error
+			notify(context->observer, "decrypt_failed");
+			return 0;
+		}
+
+		blob = gsl::as_bytes(plaintext);
+	}
+	// only a response which decrypts can hold back others
+	record_response(*context, seq, digest);
+
+	phase_scope callback_phase(context->observer, op_phase::callback);
 	auto &e_map = context->entries_map;
+	// parse the entries one at a time, straight out of the blob
+	// a malformed blob keeps the entries parsed before the error
+	entries_header header;
+	if (!try_extract(gsl::span<entries_header, 1>(header), blob)
+		|| blob.size() < header.entries_offset)
+	{
+		notify(context->observer, "parse_failed");
+		return 0;
+	}
+	blob = blob.subspan(header.entries_offset);
 	// check if there are new entries or if the seq number has changed:
-	for (entry &e : blob_entries) 
+	for (int n = 0; n < header.entry_count; ++n)
 	{
-		// try inserting the current entry in the map:
-		auto ret = e_map.insert(std::pair<uint32_t, entry>(e.id(), e));
-
-		if (ret.second == true)
-		{	// the element was inserted (it wasn't in the map before).
-			// call the entry_updated callback to notify the client of the new entry:
-			context->entry_cb(e);
+		entry e(0);
+		if (entry::try_parse(blob, e) != parse_error::none)
+		{
+			notify(context->observer, "parse_failed");
+			return 0;
+		}
+		auto i = e_map.find(e.id());
+		if (i == e_map.end())
+		{	// the element isn't in the map yet.
+			// insert it and notify the client of the new entry:
+			i = e_map.emplace(e.id(), std::move(e)).first;
+			entry_changed(*context, i->second);
 		}
-		else if (e.seq() > ret.first->second.seq())
+		else if (e.seq() > i->second.seq())
 		{	// this entry already exists in the map, but its sequence number is higher.
-			// notify the client of the updated entry:
-			context->entry_cb(e);
-			// and update the existing entry in the map:
-			ret.first->second.update_seq(e.seq());
-			ret.first->second.update_contents(e.value());
+			// replace the existing entry in the map:
+			i->second = std::move(e);
+			// and notify the client of the updated entry:
+			entry_changed(*context, i->second);
 		}
 	}
 
 	return 0;
 }
 
-void synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> const& entries
-	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb)
+namespace
 {
-	std::array<unsigned char, crypto_sign_PUBLICKEYBYTES> target_public;
-	std::array<unsigned char, crypto_sign_SECRETKEYBYTES> target_private;
-	// generate a key pair from the shared secret which will be used
-	// as the target keypair for the DHT put call:
-	crypto_sign_seed_keypair(target_public.data(), target_private.data(), (const unsigned char*) shared_key.data());
+	op_handle start_synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+		, entry_updated_fn entry_cb, entries_updated_fn entries_cb, finalize_entries_fn finalize_cb
+		, sync_finished_fn finished_cb, op_observer* observer, op_handle handle)
+	{
+		if (handle.status() != op_status::pending)
+		{
+			// ended before it was started
+			finished_cb();
+			return handle;
+		}
 
-	// store context info for the callbacks:
-	dht_put_context *put_context = new dht_put_context(entries, shared_key, entry_cb, finalize_cb, finished_cb);	
+		std::array<unsigned char, crypto_sign_PUBLICKEYBYTES> target_public;
+		std::array<unsigned char, crypto_sign_SECRETKEYBYTES> target_private;
+		// generate a key pair from the shared secret which will be used
+		// as the target keypair for the DHT put call:
+		crypto_sign_seed_keypair(target_public.data(), target_private.data(), (const unsigned char*) shared_key.data());
+
+		// store context info for the callbacks:
+		dht_put_context *put_context = new_sync_context(std::move(entries), shared_key, std::move(entry_cb)
+			, std::move(entries_cb), std::move(finalize_cb), std::move(finished_cb), observer, handle);
+		set_abort(handle, [put_context]() { end_sync(*put_context); });
+
+		// create a lambda function for the final callback:
+		auto put_completed_callback = [](void *ctx) {
+			// extract the dht put context:
+			dht_put_context *context = (dht_put_context *)ctx;
+			if (context->finished_cb)
+			{
+				// the DHT may give up without ever asking for the data to store
+				deliver_updates(*context);
+				complete(context->handle, op_status::success);
+				end_sync(*context);
+			}
+			delete_sync_context(context);
+		};
+
+		if (observer) observer->phase_begin(op_phase::lookup);
+
+		// DHT mutable put call:
+		dht.Put(target_public.data(), target_private.data(), put_callback, put_completed_callback, put_data_callback, put_context);
+		return handle;
+	}
+}
 
-	// create a lambda function for the final callback:
-	auto put_completed_callback = [](void *ctx) {
-		// extract the dht put context:
-		dht_put_context *context = (dht_put_context *)ctx;
-		// call the finished callback:
-		context->finished_cb();
-		delete context;
-	};
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_observer* observer, op_handle handle)
+{
+	return synchronize(dht, shared_key, std::move(entries), entry_updated_fn(std::move(entry_cb))
+		, finalize_entries_fn(std::move(finalize_cb)), sync_finished_fn(std::move(finished_cb))
+		, observer, std::move(handle));
+}
 
-	// DHT mutable put call:
-	dht.Put(target_public.data(), target_private.data(), put_callback, put_completed_callback, put_data_callback, put_context);
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entry_updated_fn entry_cb, finalize_entries_fn finalize_cb, sync_finished_fn finished_cb
+	, op_observer* observer, op_handle handle)
+{
+	return start_synchronize(dht, shared_key, std::move(entries), std::move(entry_cb), nullptr
+		, std::move(finalize_cb), std::move(finished_cb), observer, std::move(handle));
+}
+
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entries_updated entries_cb, finalize_entries finalize_cb, sync_finished finished_cb
+	, op_observer* observer, op_handle handle)
+{
+	return synchronize(dht, shared_key, std::move(entries), entries_updated_fn(std::move(entries_cb))
+		, finalize_entries_fn(std::move(finalize_cb)), sync_finished_fn(std::move(finished_cb))
+		, observer, std::move(handle));
+}
+
+op_handle synchronize(IDht& dht, secret_key_span shared_key, std::vector<entry> entries
+	, entries_updated_fn entries_cb, finalize_entries_fn finalize_cb, sync_finished_fn finished_cb
+	, op_observer* observer, op_handle handle)
+{
+	return start_synchronize(dht, shared_key, std::move(entries), nullptr, std::move(entries_cb)
+		, std::move(finalize_cb), std::move(finished_cb), observer, std::move(handle));
 }
 
 } // namespace scout
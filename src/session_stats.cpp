@@ -0,0 +1,163 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "session_stats.hpp"
+
+namespace scout
+{
+
+namespace
+{
+	auto const relaxed = std::memory_order_relaxed;
+}
+
+char const* op_type_name(op_type t)
+{
+	switch (t)
+	{
+		case op_type::synchronize: return "synchronize";
+		case op_type::put: return "put";
+		case op_type::get: return "get";
+	}
+	return "unknown";
+}
+
+char const* op_phase_name(op_phase p)
+{
+	switch (p)
+	{
+		case op_phase::queue: return "queue";
+		case op_phase::lookup: return "lookup";
+		case op_phase::decrypt: return "decrypt";
+		case op_phase::encrypt: return "encrypt";
+		case op_phase::store: return "store";
+		case op_phase::callback: return "callback";
+	}
+	return "unknown";
+}
+
+session_counters::session_counters()
+	: packets_in(0)
+	, packets_out(0)
+	, bytes_in(0)
+	, bytes_out(0)
+	, send_failures(0)
+	, queued(0)
+	, gets_hedged(0)
+	, hedges_won(0)
+	, routing_table_size(0)
+	, dht_rate(0)
+	, dht_quota(0)
+{}
+
+void session_counters::op_queued(op_type t)
+{
+	ops[int(t)].started.fetch_add(1, relaxed);
+	queued.fetch_add(1, relaxed);
+}
+
+void session_counters::op_dequeued()
+{
+	queued.fetch_sub(1, relaxed);
+}
+
+void session_counters::op_finished(op_type t, bool success, clock::time_point start)
+{
+	op_counters& c = ops[int(t)];
+	if (success) c.succeeded.fetch_add(1, relaxed);
+	else c.failed.fetch_add(1, relaxed);
+	c.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start));
+}
+
+void session_counters::record_phase(op_type t, op_phase p, std::chrono::microseconds duration)
+{
+	ops[int(t)].phases[int(p)].record(duration);
+}
+
+void session_counters::op_coalesced(op_type t)
+{
+	ops[int(t)].coalesced.fetch_add(1, relaxed);
+}
+
+void session_counters::get_hedged()
+{
+	gets_hedged.fetch_add(1, relaxed);
+}
+
+void session_counters::hedge_won()
+{
+	hedges_won.fetch_add(1, relaxed);
+}
+
+void session_counters::packet_in(std::size_t bytes)
+{
+	packets_in.fetch_add(1, relaxed);
+	bytes_in.fetch_add(bytes, relaxed);
+}
+
+void session_counters::packet_out(std::size_t bytes, bool success)
+{
+	if (!success)
+	{
+		send_failures.fetch_add(1, relaxed);
+		return;
+	}
+	packets_out.fetch_add(1, relaxed);
+	bytes_out.fetch_add(bytes, relaxed);
+}
+
+session_stats session_counters::snapshot(bool reset_histograms)
+{
+	session_stats ret;
+	for (int i = 0; i < num_op_types; ++i)
+	{
+		op_counters& c = ops[i];
+		op_stats& s = ret.ops[i];
+		s.succeeded = c.succeeded.load(relaxed);
+		s.failed = c.failed.load(relaxed);
+		// load started last so outstanding never goes negative
+		s.started = c.started.load(relaxed);
+		std::uint64_t const done = s.succeeded + s.failed;
+		s.outstanding = s.started > done ? s.started - done : 0;
+		s.coalesced = c.coalesced.load(relaxed);
+		if (reset_histograms)
+		{
+			s.latency = c.latency.snapshot_and_reset();
+			for (int p = 0; p < num_op_phases; ++p)
+				s.phases[p] = c.phases[p].snapshot_and_reset();
+		}
+		else
+		{
+			s.latency = c.latency.snapshot();
+			for (int p = 0; p < num_op_phases; ++p)
+				s.phases[p] = c.phases[p].snapshot();
+		}
+	}
+	ret.packets_in = packets_in.load(relaxed);
+	ret.packets_out = packets_out.load(relaxed);
+	ret.bytes_in = bytes_in.load(relaxed);
+	ret.bytes_out = bytes_out.load(relaxed);
+	ret.send_failures = send_failures.load(relaxed);
+	ret.queued = queued.load(relaxed);
+	ret.gets_hedged = gets_hedged.load(relaxed);
+	ret.hedges_won = hedges_won.load(relaxed);
+	ret.routing_table_size = routing_table_size.load(relaxed);
+	ret.dht_rate = dht_rate.load(relaxed);
+	ret.dht_quota = dht_quota.load(relaxed);
+	return ret;
+}
+
+} // namespace scout
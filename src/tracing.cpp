@@ -0,0 +1,88 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "tracing.hpp"
+#include "utils.hpp" // for log_error
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+namespace scout
+{
+
+chrome_trace_writer::chrome_trace_writer(char const* filename)
+	: m_file(std::fopen(filename, "w"))
+	, m_start(std::chrono::steady_clock::now())
+	, m_first(true)
+{
+	if (m_file == nullptr)
+	{
+		log_error("failed to open trace file \"%s\": %s", filename, strerror(errno));
+		return;
+	}
+	std::fputs("{\"traceEvents\":[\n", m_file);
+}
+
+chrome_trace_writer::~chrome_trace_writer()
+{
+	if (m_file == nullptr) return;
+	std::fputs("\n]}\n", m_file);
+	std::fclose(m_file);
+}
+
+void chrome_trace_writer::op_begin(std::uint64_t id, op_type t)
+{
+	write(id, t, op_type_name(t), 'b');
+}
+
+void chrome_trace_writer::op_end(std::uint64_t id, op_type t)
+{
+	write(id, t, op_type_name(t), 'e');
+}
+
+void chrome_trace_writer::phase_begin(std::uint64_t id, op_type t, op_phase p)
+{
+	write(id, t, op_phase_name(p), 'b');
+}
+
+void chrome_trace_writer::phase_end(std::uint64_t id, op_type t, op_phase p)
+{
+	write(id, t, op_phase_name(p), 'e');
+}
+
+void chrome_trace_writer::event(std::uint64_t id, op_type t, char const* name)
+{
+	write(id, t, name, 'n');
+}
+
+void chrome_trace_writer::write(std::uint64_t id, op_type t, char const* name, char phase)
+{
+	if (m_file == nullptr) return;
+
+	// take the timestamp outside the lock so contention doesn't skew it
+	auto const ts = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - m_start).count();
+
+	// async events are matched up by category and id, so every operation
+	// gets its own track regardless of which thread it ran on
+	std::lock_guard<std::mutex> l(m_mutex);
+	std::fprintf(m_file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\""
+		",\"id\":\"0x%" PRIx64 "\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":1}"
+		, m_first ? "" : ",\n", name, op_type_name(t), phase, id, std::int64_t(ts));
+	m_first = false;
+}
+
+} // namespace scout
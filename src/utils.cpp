@@ -69,91 +69,102 @@ std::vector<gsl::byte> message_dht_blob_write(gsl::span<gsl::byte const> msg_dat
 // and a hash pointing to the next message in the linked list:
 std::vector<gsl::byte> message_dht_blob_read(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash)
 {
-	// if the buffer is empty, return an empty vector:
-	if (dht_blob.size() == 0)
+	gsl::span<gsl::byte const> msg;
+	if (message_dht_blob_parse(dht_blob, next_msg_hash, msg) == parse_error::truncated)
+		throw std::length_error("bytes span smaller than destination");
+	return std::vector<gsl::byte>(msg.begin(), msg.end());
+}
+
+gsl::span<gsl::byte const> message_dht_blob_view(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash) noexcept
+{
+	gsl::span<gsl::byte const> msg;
+	if (message_dht_blob_parse(dht_blob, next_msg_hash, msg) != parse_error::none)
 		return{};
+	return msg;
+}
+
+parse_error message_dht_blob_parse(gsl::span<gsl::byte const> dht_blob, hash& next_msg_hash
+	, gsl::span<gsl::byte const>& msg) noexcept
+{
+	msg = {};
+	// an empty buffer is an empty message:
+	if (dht_blob.size() == 0)
+		return parse_error::none;
 
 	// extract the header:
 	dht_msg_header header;
-	dht_blob = extract(gsl::span<dht_msg_header, 1>(header), dht_blob);
+	if (!try_extract(gsl::span<dht_msg_header, 1>(header), dht_blob))
+		return parse_error::truncated;
 	// get the next hash from the extracted header:
 	std::copy(header.next_hash.begin(), header.next_hash.end(), next_msg_hash.data());
-	// return an empty vector if the buffer isn't long enough for the message length:
-	if (dht_blob.size() < header.msg_offset + header.msg_length)
-		return{};
+	// the buffer must be long enough for the message length:
+	if (dht_blob.size() < std::ptrdiff_t(header.msg_offset) + header.msg_length)
+		return parse_error::bad_length;
 
-	// prepare a vector to receive the message contents:
-	std::vector<gsl::byte> msg_contents(header.msg_length);
-	// apply the offset (if any) and extract the actual message contents:
-	dht_blob = extract(gsl::as_span(msg_contents), dht_blob.subspan(header.msg_offset, header.msg_length));
-
-	return msg_contents;
+	// apply the offset (if any) to find the actual message contents:
+	msg = dht_blob.subspan(header.msg_offset, header.msg_length);
+	return parse_error::none;
 }
 
-void log_debug(char const* fmt, ...)
+std::size_t encrypted_size(std::size_t plaintext_size)
 {
-	va_list vl;
-	va_start(vl, fmt);
-	vfprintf(stderr, fmt, vl);
-	va_end(vl);
-	fprintf(stderr, "\n");
+	return crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES + plaintext_size;
 }
 
-void log_error(char const* fmt, ...)
+std::size_t decrypted_size(std::size_t ciphertext_size)
 {
-	va_list vl;
-	va_start(vl, fmt);
-	vfprintf(stderr, fmt, vl);
-	va_end(vl);
-	fprintf(stderr, "\n");
+	if (ciphertext_size <= crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES)
+		return 0;
+	return ciphertext_size - crypto_secretbox_NONCEBYTES - crypto_secretbox_MACBYTES;
 }
 
 std::vector<char> decrypt_buffer(std::vector<char> buffer, secret_key_span sk)
 {
-	std::vector<char> plaintext;
-
-	if (buffer.size() <= crypto_secretbox_NONCEBYTES + crypto_secretbox_BOXZEROBYTES)
-		return plaintext;
-
-	// pull out the nonce bytes from the start of the buffer
-	unsigned char nonce[crypto_secretbox_NONCEBYTES];
-	std::memcpy(nonce, &buffer[0], crypto_secretbox_NONCEBYTES);
-	buffer.erase(buffer.begin(), buffer.begin() + crypto_secretbox_NONCEBYTES);
+	std::vector<char> plaintext(decrypted_size(buffer.size()));
+	auto const msg = decrypt_buffer(gsl::as_span(buffer.data(), buffer.size())
+		, gsl::as_span(plaintext.data(), plaintext.size()), sk);
+	plaintext.resize(msg.size());
+	return plaintext;
+}
 
-	// prepend the zero-padding space needed by
-	// crypto_box_open()
-	buffer.resize(buffer.size() + crypto_secretbox_BOXZEROBYTES);
-	std::memmove(&buffer[crypto_secretbox_BOXZEROBYTES], &buffer[0]
-		, buffer.size() - crypto_secretbox_BOXZEROBYTES);
-	std::memset(&buffer[0], 0, crypto_secretbox_BOXZEROBYTES);
-	plaintext.resize(buffer.size());
+gsl::span<char> decrypt_buffer(gsl::span<char const> buffer, gsl::span<char> plaintext, secret_key_span sk)
+{
+	std::size_t const size = decrypted_size(buffer.size());
+	if (size == 0) return{};
+	assert(std::size_t(plaintext.size()) >= size);
 
-	// crypto_secretbox_open(m,c,mlen,n,sk);
+	// the buffer is the nonce followed by the MAC and the encrypted message
+	// crypto_secretbox_open_easy(m,c,clen,n,sk);
 	// m: plain text message [out]
-	// c: cipher text [in]
-	// mlen: length of message [in]
+	// c: MAC and cipher text [in]
+	// clen: length of c [in]
 	// n: nonce bytes [in]
 	// sk: secret key [in]
-	int ret = crypto_secretbox_open((unsigned char*)&plaintext[0]
-		, (unsigned char*)&buffer[0]
-		, buffer.size()
-		, nonce
-		, (const unsigned char*) sk.data());
-
-	if (ret != 0) {
-		plaintext.clear();
-		return plaintext;
-	}
+	int ret = crypto_secretbox_open_easy((unsigned char*)plaintext.data()
+		, (const unsigned char*)buffer.data() + crypto_secretbox_NONCEBYTES
+		, buffer.size() - crypto_secretbox_NONCEBYTES
+		, (const unsigned char*)buffer.data()
+		, (const unsigned char*)sk.data());
 
-	// now, strip the leading zeroes
-	plaintext.erase(plaintext.begin(), plaintext.begin() + crypto_secretbox_ZEROBYTES);
-	return plaintext;
+	if (ret != 0) return{};
+	return plaintext.subspan(0, std::ptrdiff_t(size));
 }
 
 std::vector<char> encrypt_buffer(std::vector<char> buffer, secret_key_span sk, const unsigned char* nonce_in)
 {
-	// first, generate a nonce
-	unsigned char nonce[crypto_secretbox_NONCEBYTES];
+	std::vector<char> ciphertext(encrypted_size(buffer.size()));
+	encrypt_buffer(gsl::as_span(buffer.data(), buffer.size())
+		, gsl::as_span(ciphertext.data(), ciphertext.size()), sk, nonce_in);
+	return ciphertext;
+}
+
+void encrypt_buffer(gsl::span<char const> plaintext, gsl::span<char> ciphertext, secret_key_span sk
+	, const unsigned char* nonce_in)
+{
+	assert(std::size_t(ciphertext.size()) == encrypted_size(plaintext.size()));
+	unsigned char* nonce = (unsigned char*)ciphertext.data();
+
+	// first, generate a nonce, which the ciphertext starts with
 	if (nonce_in) {
 		std::copy(nonce_in, nonce_in + crypto_secretbox_NONCEBYTES, nonce);
 	}
@@ -161,26 +172,10 @@ std::vector<char> encrypt_buffer(std::vector<char> buffer, secret_key_span sk, c
 		randombytes(nonce, crypto_secretbox_NONCEBYTES);
 	}
 
-	// then prepend the zero padding
-	buffer.resize(buffer.size() + crypto_secretbox_ZEROBYTES);
-	std::memmove(&buffer[crypto_secretbox_ZEROBYTES], &buffer[0]
-		, buffer.size() - crypto_secretbox_ZEROBYTES);
-	std::memset(&buffer[0], 0, crypto_secretbox_ZEROBYTES);
-
-	std::vector<char> ciphertext;
-	ciphertext.resize(buffer.size());
-
-	crypto_secretbox((unsigned char*)&ciphertext[0] // destination buffer
-		, (const unsigned char*)&buffer[0] // source plaintext buffer
-		, buffer.size()
+	// followed by the MAC and the encrypted message
+	crypto_secretbox_easy(nonce + crypto_secretbox_NONCEBYTES // destination buffer
+		, (const unsigned char*)plaintext.data() // source plaintext buffer
+		, plaintext.size()
 		, nonce // nonce bytes
 		, (const unsigned char*)sk.data());
-
-	// strip the remaining zero-padding
-	ciphertext.erase(ciphertext.begin(), ciphertext.begin()
-		+ crypto_secretbox_BOXZEROBYTES);
-
-	// prepend the nonce
-	ciphertext.insert(ciphertext.begin(), nonce, nonce + crypto_secretbox_NONCEBYTES);
-	return ciphertext;
 }
@@ -0,0 +1,67 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "alloc_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	thread_local std::uint64_t allocations = 0;
+	thread_local std::uint64_t allocated_bytes = 0;
+
+	void* allocate(std::size_t size)
+	{
+		++allocations;
+		allocated_bytes += size;
+		if (size == 0) size = 1;
+		void* ret = std::malloc(size);
+		if (ret == nullptr) throw std::bad_alloc();
+		return ret;
+	}
+}
+
+std::uint64_t thread_allocations()
+{
+	return allocations;
+}
+
+std::uint64_t thread_allocated_bytes()
+{
+	return allocated_bytes;
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+	try { return allocate(size); }
+	catch (std::bad_alloc const&) { return nullptr; }
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept
+{
+	try { return allocate(size); }
+	catch (std::bad_alloc const&) { return nullptr; }
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::nothrow_t const&) noexcept { std::free(p); }
+void operator delete[](void* p, std::nothrow_t const&) noexcept { std::free(p); }
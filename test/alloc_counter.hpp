@@ -0,0 +1,43 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCOUT_ALLOC_COUNTER_HPP
+#define SCOUT_ALLOC_COUNTER_HPP
+
+#include <cstdint>
+
+// Counts heap allocations made through the global operator new. Only test
+// programs which link alloc_counter.cpp, which replaces the global
+// allocation functions, may use this.
+
+// the number of allocations made by the calling thread so far
+std::uint64_t thread_allocations();
+// the number of bytes requested by those allocations
+std::uint64_t thread_allocated_bytes();
+
+// counts the allocations made by the calling thread during its lifetime
+class alloc_scope
+{
+public:
+	alloc_scope() : m_start(thread_allocations()) {}
+
+	std::uint64_t count() const { return thread_allocations() - m_start; }
+
+private:
+	std::uint64_t m_start;
+};
+
+#endif
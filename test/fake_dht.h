@@ -16,6 +16,10 @@ limitations under the License.
 
 #include "dht.h"
 #include <span.h>
+#include <string>
+#include <vector>
+#include <scout.hpp>
+#include <utils.hpp>
 
 class FakeDhtImpl : public IDht
 {
@@ -101,4 +105,85 @@ public:
 	virtual int GetNumPeersTracked() { return 0; }
 	virtual void Restart() {}
 	virtual void GenerateId() {}
-};
\ No newline at end of file
+};
+// holds on to every request until the test answers it
+struct deferred_dht : FakeDhtImpl
+{
+	struct put_request
+	{
+		DhtPutCompletedCallback* completed_callback;
+		void* ctx;
+	};
+
+	struct get_request
+	{
+		DhtGetCallback* callback;
+		void* ctx;
+	};
+
+	struct store_request
+	{
+		DhtPutCallback* put_callback;
+		DhtPutCompletedCallback* completed_callback;
+		DhtPutDataCallback* data_callback;
+		void* ctx;
+	};
+
+	sha1_hash ImmutablePut(const byte * data, size_t data_len,
+		DhtPutCompletedCallback* put_completed_callback = nullptr, void *ctx = nullptr) override
+	{
+		puts.push_back({ put_completed_callback, ctx });
+		return sha1_hash();
+	}
+
+	void ImmutableGet(sha1_hash target, DhtGetCallback* cb, void* ctx = nullptr) override
+	{
+		gets.push_back({ cb, ctx });
+	}
+
+	void Put(const byte * pkey, const byte * skey, DhtPutCallback* put_callback,
+		DhtPutCompletedCallback * put_completed_callback, DhtPutDataCallback* put_data_callback,
+		void *ctx, int flags = 0, int64 seq = 0) override
+	{
+		stores.push_back({ put_callback, put_completed_callback, put_data_callback, ctx });
+	}
+
+	void complete_put(std::size_t i)
+	{
+		puts[i].completed_callback(puts[i].ctx);
+	}
+
+	void answer_get(std::size_t i, std::vector<char> const& item)
+	{
+		gets[i].callback(gets[i].ctx, item);
+	}
+
+	// answer the i-th store as if nothing had been stored under the key
+	void complete_store(std::size_t i)
+	{
+		store_request const& r = stores[i];
+		std::vector<char> buffer;
+		int64 seq = 0;
+		SockAddr src;
+		r.data_callback(r.ctx, buffer, seq, src);
+		r.put_callback(r.ctx, buffer, seq, src);
+		r.completed_callback(r.ctx);
+	}
+
+	std::vector<put_request> puts;
+	std::vector<get_request> gets;
+	std::vector<store_request> stores;
+};
+
+// an encrypted, length prefixed list of entries as the DHT returns it
+inline std::vector<char> entries_blob(std::vector<scout::entry> const& entries
+	, scout::secret_key_span key)
+{
+	std::vector<char> buffer(1000);
+	auto residue = scout::serialize(entries, gsl::as_writeable_bytes(gsl::as_span(buffer)));
+	buffer.resize(buffer.size() - residue.size());
+	buffer = encrypt_buffer(buffer, key);
+	std::string const prefix = std::to_string(buffer.size()) + ":";
+	buffer.insert(buffer.begin(), prefix.begin(), prefix.end());
+	return buffer;
+}
@@ -0,0 +1,202 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <scout.hpp>
+#include <utils.hpp>
+#include "alloc_counter.hpp"
+#include "fake_dht.h"
+
+using namespace scout;
+
+// These are upper bounds on the heap allocations made by each request
+// against FakeDhtImpl, which allocates nothing itself. Lower them when an
+// allocation is removed; a test failing here means a change added one.
+
+namespace
+{
+	std::string const test_msg = "test message";
+
+	gsl::span<gsl::byte const> msg_span()
+	{
+		return gsl::as_bytes(gsl::as_span(test_msg.c_str(), test_msg.size()));
+	}
+
+	std::vector<entry> make_entries(int count)
+	{
+		std::vector<entry> entries;
+		std::array<char, 10> const content = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+		for (int i = 0; i < count; ++i)
+		{
+			entries.emplace_back(i);
+			entries.back().assign(gsl::as_span(content));
+		}
+		return entries;
+	}
+}
+
+TEST(allocations, push_front)
+{
+	list_head head;
+	alloc_scope scope;
+	list_token token = head.push_front(msg_span());
+	// the blob and its length prefix
+	EXPECT_LE(scope.count(), 2);
+}
+
+TEST(allocations, put)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	list_head head;
+	list_token token = head.push_front(msg_span());
+	// make room for the stored item up front
+	fake_dht.immutableData.reserve(1000);
+	int called = 0;
+
+	alloc_scope scope;
+	put(fake_dht, token, msg_span(), [&called] { ++called; });
+	// the blob, the callback context and the handle's state
+	EXPECT_LE(scope.count(), 3);
+	EXPECT_EQ(1, called);
+}
+
+TEST(allocations, get)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	hash next;
+	next.fill(gsl::byte(1));
+	auto blob = message_dht_blob_write(msg_span(), next);
+	std::string const prefix = std::to_string(blob.size()) + ":";
+	fake_dht.immutableData.assign(prefix.begin(), prefix.end());
+	fake_dht.immutableData.insert(fake_dht.immutableData.end()
+		, (char const*)blob.data(), (char const*)blob.data() + blob.size());
+	hash target;
+	target.fill(gsl::byte(0));
+	int called = 0;
+
+	alloc_scope scope;
+	get(fake_dht, target, [&called](std::vector<gsl::byte> contents, hash const&) { ++called; });
+	// the callback context, the handle's state and the contents
+	EXPECT_LE(scope.count(), 3);
+	EXPECT_EQ(1, called);
+}
+
+TEST(allocations, get_view)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	hash next;
+	next.fill(gsl::byte(1));
+	auto blob = message_dht_blob_write(msg_span(), next);
+	std::string const prefix = std::to_string(blob.size()) + ":";
+	fake_dht.immutableData.assign(prefix.begin(), prefix.end());
+	fake_dht.immutableData.insert(fake_dht.immutableData.end()
+		, (char const*)blob.data(), (char const*)blob.data() + blob.size());
+	hash target;
+	target.fill(gsl::byte(0));
+	int called = 0;
+
+	alloc_scope scope;
+	get_view(fake_dht, target, [&called](gsl::span<gsl::byte const> contents, hash const&) { ++called; });
+	// the callback context and the handle's state
+	EXPECT_LE(scope.count(), 2);
+	EXPECT_EQ(1, called);
+}
+
+// the inline callback types store a capture too big for std::function's
+// small buffer without allocating
+TEST(allocations, put_inline_callback)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	list_head head;
+	list_token token = head.push_front(msg_span());
+	fake_dht.immutableData.reserve(1000);
+	std::array<char, 40> padding = {};
+	int called = 0;
+
+	alloc_scope scope;
+	put(fake_dht, token, msg_span(), put_finished_fn([&called, padding] { called += 1 + padding[0]; }));
+	// the blob, the callback context and the handle's state
+	EXPECT_LE(scope.count(), 3);
+	EXPECT_EQ(1, called);
+}
+
+TEST(allocations, get_inline_callback)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	hash target;
+	target.fill(gsl::byte(0));
+	std::array<char, 40> padding = {};
+	int called = 0;
+
+	alloc_scope scope;
+	get(fake_dht, target, item_received_fn([&called, padding](std::vector<gsl::byte>, hash const&)
+	{
+		called += 1 + padding[0];
+	}));
+	// the callback context and the handle's state
+	EXPECT_LE(scope.count(), 2);
+	EXPECT_EQ(1, called);
+}
+
+TEST(allocations, synchronize)
+{
+	FakeDhtImpl fake_dht;
+	fake_dht.SetSHACallback(&sha1_fun);
+	secret_key key;
+	key.fill(gsl::byte(7));
+
+	// the DHT returns the same three entries we synchronize
+	std::vector<entry> const entries = make_entries(3);
+	fake_dht.putDataCallbackBuffer = entries_blob(entries, key);
+	int called = 0;
+	auto sync = [&]
+	{
+		synchronize(fake_dht, key, entries
+			, [](entry const&) {}
+			, [](std::vector<entry>&) {}
+			, [&called] { ++called; });
+	};
+	// the first one fills the arena pool
+	sync();
+
+	alloc_scope scope;
+	sync();
+	// the handle's state, our copy of the entries and the vector passed to
+	// finalize_cb. Everything else comes from the context's arena
+	EXPECT_LE(scope.count(), 3);
+	EXPECT_EQ(2, called);
+}
+
+TEST(allocations, parse)
+{
+	std::vector<entry> const entries = make_entries(8);
+	std::vector<gsl::byte> buffer(1000);
+	serialize(entries, gsl::as_span(buffer));
+	std::vector<entry> parsed;
+	parsed.reserve(entries.size());
+
+	alloc_scope scope;
+	parse(gsl::as_span(buffer), parsed);
+	// the contents are stored inside the entries
+	EXPECT_EQ(0, scope.count());
+	EXPECT_EQ(entries.size(), parsed.size());
+}
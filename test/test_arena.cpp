@@ -0,0 +1,85 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "arena.hpp"
+
+using namespace scout;
+
+TEST(arena, alignment)
+{
+	arena a(64);
+	for (std::size_t align : { 1, 2, 4, 8, 16 })
+	{
+		a.allocate(1, 1);
+		void* p = a.allocate(8, align);
+		EXPECT_EQ(0, reinterpret_cast<std::uintptr_t>(p) % align);
+	}
+}
+
+TEST(arena, large_allocation)
+{
+	arena a(64);
+	char* p = static_cast<char*>(a.allocate(1000, 1));
+	// the whole allocation is usable
+	std::fill(p, p + 1000, 'x');
+	EXPECT_GE(a.capacity(), 1064);
+}
+
+TEST(arena, reset)
+{
+	arena a(64);
+	void* first = a.allocate(16, 8);
+	for (int i = 0; i < 100; ++i) a.allocate(16, 8);
+	EXPECT_GT(a.capacity(), 64);
+	a.reset();
+	// only the first block is kept, and allocation starts over from it
+	EXPECT_EQ(64, a.capacity());
+	EXPECT_EQ(first, a.allocate(16, 8));
+}
+
+TEST(arena, containers)
+{
+	arena a;
+	std::map<int, int, std::less<int>, arena_allocator<std::pair<int const, int>>> m{
+		std::less<int>(), arena_allocator<std::pair<int const, int>>(a) };
+	std::vector<int, arena_allocator<int>> v{ arena_allocator<int>(a) };
+	for (int i = 0; i < 1000; ++i)
+	{
+		m.emplace(i, i);
+		v.push_back(i);
+	}
+	EXPECT_EQ(1000, m.size());
+	EXPECT_EQ(999, m[999]);
+	EXPECT_EQ(999, v.back());
+}
+
+TEST(arena, pool)
+{
+	arena* a = acquire_arena();
+	a->allocate(100000, 8);
+	release_arena(a);
+	// the arena is reused, without the memory it grew by
+	arena* b = acquire_arena();
+	EXPECT_EQ(a, b);
+	EXPECT_EQ(std::size_t(arena::default_block_size), b->capacity());
+	release_arena(b);
+}
@@ -0,0 +1,153 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <set>
+#include <thread>
+#include <completion_queue.hpp>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+using namespace scout;
+
+namespace
+{
+	completion make_completion(std::uint64_t id)
+	{
+		completion c;
+		c.id = id;
+		c.type = op_type::get;
+		c.status = op_status::success;
+		c.contents.assign(4, gsl::byte(id));
+		return c;
+	}
+
+	bool readable(completion_queue const& q)
+	{
+#ifdef _WIN32
+		return true;
+#else
+		pollfd p;
+		p.fd = q.native_handle();
+		p.events = POLLIN;
+		p.revents = 0;
+		return ::poll(&p, 1, 0) == 1;
+#endif
+	}
+}
+
+TEST(completion_queue, harvest)
+{
+	completion_queue q;
+	std::vector<completion> out;
+	EXPECT_FALSE(readable(q));
+	EXPECT_EQ(q.harvest(out), 0);
+	EXPECT_FALSE(q.wait(0));
+
+	q.post(make_completion(1));
+	q.post(make_completion(2));
+	EXPECT_TRUE(readable(q));
+	EXPECT_TRUE(q.wait(0));
+
+	ASSERT_EQ(q.harvest(out), 2);
+	EXPECT_EQ(out[0].id, 1);
+	EXPECT_EQ(out[1].id, 2);
+	EXPECT_EQ(out[1].contents, std::vector<gsl::byte>(4, gsl::byte(2)));
+	EXPECT_FALSE(readable(q));
+}
+
+TEST(completion_queue, partial_harvest)
+{
+	completion_queue q;
+	for (int i = 0; i < 10; ++i) q.post(make_completion(i));
+
+	std::vector<completion> out;
+	EXPECT_EQ(q.harvest(out, 4), 4);
+	// the rest are still waiting, so the handle stays readable
+	EXPECT_TRUE(readable(q));
+	EXPECT_EQ(q.harvest(out), 6);
+	EXPECT_FALSE(readable(q));
+	for (int i = 0; i < 10; ++i) EXPECT_EQ(out[i].id, i);
+}
+
+TEST(completion_queue, overflow)
+{
+	// more completions than fit in the ring are kept, not dropped
+	completion_queue q;
+	int const count = 5000;
+	for (int i = 0; i < count; ++i) q.post(make_completion(i));
+
+	std::vector<completion> out;
+	EXPECT_EQ(q.harvest(out), count);
+	std::set<std::uint64_t> ids;
+	for (completion const& c : out) ids.insert(c.id);
+	EXPECT_EQ(ids.size(), count);
+	EXPECT_FALSE(readable(q));
+}
+
+TEST(completion_queue, threads)
+{
+	completion_queue q;
+	int const per_thread = 2000;
+	std::vector<std::thread> producers;
+	for (int t = 0; t < 4; ++t)
+	{
+		producers.emplace_back([&q, t]()
+		{
+			for (int i = 0; i < per_thread; ++i)
+				q.post(make_completion(t * per_thread + i));
+		});
+	}
+
+	std::vector<completion> out;
+	while (out.size() < 4 * per_thread)
+	{
+		ASSERT_TRUE(q.wait(5000));
+		q.harvest(out);
+	}
+	for (std::thread& t : producers) t.join();
+
+	std::set<std::uint64_t> ids;
+	for (completion const& c : out) ids.insert(c.id);
+	EXPECT_EQ(ids.size(), 4 * per_thread);
+}
+
+// completions posted while the consumer is harvesting must still wake it up
+// once it has caught up and waits again
+TEST(completion_queue, post_during_harvest)
+{
+	completion_queue q;
+	int const count = 5000;
+	std::thread producer([&q]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			q.post(make_completion(i));
+			// give the consumer time to catch up and wait for the next one
+			std::this_thread::sleep_for(std::chrono::microseconds(20));
+		}
+	});
+
+	std::vector<completion> out;
+	while (out.size() < count && q.wait(2000))
+		q.harvest(out);
+	producer.join();
+	EXPECT_EQ(out.size(), count);
+}
@@ -0,0 +1,160 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <coroutine.hpp>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <deque>
+#include <utils.hpp>
+#include "fake_dht.h"
+
+using namespace scout;
+
+namespace
+{
+	// the request functions of dht_session, run directly against the fake DHT
+	struct fake_session
+	{
+		fake_session() { dht.SetSHACallback(&sha1_fun); }
+
+		void put(list_token const& token, gsl::span<gsl::byte const> contents, put_finished cb)
+		{
+			scout::put(dht, token, contents, std::move(cb));
+			// the real DHT stores items bencoded
+			std::string const prefix = std::to_string(dht.immutableData.size()) + ":";
+			dht.immutableData.insert(dht.immutableData.begin(), prefix.begin(), prefix.end());
+		}
+
+		void get(hash_span address, item_received cb)
+		{ scout::get(dht, address, std::move(cb)); }
+
+		void synchronize(secret_key_span key, std::vector<entry> entries
+			, entry_updated entry_cb, finalize_entries finalize_cb, sync_finished finished_cb)
+		{
+			scout::synchronize(dht, key, entries, std::move(entry_cb)
+				, std::move(finalize_cb), std::move(finished_cb));
+		}
+
+		FakeDhtImpl dht;
+	};
+
+	// resumes coroutines when run() is called, standing in for an io_service
+	struct queue_executor
+	{
+		template <typename F>
+		void post(F f) { queue.push_back(std::move(f)); }
+
+		void run()
+		{
+			while (!queue.empty())
+			{
+				auto f = std::move(queue.front());
+				queue.pop_front();
+				f();
+			}
+		}
+
+		std::deque<std::function<void()>> queue;
+	};
+
+	task<std::vector<gsl::byte>> put_then_get(fake_session& ses, queue_executor& ex
+		, std::string const& msg)
+	{
+		auto const contents = gsl::as_bytes(gsl::as_span(msg.c_str(), msg.size()));
+		list_head head;
+		list_token const token = head.push_front(contents);
+		co_await async_put(ses, ex, token, contents);
+
+		get_result r = co_await async_get(ses, ex, head.head());
+		co_return std::move(r.contents);
+	}
+
+	task<> fetch(fake_session& ses, queue_executor& ex, std::string const& msg
+		, std::vector<gsl::byte>& received)
+	{
+		received = co_await put_then_get(ses, ex, msg);
+	}
+
+	task<> sync(fake_session& ses, queue_executor& ex, secret_key const& key
+		, std::vector<entry> const& entries, sync_result& result)
+	{
+		result = co_await async_synchronize(ses, ex, key, entries
+			, [](std::vector<entry>& e) { e.emplace_back(2); });
+	}
+}
+
+TEST(coroutine, put_and_get)
+{
+	fake_session ses;
+	queue_executor ex;
+	std::string const msg = "test message";
+	std::vector<gsl::byte> received;
+
+	spawn(fetch(ses, ex, msg, received));
+
+	// nothing resumes until the executor runs
+	EXPECT_TRUE(received.empty());
+	ex.run();
+
+	ASSERT_EQ(msg.size(), received.size());
+	EXPECT_TRUE(std::equal(received.begin(), received.end()
+		, (gsl::byte const*)msg.data()));
+}
+
+TEST(coroutine, synchronize)
+{
+	fake_session ses;
+	queue_executor ex;
+	secret_key key;
+	key.fill(gsl::byte(3));
+
+	std::vector<entry> entries;
+	entries.emplace_back(1);
+	std::array<char, 3> const content = { 1, 2, 3 };
+	entries.back().assign(gsl::as_span(content));
+
+	// the other peer has stored an entry of its own
+	std::vector<entry> remote;
+	remote.emplace_back(5);
+	remote.back().assign(gsl::as_span(content));
+	ses.dht.putDataCallbackBuffer = entries_blob(remote, key);
+
+	sync_result result;
+	spawn(sync(ses, ex, key, entries, result));
+	ex.run();
+
+	ASSERT_EQ(1, result.received.size());
+	EXPECT_EQ(remote[0], result.received[0]);
+	// our entry, theirs and the one added by the finalize callback
+	ASSERT_EQ(3, result.stored.size());
+	EXPECT_EQ(entries[0], result.stored[0]);
+	EXPECT_EQ(remote[0], result.stored[1]);
+	EXPECT_EQ(2, result.stored[2].id());
+}
+
+TEST(coroutine, frame_pool)
+{
+	// a freed frame is handed out again for the next one of the same size
+	void* p = frame_pool::allocate(200);
+	frame_pool::deallocate(p, 200);
+	EXPECT_EQ(p, frame_pool::allocate(220));
+	frame_pool::deallocate(p, 220);
+}
+
+#endif
@@ -0,0 +1,496 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <future>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dht_session.hpp>
+#include <utils.hpp>
+#include "fake_dht.h"
+
+using namespace scout;
+
+namespace
+{
+	// a session which doesn't touch the network, with one request of each
+	// class in flight at a time
+	session_settings test_settings()
+	{
+		session_settings s;
+		s.bootstrap_nodes.clear();
+		s.bind_address = boost::asio::ip::address_v4::loopback();
+		s.persist_state = false;
+		s.map_ports = false;
+		s.max_outstanding = { { 1, 1, 1 } };
+		return s;
+	}
+
+	// run f on the network thread, after everything posted to it so far
+	void on_network_thread(dht_session& ses, std::function<void()> f)
+	{
+		std::promise<void> done;
+		ses.inject_packets({}, [&]() { f(); done.set_value(); });
+		done.get_future().wait();
+	}
+
+	std::vector<completion> wait_for(completion_queue& q, std::size_t count)
+	{
+		std::vector<completion> out;
+		while (out.size() < count && q.wait(5000)) q.harvest(out);
+		return out;
+	}
+
+	std::vector<completion> harvest_now(dht_session& ses, completion_queue& q)
+	{
+		// let the network thread catch up first
+		on_network_thread(ses, [] {});
+		std::vector<completion> out;
+		q.harvest(out);
+		return out;
+	}
+
+	std::string const contents = "test message";
+
+	gsl::span<gsl::byte const> contents_span()
+	{
+		return gsl::as_bytes(gsl::as_span(contents.c_str(), contents.size()));
+	}
+
+	hash const next_hash = { gsl::byte(1), gsl::byte(2), gsl::byte(3) };
+
+	// contents as the DHT returns them
+	std::vector<char> dht_item()
+	{
+		std::vector<gsl::byte> const blob = message_dht_blob_write(contents_span()
+			, gsl::as_span(next_hash));
+		std::string const prefix = std::to_string(blob.size()) + ":";
+		std::vector<char> buffer(prefix.begin(), prefix.end());
+		buffer.insert(buffer.end(), (char const*)blob.data(), (char const*)blob.data() + blob.size());
+		return buffer;
+	}
+
+	entry make_entry(std::uint32_t id, std::int64_t seq, char value)
+	{
+		entry e(id);
+		e.update_contents(gsl::as_bytes(gsl::as_span(&value, 1)));
+		e.update_seq(seq);
+		return e;
+	}
+
+	// the id and value of each entry, in id order
+	std::map<std::uint32_t, char> values(std::vector<entry> const& entries)
+	{
+		std::map<std::uint32_t, char> ret;
+		for (entry const& e : entries) ret[e.id()] = char(e.value()[0]);
+		return ret;
+	}
+
+	secret_key shared_key()
+	{
+		return key_exchange(generate_keypair().first, generate_keypair().second);
+	}
+
+	void expect_item(completion const& c)
+	{
+		EXPECT_EQ(op_status::success, c.status);
+		EXPECT_EQ(next_hash, c.next_hash);
+		EXPECT_EQ(contents, std::string((char const*)c.contents.data(), c.contents.size()));
+	}
+}
+
+TEST(dht_session, timeout_while_queued)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	list_head head;
+	list_token token = head.push_front(contents_span());
+
+	// the first put holds the only slot until the DHT answers it
+	op_handle first = ses.put(token, contents_span(), q);
+	op_options options;
+	options.timeout = std::chrono::milliseconds(50);
+	op_handle queued_put = ses.put(token, contents_span(), q, options);
+	hash target = token.next();
+	op_handle queued_get = ses.get(target, q, options);
+
+	std::vector<completion> out = wait_for(q, 2);
+	ASSERT_EQ(2, out.size());
+	for (completion const& c : out)
+	{
+		EXPECT_TRUE(c.id == queued_put.id() || c.id == queued_get.id());
+		EXPECT_EQ(op_status::timed_out, c.status);
+	}
+	EXPECT_EQ(op_status::pending, first.status());
+
+	on_network_thread(ses, [&]
+	{
+		// neither timed out request reached the DHT
+		ASSERT_EQ(1, dht->puts.size());
+		EXPECT_EQ(0, dht->gets.size());
+		dht->complete_put(0);
+	});
+	out = harvest_now(ses, q);
+	ASSERT_EQ(1, out.size());
+	EXPECT_EQ(first.id(), out[0].id);
+	EXPECT_EQ(op_status::success, out[0].status);
+	ses.stop();
+}
+
+TEST(dht_session, cancel_behind_another_op)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	list_head head;
+	list_token token = head.push_front(contents_span());
+
+	op_handle first = ses.put(token, contents_span(), q);
+	op_handle second = ses.put(token, contents_span(), q);
+	op_handle third = ses.put(token, contents_span(), q);
+
+	// the third is behind the second, which waits for the first
+	third.cancel();
+	std::vector<completion> out = wait_for(q, 1);
+	ASSERT_EQ(1, out.size());
+	EXPECT_EQ(third.id(), out[0].id);
+	EXPECT_EQ(op_status::cancelled, out[0].status);
+	EXPECT_EQ(op_status::pending, first.status());
+	EXPECT_EQ(op_status::pending, second.status());
+
+	// the second starts once the first is done
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->puts.size());
+		dht->complete_put(0);
+	});
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(2, dht->puts.size());
+		dht->complete_put(1);
+	});
+	out = harvest_now(ses, q);
+	ASSERT_EQ(2, out.size());
+	EXPECT_EQ(first.id(), out[0].id);
+	EXPECT_EQ(second.id(), out[1].id);
+	EXPECT_EQ(op_status::success, out[1].status);
+	ses.stop();
+}
+
+TEST(dht_session, gets_share_one_lookup)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	hash target = { gsl::byte(7) };
+	std::set<std::uint64_t> ids;
+	for (int i = 0; i < 4; ++i) ids.insert(ses.get(target, q).id());
+
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->gets.size());
+		dht->answer_get(0, dht_item());
+	});
+
+	// every get is answered, each on its own handle
+	std::vector<completion> out = harvest_now(ses, q);
+	ASSERT_EQ(4, out.size());
+	for (completion const& c : out)
+	{
+		expect_item(c);
+		EXPECT_EQ(1, ids.erase(c.id));
+	}
+	EXPECT_EQ(3, ses.get_stats().ops[int(op_type::get)].coalesced);
+	ses.stop();
+}
+
+TEST(dht_session, cancelling_the_first_get_keeps_the_lookup)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	hash target = { gsl::byte(7) };
+	op_handle leader = ses.get(target, q);
+	op_handle first = ses.get(target, q);
+	op_handle second = ses.get(target, q);
+
+	leader.cancel();
+	std::vector<completion> out = wait_for(q, 1);
+	ASSERT_EQ(1, out.size());
+	EXPECT_EQ(leader.id(), out[0].id);
+	EXPECT_EQ(op_status::cancelled, out[0].status);
+
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->gets.size());
+		dht->answer_get(0, dht_item());
+	});
+	out = harvest_now(ses, q);
+	ASSERT_EQ(2, out.size());
+	EXPECT_EQ(first.id(), out[0].id);
+	EXPECT_EQ(second.id(), out[1].id);
+	for (completion const& c : out) expect_item(c);
+	ses.stop();
+}
+
+TEST(dht_session, interactive_get_moves_a_queued_lookup)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	list_head head;
+	list_token token = head.push_front(contents_span());
+	op_options background;
+	background.priority = op_priority::background;
+	op_options interactive;
+	interactive.priority = op_priority::interactive;
+
+	// the put holds the only background slot
+	ses.put(token, contents_span(), q, background);
+	hash target = { gsl::byte(7) };
+	ses.get(target, q, background);
+	on_network_thread(ses, [&]
+	{
+		EXPECT_EQ(1, dht->puts.size());
+		EXPECT_EQ(0, dht->gets.size());
+	});
+
+	ses.get(target, q, interactive);
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->gets.size());
+		dht->answer_get(0, dht_item());
+	});
+	std::vector<completion> out = harvest_now(ses, q);
+	ASSERT_EQ(2, out.size());
+	for (completion const& c : out) expect_item(c);
+
+	on_network_thread(ses, [&] { dht->complete_put(0); });
+	EXPECT_EQ(1, harvest_now(ses, q).size());
+	ses.stop();
+}
+
+TEST(dht_session, synchronizes_merge)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	list_head head;
+	list_token token = head.push_front(contents_span());
+	secret_key key = shared_key();
+
+	// the put holds the only normal slot, so the synchronizes queue up
+	op_handle held = ses.put(token, contents_span(), q);
+	// between equal sequence numbers the later call wins, otherwise the
+	// higher sequence number does
+	std::set<std::uint64_t> ids;
+	ids.insert(ses.synchronize(key, { make_entry(1, 1, 'a'), make_entry(2, 5, 'a') }, q).id());
+	ids.insert(ses.synchronize(key, { make_entry(1, 1, 'b'), make_entry(2, 4, 'b') }, q).id());
+	ids.insert(ses.synchronize(key, { make_entry(3, 1, 'c') }, q).id());
+
+	on_network_thread(ses, [&]
+	{
+		EXPECT_EQ(0, dht->stores.size());
+		dht->complete_put(0);
+	});
+	on_network_thread(ses, [&]
+	{
+		// one store for all three
+		ASSERT_EQ(1, dht->stores.size());
+		dht->complete_store(0);
+	});
+
+	std::vector<completion> out = harvest_now(ses, q);
+	ASSERT_EQ(4, out.size());
+	EXPECT_EQ(held.id(), out[0].id);
+	std::map<std::uint32_t, char> const expected = { { 1, 'b' }, { 2, 'a' }, { 3, 'c' } };
+	for (int i = 1; i < 4; ++i)
+	{
+		EXPECT_EQ(1, ids.erase(out[i].id));
+		EXPECT_EQ(op_status::success, out[i].status);
+		EXPECT_EQ(expected, values(out[i].entries));
+	}
+	EXPECT_EQ(2, ses.get_stats().ops[int(op_type::synchronize)].coalesced);
+	ses.stop();
+}
+
+TEST(dht_session, synchronize_behind_a_running_one)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	secret_key key = shared_key();
+	op_handle first = ses.synchronize(key, { make_entry(1, 1, 'a') }, q);
+	on_network_thread(ses, [&] { EXPECT_EQ(1, dht->stores.size()); });
+
+	// both follow the running store, and the first of them times out
+	// waiting for it
+	op_options options;
+	options.timeout = std::chrono::milliseconds(50);
+	op_handle timed_out = ses.synchronize(key, { make_entry(2, 1, 'b') }, q, options);
+	op_handle last = ses.synchronize(key, { make_entry(3, 1, 'c') }, q);
+	std::vector<completion> out = wait_for(q, 1);
+	ASSERT_EQ(1, out.size());
+	EXPECT_EQ(timed_out.id(), out[0].id);
+	EXPECT_EQ(op_status::timed_out, out[0].status);
+
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->stores.size());
+		dht->complete_store(0);
+	});
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(2, dht->stores.size());
+		dht->complete_store(1);
+	});
+
+	out = harvest_now(ses, q);
+	ASSERT_EQ(2, out.size());
+	EXPECT_EQ(first.id(), out[0].id);
+	EXPECT_EQ((std::map<std::uint32_t, char>{ { 1, 'a' } }), values(out[0].entries));
+	// the timed out synchronize's entries aren't stored
+	EXPECT_EQ(last.id(), out[1].id);
+	EXPECT_EQ(op_status::success, out[1].status);
+	EXPECT_EQ((std::map<std::uint32_t, char>{ { 3, 'c' } }), values(out[1].entries));
+	EXPECT_EQ(0, ses.get_stats().queued);
+	ses.stop();
+}
+
+TEST(dht_session, interactive_synchronize_moves_a_queued_store)
+{
+	deferred_dht* dht = new deferred_dht;
+	dht_session ses(test_settings(), dht);
+	ASSERT_EQ(0, ses.start());
+
+	completion_queue q;
+	list_head head;
+	list_token token = head.push_front(contents_span());
+	secret_key key = shared_key();
+	op_options background;
+	background.priority = op_priority::background;
+	op_options interactive;
+	interactive.priority = op_priority::interactive;
+
+	// the put holds the only background slot
+	ses.put(token, contents_span(), q, background);
+	ses.synchronize(key, { make_entry(1, 1, 'a') }, q, background);
+	on_network_thread(ses, [&] { EXPECT_EQ(0, dht->stores.size()); });
+
+	ses.synchronize(key, { make_entry(2, 1, 'b') }, q, interactive);
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(1, dht->stores.size());
+		dht->complete_store(0);
+		dht->complete_put(0);
+	});
+	EXPECT_EQ(3, harvest_now(ses, q).size());
+	ses.stop();
+}
+
+TEST(dht_session, hedge)
+{
+	deferred_dht* dht = new deferred_dht;
+	session_settings settings = test_settings();
+	settings.max_outstanding = { { 100, 100, 1 } };
+	settings.hedge_percentile = 0.5;
+	settings.hedge_budget = 1.;
+	dht_session ses(settings, dht);
+	ASSERT_EQ(0, ses.start());
+
+	// lookups which take about 50 ms, enough history to set the hedge delay
+	completion_queue q;
+	int const history = 64;
+	for (int i = 0; i < history; ++i)
+	{
+		hash target = { gsl::byte(i) };
+		ses.get(target, q);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(history, dht->gets.size());
+		for (int i = 0; i < history; ++i) dht->answer_get(i, dht_item());
+	});
+	EXPECT_EQ(history, harvest_now(ses, q).size());
+
+	hash target = { gsl::byte(100) };
+	op_handle h = ses.get(target, q);
+	// the hedge waits for the delay
+	on_network_thread(ses, [&] { EXPECT_EQ(history + 1, dht->gets.size()); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(history + 2, dht->gets.size());
+		// the hedge answers first
+		dht->answer_get(history + 1, dht_item());
+	});
+	std::vector<completion> out = harvest_now(ses, q);
+	ASSERT_EQ(1, out.size());
+	EXPECT_EQ(h.id(), out[0].id);
+	expect_item(out[0]);
+	session_stats stats = ses.get_stats();
+	EXPECT_EQ(1, stats.gets_hedged);
+	EXPECT_EQ(1, stats.hedges_won);
+
+	// the first lookup was cancelled, its answer is dropped
+	on_network_thread(ses, [&]
+	{
+		dht->answer_get(history, dht_item());
+	});
+	EXPECT_EQ(0, harvest_now(ses, q).size());
+
+	// a hedge waits for its turn like any other lookup. The only background
+	// slot is taken by the first lookup
+	op_options background;
+	background.priority = op_priority::background;
+	target[0] = gsl::byte(101);
+	h = ses.get(target, q, background);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	on_network_thread(ses, [&]
+	{
+		ASSERT_EQ(history + 3, dht->gets.size());
+		dht->answer_get(history + 2, dht_item());
+	});
+	out = harvest_now(ses, q);
+	ASSERT_EQ(1, out.size());
+	expect_item(out[0]);
+	// and is dropped once the first lookup answers
+	on_network_thread(ses, [&] { EXPECT_EQ(history + 3, dht->gets.size()); });
+	EXPECT_EQ(1, ses.get_stats().gets_hedged);
+	EXPECT_EQ(0, ses.get_stats().queued);
+	ses.stop();
+}
@@ -0,0 +1,76 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <histogram.hpp>
+
+using namespace scout;
+
+TEST(histogram, bucket_bounds)
+{
+	// every value must fall within the bounds of its bucket and the bucket
+	// must not be wider than the configured relative error
+	for (std::uint64_t v = 0; v < (std::uint64_t(1) << histogram_layout::max_exponent); v = v * 3 / 2 + 1)
+	{
+		int const b = histogram_layout::bucket_for(v);
+		ASSERT_LT(b, int(histogram_layout::num_buckets));
+		EXPECT_LE(histogram_layout::bucket_lower(b), v);
+		EXPECT_GT(histogram_layout::bucket_upper(b), v);
+		std::uint64_t const width = histogram_layout::bucket_upper(b) - histogram_layout::bucket_lower(b);
+		EXPECT_LE(width, (std::max)(std::uint64_t(1), v / histogram_layout::sub_buckets));
+	}
+
+	// buckets are contiguous
+	for (int b = 1; b < histogram_layout::num_buckets; ++b)
+		EXPECT_EQ(histogram_layout::bucket_upper(b - 1), histogram_layout::bucket_lower(b));
+}
+
+TEST(histogram, percentiles)
+{
+	latency_histogram h;
+	for (int i = 1; i <= 1000; ++i)
+		h.record(std::chrono::milliseconds(i));
+
+	histogram_snapshot const s = h.snapshot();
+	EXPECT_EQ(1000, s.count);
+	EXPECT_EQ(1000000, s.max);
+	EXPECT_EQ(500500, s.mean());
+
+	// percentiles are reported as the top of their bucket
+	EXPECT_GE(s.p50(), 500000);
+	EXPECT_LE(s.p50(), 500000 + 500000 / histogram_layout::sub_buckets);
+	EXPECT_GE(s.p99(), 990000);
+	EXPECT_LE(s.p999(), 1000000);
+	EXPECT_EQ(0, histogram_snapshot().p99());
+}
+
+TEST(histogram, reset_and_merge)
+{
+	latency_histogram h;
+	h.record(std::chrono::microseconds(10));
+	h.record(std::chrono::microseconds(20));
+
+	histogram_snapshot s = h.snapshot_and_reset();
+	EXPECT_EQ(2, s.count);
+	EXPECT_EQ(30, s.sum);
+	EXPECT_EQ(0, h.snapshot().count);
+
+	h.record(std::chrono::microseconds(40));
+	s.merge(h.snapshot());
+	EXPECT_EQ(3, s.count);
+	EXPECT_EQ(40, s.max);
+}
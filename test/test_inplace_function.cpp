@@ -0,0 +1,92 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <functional>
+#include <memory>
+#include <inplace_function.hpp>
+
+using namespace scout;
+
+namespace
+{
+	// counts live copies so tests can tell the callable was destroyed
+	struct tracked
+	{
+		explicit tracked(int& l) : live(&l) { ++*live; }
+		tracked(tracked&& o) : live(o.live) { ++*live; }
+		tracked(tracked const&) = delete;
+		~tracked() { --*live; }
+		int* live;
+	};
+}
+
+TEST(inplace_function, call)
+{
+	int sum = 0;
+	inplace_function<int(int), 32> f([&sum](int x) { sum += x; return sum; });
+	ASSERT_TRUE(bool(f));
+	EXPECT_EQ(2, f(2));
+	EXPECT_EQ(5, f(3));
+	EXPECT_EQ(5, sum);
+}
+
+TEST(inplace_function, empty)
+{
+	inplace_function<void(), 32> f;
+	EXPECT_FALSE(bool(f));
+	inplace_function<void(), 32> g(nullptr);
+	EXPECT_FALSE(bool(g));
+}
+
+TEST(inplace_function, move_only_capture)
+{
+	std::unique_ptr<int> p(new int(7));
+	inplace_function<int(), 32> f([p = std::move(p)]() { return *p; });
+	inplace_function<int(), 32> g(std::move(f));
+	EXPECT_FALSE(bool(f));
+	ASSERT_TRUE(bool(g));
+	EXPECT_EQ(7, g());
+}
+
+TEST(inplace_function, destroys_callable)
+{
+	int live = 0;
+	{
+		inplace_function<void(), 32> f([t = tracked(live)]() {});
+		EXPECT_EQ(1, live);
+		inplace_function<void(), 32> g;
+		g = std::move(f);
+		EXPECT_EQ(1, live);
+		g = nullptr;
+		EXPECT_EQ(0, live);
+		EXPECT_FALSE(bool(g));
+
+		f = inplace_function<void(), 32>([t = tracked(live)]() {});
+		EXPECT_EQ(1, live);
+	}
+	EXPECT_EQ(0, live);
+}
+
+TEST(inplace_function, holds_std_function)
+{
+	int called = 0;
+	std::function<void()> sf = [&called] { ++called; };
+	inplace_function<void(), sizeof(std::function<void()>)> f(std::move(sf));
+	f();
+	EXPECT_EQ(1, called);
+}
@@ -0,0 +1,247 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <logging.hpp>
+#include "ring_buffer.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace scout;
+
+namespace
+{
+	// collects every message passed to the sink
+	struct captured_log
+	{
+		captured_log()
+		{
+			set_log_level(log_level::debug);
+			set_log_sink([this](log_message const& msg)
+			{
+				std::lock_guard<std::mutex> l(mutex);
+				lines.emplace_back(msg.text, msg.length);
+				levels.push_back(msg.level);
+			});
+		}
+
+		~captured_log()
+		{
+			flush_log();
+			set_log_sink(nullptr);
+			set_log_level(log_level::debug);
+		}
+
+		std::vector<std::string> take()
+		{
+			flush_log();
+			std::lock_guard<std::mutex> l(mutex);
+			levels.clear();
+			return std::move(lines);
+		}
+
+		std::mutex mutex;
+		std::vector<std::string> lines;
+		std::vector<log_level> levels;
+	};
+}
+
+TEST(ring_buffer, push_and_pop)
+{
+	ring_buffer<int, 4> ring;
+	EXPECT_TRUE(ring.empty());
+
+	for (int i = 0; i < 4; ++i)
+		EXPECT_TRUE(ring.push([i](int& v) { v = i; }));
+
+	// full, so the slot isn't filled
+	bool filled = false;
+	EXPECT_FALSE(ring.push([&](int&) { filled = true; }));
+	EXPECT_FALSE(filled);
+
+	int popped = -1;
+	EXPECT_TRUE(ring.pop([&](int& v) { popped = v; }));
+	EXPECT_EQ(0, popped);
+	// the released slot can be filled again
+	EXPECT_TRUE(ring.push([](int& v) { v = 4; }));
+
+	std::vector<int> rest;
+	while (ring.pop([&](int& v) { rest.push_back(v); })) {}
+	EXPECT_EQ((std::vector<int>{ 1, 2, 3, 4 }), rest);
+	EXPECT_TRUE(ring.empty());
+	EXPECT_FALSE(ring.pop([](int&) {}));
+}
+
+TEST(logging, producers_keep_their_order)
+{
+	captured_log log;
+	int const producers = 4;
+	// fewer than the ring holds, so nothing is dropped however slow the
+	// logging thread is
+	int const per_producer = 200;
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back([p]
+		{
+			for (int i = 0; i < per_producer; ++i)
+				log_info("%d %d", p, i);
+		});
+	}
+	for (auto& t : threads) t.join();
+
+	std::vector<std::string> const lines = log.take();
+	ASSERT_EQ(std::size_t(producers * per_producer), lines.size());
+	std::vector<int> next(producers, 0);
+	for (std::string const& line : lines)
+	{
+		int p = -1, i = -1;
+		ASSERT_EQ(2, std::sscanf(line.c_str(), "%d %d", &p, &i));
+		ASSERT_LE(0, p);
+		ASSERT_GT(producers, p);
+		EXPECT_EQ(next[p], i);
+		next[p] = i + 1;
+	}
+}
+
+TEST(logging, drops_when_full)
+{
+	std::mutex m;
+	std::condition_variable cv;
+	bool blocked = false;
+	bool release = false;
+	std::vector<std::string> lines;
+	set_log_level(log_level::debug);
+	set_log_sink([&](log_message const& msg)
+	{
+		std::unique_lock<std::mutex> l(m);
+		lines.emplace_back(msg.text, msg.length);
+		blocked = true;
+		cv.notify_all();
+		cv.wait(l, [&] { return release; });
+	});
+
+	// hold the logging thread in the sink, then log more than the ring holds
+	log_info("first");
+	{
+		std::unique_lock<std::mutex> l(m);
+		cv.wait(l, [&] { return blocked; });
+	}
+	int const logged = 2000;
+	for (int i = 0; i < logged; ++i)
+		log_info("%d", i);
+	{
+		std::lock_guard<std::mutex> l(m);
+		release = true;
+	}
+	cv.notify_all();
+	flush_log();
+	set_log_sink(nullptr);
+
+	// every message is either passed on or counted as dropped
+	ASSERT_FALSE(lines.empty());
+	EXPECT_EQ("first", lines.front());
+	int passed = 0;
+	unsigned long long dropped = 0;
+	int expected = 0;
+	for (std::size_t i = 1; i < lines.size(); ++i)
+	{
+		unsigned long long n = 0;
+		if (std::sscanf(lines[i].c_str(), "logging: dropped %llu messages", &n) == 1)
+		{
+			dropped += n;
+			continue;
+		}
+		// the ones which made it keep their order
+		int const value = std::stoi(lines[i]);
+		EXPECT_LE(expected, value);
+		expected = value + 1;
+		++passed;
+	}
+	EXPECT_GT(dropped, 0);
+	EXPECT_EQ(logged, passed + int(dropped));
+}
+
+TEST(logging, flush_waits_for_the_sink)
+{
+	captured_log log;
+	for (int i = 0; i < 100; ++i)
+		log_info("%d", i);
+	flush_log();
+
+	std::lock_guard<std::mutex> l(log.mutex);
+	ASSERT_EQ(100, log.lines.size());
+	EXPECT_EQ("99", log.lines.back());
+}
+
+TEST(logging, set_sink)
+{
+	std::vector<std::string> first;
+	std::vector<std::string> second;
+	set_log_level(log_level::debug);
+	set_log_sink([&](log_message const& msg) { first.emplace_back(msg.text, msg.length); });
+	log_info("one");
+	flush_log();
+	set_log_sink([&](log_message const& msg) { second.emplace_back(msg.text, msg.length); });
+	log_info("two");
+	flush_log();
+
+	// an empty sink goes back to stderr and the old one isn't called again
+	set_log_sink(nullptr);
+	log_info("three");
+	flush_log();
+
+	EXPECT_EQ(std::vector<std::string>{ "one" }, first);
+	EXPECT_EQ(std::vector<std::string>{ "two" }, second);
+}
+
+TEST(logging, level_filter)
+{
+	captured_log log;
+	set_log_level(log_level::warning);
+	EXPECT_EQ(log_level::warning, get_log_level());
+	EXPECT_FALSE(should_log(log_level::info));
+	EXPECT_TRUE(should_log(log_level::error));
+
+	log_debug("debug");
+	log_info("info");
+	log_warning("warning");
+	log_error("error");
+	flush_log();
+	{
+		std::lock_guard<std::mutex> l(log.mutex);
+		ASSERT_EQ(2, log.levels.size());
+		EXPECT_EQ(log_level::warning, log.levels[0]);
+		EXPECT_EQ(log_level::error, log.levels[1]);
+	}
+	EXPECT_EQ((std::vector<std::string>{ "warning", "error" }), log.take());
+
+	// lowered again at runtime
+	set_log_level(log_level::debug);
+	log_debug("debug");
+	EXPECT_EQ(std::vector<std::string>{ "debug" }, log.take());
+
+	set_log_level(log_level::off);
+	log_error("error");
+	EXPECT_TRUE(log.take().empty());
+}
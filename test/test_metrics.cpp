@@ -0,0 +1,212 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <dht_session.hpp>
+#include <metrics.hpp>
+#include "metrics_server.hpp"
+#include "fake_dht.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+using namespace scout;
+using boost::asio::ip::tcp;
+
+namespace
+{
+	// a metrics_server on its own thread, serving a fixed body
+	struct test_server
+	{
+		test_server(std::chrono::milliseconds timeout = std::chrono::seconds(5))
+			: work(new boost::asio::io_service::work(ios))
+			, server(ios, [](std::string& out) { out += "scout_test 1\n# EOF\n"; }, timeout)
+		{
+			boost::system::error_code ec;
+			server.listen(0, ec);
+			EXPECT_FALSE(ec);
+			thread = std::thread([this] { ios.run(); });
+		}
+
+		~test_server()
+		{
+			ios.post([this] { server.close(); });
+			work.reset();
+			ios.stop();
+			thread.join();
+		}
+
+		boost::asio::io_service ios;
+		std::unique_ptr<boost::asio::io_service::work> work;
+		metrics_server server;
+		std::thread thread;
+	};
+
+	tcp::endpoint server_endpoint(std::uint16_t port)
+	{
+		return tcp::endpoint(boost::asio::ip::address_v4::loopback(), port);
+	}
+
+	// send request and return everything the server answers with, up to the
+	// point where it closes the connection
+	std::string http_request(std::uint16_t port, std::string const& request)
+	{
+		boost::asio::io_service ios;
+		tcp::socket s(ios);
+		s.connect(server_endpoint(port));
+		boost::asio::write(s, boost::asio::buffer(request));
+		std::string response;
+		boost::system::error_code ec;
+		char buf[1024];
+		for (;;)
+		{
+			std::size_t const n = s.read_some(boost::asio::buffer(buf), ec);
+			if (ec) break;
+			response.append(buf, n);
+		}
+		EXPECT_EQ(boost::asio::error::eof, ec);
+		return response;
+	}
+
+	std::string status_line(std::string const& response)
+	{
+		return response.substr(0, response.find("\r\n"));
+	}
+
+	std::string body(std::string const& response)
+	{
+		std::size_t const end = response.find("\r\n\r\n");
+		if (end == std::string::npos) return std::string();
+		return response.substr(end + 4);
+	}
+}
+
+TEST(metrics, openmetrics_text)
+{
+	session_counters counters;
+	counters.op_queued(op_type::get);
+	counters.op_dequeued();
+	counters.op_finished(op_type::get, true, session_counters::clock::now());
+	counters.record_phase(op_type::get, op_phase::lookup, std::chrono::milliseconds(3));
+	counters.packet_in(100);
+	counters.op_coalesced(op_type::get);
+	counters.get_hedged();
+
+	std::string out;
+	render_metrics(counters.snapshot(), out);
+
+	EXPECT_NE(std::string::npos, out.find("# TYPE scout_operations_started counter\n"));
+	EXPECT_NE(std::string::npos, out.find("scout_operations_started_total{op=\"get\"} 1\n"));
+	EXPECT_NE(std::string::npos, out.find(
+		"scout_operations_completed_total{op=\"get\",result=\"success\"} 1\n"));
+	EXPECT_NE(std::string::npos, out.find("scout_udp_bytes_total{direction=\"in\"} 100\n"));
+	EXPECT_NE(std::string::npos, out.find("scout_operations_coalesced_total{op=\"get\"} 1\n"));
+	EXPECT_NE(std::string::npos, out.find("scout_get_hedges_total 1\n"));
+	EXPECT_NE(std::string::npos, out.find("scout_get_hedges_won_total 0\n"));
+
+	// the 3 ms sample is counted from the 5 ms bucket onwards
+	EXPECT_NE(std::string::npos, out.find(
+		"scout_operation_phase_seconds_bucket{op=\"get\",phase=\"lookup\",le=\"0.0025\"} 0\n"));
+	EXPECT_NE(std::string::npos, out.find(
+		"scout_operation_phase_seconds_bucket{op=\"get\",phase=\"lookup\",le=\"0.005\"} 1\n"));
+	EXPECT_NE(std::string::npos, out.find(
+		"scout_operation_phase_seconds_count{op=\"get\",phase=\"lookup\"} 1\n"));
+	EXPECT_NE(std::string::npos, out.find(
+		"scout_operation_phase_seconds_sum{op=\"get\",phase=\"lookup\"} 0.003\n"));
+
+	// the exposition must be terminated
+	ASSERT_GE(out.size(), 6);
+	EXPECT_EQ("# EOF\n", out.substr(out.size() - 6));
+}
+
+TEST(metrics_server, get_metrics)
+{
+	test_server t;
+	ASSERT_NE(0, t.server.port());
+
+	std::string const response = http_request(t.server.port()
+		, "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+	EXPECT_EQ("HTTP/1.0 200 OK", status_line(response));
+	EXPECT_NE(std::string::npos, response.find(
+		std::string("\r\nContent-Type: ") + openmetrics_content_type + "\r\n"));
+	EXPECT_NE(std::string::npos, response.find("\r\nContent-Length: 19\r\n"));
+	EXPECT_EQ("scout_test 1\n# EOF\n", body(response));
+}
+
+TEST(metrics_server, not_found)
+{
+	test_server t;
+	std::string const response = http_request(t.server.port()
+		, "GET /stats HTTP/1.0\r\n\r\n");
+	EXPECT_EQ("HTTP/1.0 404 Not Found", status_line(response));
+	EXPECT_NE(std::string::npos, response.find("\r\nContent-Type: text/plain\r\n"));
+	EXPECT_EQ("", body(response));
+}
+
+TEST(metrics_server, method_not_allowed)
+{
+	test_server t;
+	std::string const response = http_request(t.server.port()
+		, "POST /metrics HTTP/1.0\r\nContent-Length: 0\r\n\r\n");
+	EXPECT_EQ("HTTP/1.0 405 Method Not Allowed", status_line(response));
+	EXPECT_EQ("", body(response));
+}
+
+TEST(metrics_server, incomplete_request_times_out)
+{
+	test_server t(std::chrono::milliseconds(50));
+
+	// the request never ends, so the server gives up and closes the
+	// connection without answering
+	std::string const response = http_request(t.server.port(), "GET /metrics HTTP/1.0\r\n");
+	EXPECT_EQ("", response);
+
+	// and keeps serving others
+	EXPECT_EQ("HTTP/1.0 200 OK", status_line(http_request(t.server.port()
+		, "GET /metrics HTTP/1.0\r\n\r\n")));
+}
+
+TEST(metrics_server, session_endpoint)
+{
+	session_settings settings;
+	settings.bootstrap_nodes.clear();
+	settings.bind_address = boost::asio::ip::address_v4::loopback();
+	settings.persist_state = false;
+	settings.map_ports = false;
+	dht_session ses(settings, new FakeDhtImpl);
+	ASSERT_EQ(0, ses.start());
+
+	int const port = ses.serve_metrics(0);
+	ASSERT_GT(port, 0);
+	// there is only one endpoint per session
+	EXPECT_EQ(-1, ses.serve_metrics(0));
+
+	std::string const response = http_request(std::uint16_t(port)
+		, "GET /metrics HTTP/1.0\r\n\r\n");
+	EXPECT_EQ("HTTP/1.0 200 OK", status_line(response));
+	EXPECT_NE(std::string::npos, response.find(
+		std::string("\r\nContent-Type: ") + openmetrics_content_type + "\r\n"));
+	std::string const text = body(response);
+	EXPECT_NE(std::string::npos, text.find("# TYPE scout_operations_started counter\n"));
+	ASSERT_GE(text.size(), 6);
+	EXPECT_EQ("# EOF\n", text.substr(text.size() - 6));
+	ses.stop();
+}
@@ -0,0 +1,275 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include "op_scheduler.hpp"
+
+using namespace scout;
+using clock_type = op_scheduler::clock;
+
+namespace
+{
+	std::array<op_scheduler::class_limits, num_op_priorities> limits(
+		int interactive_weight, int normal_weight, int background_weight, int max_outstanding)
+	{
+		return{ { { interactive_weight, max_outstanding }
+			, { normal_weight, max_outstanding }
+			, { background_weight, max_outstanding } } };
+	}
+}
+
+TEST(op_scheduler, unlimited)
+{
+	clock_type::time_point const now;
+	op_scheduler s(limits(1, 1, 1, 100), 0, now);
+	std::vector<int> started;
+	EXPECT_TRUE(s.push(op_priority::normal, 100, op_handle(), [&](op_priority) { started.push_back(1); }));
+	// a run is already due
+	EXPECT_FALSE(s.push(op_priority::background, 100, op_handle(), [&](op_priority) { started.push_back(2); }));
+	EXPECT_EQ(clock_type::duration::zero(), s.run(now));
+	EXPECT_EQ(2, started.size());
+	EXPECT_EQ(1, s.outstanding(op_priority::normal));
+	EXPECT_EQ(1, s.outstanding(op_priority::background));
+}
+
+TEST(op_scheduler, cap)
+{
+	clock_type::time_point const now;
+	op_scheduler s(limits(1, 1, 1, 2), 0, now);
+	int started = 0;
+	for (int i = 0; i < 5; ++i)
+		s.push(op_priority::background, 100, op_handle(), [&](op_priority) { ++started; });
+	s.run(now);
+	EXPECT_EQ(2, started);
+	EXPECT_EQ(3, s.queued(op_priority::background));
+
+	// a finished request makes room for the next one
+	EXPECT_TRUE(s.finished(op_priority::background));
+	s.run(now);
+	EXPECT_EQ(3, started);
+
+	// requests which finish right away don't count against the cap
+	s.finished(op_priority::background);
+	s.finished(op_priority::background);
+	op_scheduler s2(limits(1, 1, 1, 1), 0, now);
+	started = 0;
+	for (int i = 0; i < 5; ++i)
+	{
+		s2.push(op_priority::normal, 100, op_handle(), [&](op_priority p)
+		{
+			++started;
+			EXPECT_FALSE(s2.finished(p));
+		});
+	}
+	s2.run(now);
+	EXPECT_EQ(5, started);
+}
+
+TEST(op_scheduler, ended_requests_skip_the_queue)
+{
+	clock_type::time_point const now;
+	op_scheduler s(limits(1, 1, 1, 1), 1000, now);
+	int started = 0;
+	s.push(op_priority::background, 100, op_handle(), [&](op_priority) { ++started; });
+	s.run(now);
+	EXPECT_EQ(1, started);
+
+	// the class is at its cap, but a cancelled request is let through to
+	// invoke its callback
+	op_handle h;
+	h.cancel();
+	s.push(op_priority::background, 100, h, [&](op_priority) { ++started; });
+	s.run(now);
+	EXPECT_EQ(2, started);
+}
+
+TEST(op_scheduler, ended_requests_anywhere_in_the_queue)
+{
+	clock_type::time_point const now;
+	op_scheduler s(limits(1, 1, 1, 1), 0, now);
+	std::vector<int> started;
+	s.push(op_priority::normal, 100, op_handle(), [&](op_priority) { started.push_back(1); });
+	s.push(op_priority::normal, 100, op_handle(), [&](op_priority) { started.push_back(2); });
+	op_handle h;
+	s.push(op_priority::normal, 100, h, [&](op_priority) { started.push_back(3); });
+	s.run(now);
+	EXPECT_EQ(std::vector<int>({ 1 }), started);
+
+	// the third request is cancelled behind the second, which waits for the
+	// first to finish
+	h.cancel();
+	EXPECT_TRUE(s.wake());
+	EXPECT_FALSE(s.wake());
+	s.run(now);
+	EXPECT_EQ(std::vector<int>({ 1, 3 }), started);
+	EXPECT_EQ(1, s.queued(op_priority::normal));
+}
+
+TEST(op_scheduler, budget)
+{
+	clock_type::time_point now;
+	// one second of budget is 1000 bytes
+	op_scheduler s(limits(1, 1, 1, 100), 1000, now);
+	int background = 0;
+	int interactive = 0;
+	for (int i = 0; i < 10; ++i)
+		s.push(op_priority::background, 400, op_handle(), [&](op_priority) { ++background; });
+
+	// background requests stop once the bucket is less than half full
+	clock_type::duration wait = s.run(now);
+	EXPECT_EQ(2, background);
+	EXPECT_GT(wait, clock_type::duration::zero());
+
+	// interactive requests may borrow
+	for (int i = 0; i < 3; ++i)
+		s.push(op_priority::interactive, 400, op_handle(), [&](op_priority) { ++interactive; });
+	s.run(now);
+	EXPECT_EQ(3, interactive);
+	EXPECT_EQ(2, background);
+
+	// the budget refills over time, up to one second's worth
+	now += std::chrono::seconds(5);
+	s.run(now);
+	EXPECT_EQ(4, background);
+}
+
+TEST(op_scheduler, weights)
+{
+	clock_type::time_point now;
+	op_scheduler s(limits(1, 4, 1, 1000), 1000, now);
+	std::vector<op_priority> order;
+	for (int i = 0; i < 200; ++i)
+	{
+		s.push(op_priority::normal, 100, op_handle(), [&](op_priority) { order.push_back(op_priority::normal); });
+		s.push(op_priority::interactive, 100, op_handle(), [&](op_priority) { order.push_back(op_priority::interactive); });
+	}
+
+	// drain the queues at the rate of the budget
+	while (order.size() < 100)
+	{
+		clock_type::duration const wait = s.run(now);
+		if (wait == clock_type::duration::zero()) break;
+		now += wait;
+	}
+
+	int normal = 0;
+	for (int i = 0; i < 100; ++i)
+		if (order[i] == op_priority::normal) ++normal;
+	// the normal class has four times the weight, but interactive requests
+	// may also borrow from the budget
+	EXPECT_GT(normal, 40);
+	EXPECT_LT(normal, 85);
+}
+
+TEST(op_scheduler, interactive_under_bulk)
+{
+	clock_type::time_point now;
+	op_scheduler s(limits(16, 4, 1, 1000), 8000, now);
+	int bulk = 0;
+	for (int i = 0; i < 500; ++i)
+	{
+		s.push(op_priority::normal, 13200, op_handle(), [&](op_priority) { ++bulk; });
+		s.push(op_priority::background, 13200, op_handle(), [&](op_priority) { ++bulk; });
+	}
+	s.run(now);
+	int const started_bulk = bulk;
+	EXPECT_LT(started_bulk, 5);
+
+	// an interactive request doesn't wait for the bulk to drain
+	now += std::chrono::milliseconds(10);
+	bool started = false;
+	s.push(op_priority::interactive, 3200, op_handle(), [&](op_priority) { started = true; });
+	s.run(now);
+	EXPECT_TRUE(started);
+	EXPECT_EQ(started_bulk, bulk);
+}
+
+TEST(op_scheduler, wait_for_turn)
+{
+	clock_type::time_point now;
+	op_scheduler s(limits(1, 1, 1, 100), 1000, now);
+	int interactive = 0;
+	int normal = 0;
+	s.push(op_priority::interactive, 1500, op_handle(), [&](op_priority) { ++interactive; });
+	s.push(op_priority::interactive, 100, op_handle(), [&](op_priority) { ++interactive; });
+	s.push(op_priority::normal, 100, op_handle(), [&](op_priority) { ++normal; });
+
+	// the second interactive request may borrow, but it's the normal
+	// class' turn, which waits for the bucket to be out of debt
+	clock_type::duration const wait = s.run(now);
+	EXPECT_EQ(1, interactive);
+	EXPECT_EQ(0, normal);
+	EXPECT_GE(wait, std::chrono::milliseconds(500));
+	EXPECT_LT(wait, std::chrono::milliseconds(501));
+
+	now += wait;
+	EXPECT_EQ(clock_type::duration::zero(), s.run(now));
+	EXPECT_EQ(2, interactive);
+	EXPECT_EQ(1, normal);
+}
+
+TEST(op_scheduler, refill_keeps_fractions)
+{
+	clock_type::time_point now;
+	// a byte per millisecond
+	op_scheduler s(limits(1, 1, 1, 100), 1000, now);
+	s.push(op_priority::normal, 1000, op_handle(), [](op_priority) {});
+	bool started = false;
+	s.push(op_priority::background, 100, op_handle(), [&](op_priority) { started = true; });
+	s.run(now);
+	EXPECT_FALSE(started);
+
+	// the background request waits for 500 bytes, which takes 500 ms
+	// however often the bucket is refilled
+	for (int i = 0; i < 330; ++i)
+	{
+		now += std::chrono::microseconds(1500);
+		s.run(now);
+	}
+	EXPECT_FALSE(started);
+	for (int i = 0; i < 5 && !started; ++i)
+	{
+		now += std::chrono::microseconds(1500);
+		s.run(now);
+	}
+	EXPECT_TRUE(started);
+}
+
+TEST(op_scheduler, requeue)
+{
+	clock_type::time_point const now;
+	op_scheduler s(limits(1, 1, 1, 1), 0, now);
+	std::vector<op_priority> started;
+	auto record = [&](op_priority p) { started.push_back(p); };
+	s.push(op_priority::background, 100, op_handle(), record);
+	op_handle h;
+	s.push(op_priority::background, 100, h, record);
+	s.run(now);
+	EXPECT_EQ(1, started.size());
+
+	// the second request no longer waits for the background class
+	EXPECT_TRUE(s.requeue(h, op_priority::interactive));
+	EXPECT_EQ(0, s.queued(op_priority::background));
+	s.run(now);
+	ASSERT_EQ(2, started.size());
+	EXPECT_EQ(op_priority::interactive, started[1]);
+
+	// a started request stays where it is
+	EXPECT_FALSE(s.requeue(h, op_priority::normal));
+	EXPECT_EQ(0, s.queued(op_priority::normal));
+}
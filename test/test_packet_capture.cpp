@@ -0,0 +1,62 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <packet_capture.hpp>
+
+using namespace scout;
+using boost::asio::ip::udp;
+using boost::asio::ip::address_v4;
+
+TEST(packet_capture, round_trip)
+{
+	char const* filename = "test_capture.pcap";
+	udp::endpoint const local(address_v4::from_string("10.0.0.1"), 6881);
+	udp::endpoint const remote(address_v4::from_string("192.168.1.2"), 51413);
+	std::string const query = "d1:ad2:id20:aaaaaaaaaaaaaaaaaaaae1:q4:ping1:t2:xx1:y1:qe";
+	std::string const response = "d1:rd2:id20:bbbbbbbbbbbbbbbbbbbbe1:t2:xx1:y1:re";
+	{
+		packet_capture capture(filename);
+		ASSERT_TRUE(capture.is_open());
+		capture.record(packet_direction::outgoing, query.data(), query.size(), remote, local);
+		capture.record(packet_direction::incoming, response.data(), response.size(), remote, local);
+		// IPv6 isn't captured
+		udp::endpoint const v6(boost::asio::ip::address_v6::loopback(), 1);
+		capture.record(packet_direction::incoming, response.data(), response.size(), v6, v6);
+		EXPECT_EQ(2, capture.packets());
+	}
+
+	capture_reader reader(filename);
+	ASSERT_TRUE(reader.is_open());
+
+	captured_packet p;
+	ASSERT_TRUE(reader.next(p));
+	EXPECT_EQ(packet_direction::outgoing, p.direction);
+	EXPECT_EQ(remote, p.remote);
+	EXPECT_EQ(local, p.local);
+	EXPECT_EQ(query, std::string(p.payload.begin(), p.payload.end()));
+
+	ASSERT_TRUE(reader.next(p));
+	EXPECT_EQ(packet_direction::incoming, p.direction);
+	EXPECT_EQ(remote, p.remote);
+	EXPECT_EQ(local, p.local);
+	EXPECT_EQ(response, std::string(p.payload.begin(), p.payload.end()));
+
+	EXPECT_FALSE(reader.next(p));
+	std::remove(filename);
+}
@@ -17,6 +17,7 @@ limitations under the License.
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
+#include <map>
 #include <scout.hpp>
 #include <utils.hpp>
 #include "fake_dht.h"
@@ -111,6 +112,37 @@ TEST(scout_api, get)
 	EXPECT_TRUE(received_cb_called);
 }
 
+TEST(scout_api, get_view)
+{
+	FakeDhtImpl fake_dht = FakeDhtImpl();
+	init(fake_dht);
+
+	std::string test_msg = "test message";
+	auto test_msg_span = gsl::as_bytes(gsl::as_span(test_msg.c_str(), test_msg.size()));
+	hash test_hash;
+	test_hash.fill(b(3));
+
+	auto dht_blob = message_dht_blob_write(test_msg_span, test_hash);
+	std::string prefix = std::to_string(dht_blob.size()) + ":";
+	fake_dht.immutableData.assign(prefix.begin(), prefix.end());
+	fake_dht.immutableData.insert(fake_dht.immutableData.end()
+		, (char*)dht_blob.data(), (char*)dht_blob.data() + dht_blob.size());
+
+	bool viewed_cb_called = false;
+	hash target_hash;
+	get_view(fake_dht, target_hash, [&](gsl::span<gsl::byte const> contents, hash const& next_hash)
+	{
+		viewed_cb_called = true;
+		EXPECT_EQ(next_hash, test_hash);
+		EXPECT_TRUE(std::equal(test_msg_span.begin(), test_msg_span.end(), contents.begin(), contents.end()));
+		// the contents weren't copied out of the DHT's buffer
+		auto const data = reinterpret_cast<char const*>(contents.data());
+		EXPECT_TRUE(data > fake_dht.immutableData.data()
+			&& data < fake_dht.immutableData.data() + fake_dht.immutableData.size());
+	});
+	EXPECT_TRUE(viewed_cb_called);
+}
+
 TEST(scout_api, synchronize)
 {
 	// initialize fake dht:
@@ -156,12 +188,7 @@ TEST(scout_api, synchronize)
 	entries_modified[0].update_contents(modified_entry_content);
 	// format the entries into a dht blob and feed it into the fake dht in order 
 	// to simulate updated entries for the put data callback:
-	std::vector<char> buffer(1000);
-	serialize(entries_modified, gsl::as_writeable_bytes(gsl::as_span(buffer)));
-	buffer = encrypt_buffer(buffer, shared_key);
-	std::string prefix = std::to_string(buffer.size()) + ":";
-	buffer.insert(buffer.begin(), prefix.begin(), prefix.end());
-	fake_dht.putDataCallbackBuffer = buffer;
+	fake_dht.putDataCallbackBuffer = entries_blob(entries_modified, shared_key);
 
 	entry_updated entry_cb = [&](entry const& e) {
 		entry_cb_called = true;
@@ -230,3 +257,207 @@ TEST(scout_api, synchronize)
 	EXPECT_TRUE(finalize_cb_called);
 	EXPECT_TRUE(finished_cb_called);
 }
+
+TEST(scout_api, synchronize_batched)
+{
+	FakeDhtImpl fake_dht = FakeDhtImpl();
+	init(fake_dht);
+
+	std::array<char, 10> const test_content[]
+	{ { 0, 1, 2, 3, 4, 5, 6, 7 , 8, 9 },
+	{ 10, 11, 12, 13, 14, 15, 16, 17 , 18, 19 },
+	{ 20, 21, 22, 23, 24, 25, 26, 27 , 28, 29 } };
+
+	std::vector<entry> entries;
+	for (int i = 0; i < 3; ++i)
+	{
+		entries.emplace_back(i);
+		entries.back().assign(gsl::as_span(test_content[i]));
+	}
+
+	secret_key shared_key = key_exchange(generate_keypair().first, generate_keypair().second);
+
+	// the DHT has one new and one updated entry
+	std::vector<entry> entries_modified = entries;
+	entries_modified.emplace_back(7);
+	entries_modified.back().assign(gsl::as_span(test_content[0]));
+	entries_modified[1].update_seq(entries_modified[1].seq() + 1);
+	fake_dht.putDataCallbackBuffer = entries_blob(entries_modified, shared_key);
+
+	int batches = 0;
+	std::vector<std::uint32_t> updated_ids;
+	bool finalize_cb_called = false;
+	bool finished_cb_called = false;
+
+	entries_updated entries_cb = [&](gsl::span<entry const> updated)
+	{
+		++batches;
+		EXPECT_FALSE(finalize_cb_called);
+		for (entry const& e : updated) updated_ids.push_back(e.id());
+	};
+
+	synchronize(fake_dht, shared_key, entries, entries_cb
+		, [&](std::vector<entry>& final_entries)
+		{
+			finalize_cb_called = true;
+			EXPECT_EQ(4, final_entries.size());
+		}
+		, [&] { finished_cb_called = true; });
+
+	EXPECT_EQ(1, batches);
+	EXPECT_EQ((std::vector<std::uint32_t>{ 1, 7 }), updated_ids);
+	EXPECT_TRUE(finalize_cb_called);
+	EXPECT_TRUE(finished_cb_called);
+}
+
+TEST(scout_api, cancel_get)
+{
+	deferred_dht dht;
+	init(dht);
+	hash target;
+	target.fill(b(1));
+
+	int called = 0;
+	op_handle h = get(dht, target, [&](std::vector<gsl::byte> contents, hash const&)
+	{
+		++called;
+		EXPECT_TRUE(contents.empty());
+	});
+	ASSERT_EQ(1, dht.gets.size());
+	EXPECT_EQ(op_status::pending, h.status());
+
+	h.cancel();
+	EXPECT_EQ(1, called);
+	EXPECT_EQ(op_status::cancelled, h.status());
+
+	// a late response is ignored and frees what's left of the operation
+	dht.answer_get(0, std::vector<char>{ '1', ':', 'x' });
+	EXPECT_EQ(1, called);
+
+	// cancelling again does nothing
+	h.cancel();
+	EXPECT_EQ(op_status::cancelled, h.status());
+}
+
+TEST(scout_api, cancel_before_start)
+{
+	deferred_dht dht;
+	init(dht);
+	hash target;
+	target.fill(b(1));
+
+	op_handle h;
+	h.cancel();
+	int called = 0;
+	get(dht, target, [&](std::vector<gsl::byte> contents, hash const&) { ++called; }, nullptr, h);
+	EXPECT_EQ(1, called);
+	// the DHT was never asked
+	EXPECT_TRUE(dht.gets.empty());
+}
+
+namespace
+{
+	struct event_counter : op_observer
+	{
+		void phase_begin(op_phase) override {}
+		void phase_end(op_phase) override {}
+		void event(char const* name) override { ++events[name]; }
+		std::map<std::string, int> events;
+	};
+}
+
+TEST(scout_api, synchronize_skips_redundant_responses)
+{
+	deferred_dht dht;
+	init(dht);
+	secret_key shared_key;
+	shared_key.fill(b(3));
+	std::array<char, 3> const content = { 1, 2, 3 };
+
+	std::vector<entry> v1;
+	v1.emplace_back(1);
+	v1.back().assign(gsl::as_span(content));
+	std::vector<entry> v2 = v1;
+	v2.emplace_back(2);
+	v2.back().assign(gsl::as_span(content));
+
+	event_counter observer;
+	std::vector<std::uint32_t> updated;
+	synchronize(dht, shared_key, std::vector<entry>()
+		, [&](entry const& e) { updated.push_back(e.id()); }
+		, [](std::vector<entry>&) {}
+		, [] {}, &observer);
+	ASSERT_EQ(1, dht.stores.size());
+	deferred_dht::store_request const store = dht.stores[0];
+
+	SockAddr src;
+	std::vector<char> const blob2 = entries_blob(v2, shared_key);
+	store.data_callback(store.ctx, blob2, 2, src);
+	// the same blob again
+	store.data_callback(store.ctx, blob2, 2, src);
+	// an older version
+	store.data_callback(store.ctx, entries_blob(v1, shared_key), 1, src);
+	// the same version, encrypted with a different nonce
+	store.data_callback(store.ctx, entries_blob(v2, shared_key), 2, src);
+
+	EXPECT_EQ(4, observer.events["response"]);
+	EXPECT_EQ(2, observer.events["response_skipped"]);
+	EXPECT_EQ((std::vector<std::uint32_t>{ 1, 2 }), updated);
+
+	int64 seq = 0;
+	std::vector<char> buffer;
+	EXPECT_EQ(0, store.put_callback(store.ctx, buffer, seq, src));
+	store.completed_callback(store.ctx);
+}
+
+TEST(scout_api, cancel_synchronize)
+{
+	deferred_dht dht;
+	init(dht);
+	secret_key shared_key;
+	shared_key.fill(b(3));
+	std::vector<entry> entries;
+	entries.emplace_back(1);
+
+	int updated = 0;
+	int finalized = 0;
+	int finished = 0;
+	op_handle h = synchronize(dht, shared_key, entries
+		, [&](entry const&) { ++updated; }
+		, [&](std::vector<entry>&) { ++finalized; }
+		, [&] { ++finished; });
+	ASSERT_EQ(1, dht.stores.size());
+	deferred_dht::store_request const store = dht.stores[0];
+
+	h.cancel();
+	EXPECT_EQ(1, finished);
+	EXPECT_EQ(op_status::cancelled, h.status());
+
+	// the DHT carries on with the lookup, but nothing reaches the application
+	// and the store is aborted
+	std::vector<char> buffer;
+	SockAddr src;
+	store.data_callback(store.ctx, buffer, 0, src);
+	int64 seq = 0;
+	EXPECT_NE(0, store.put_callback(store.ctx, buffer, seq, src));
+	store.completed_callback(store.ctx);
+	EXPECT_EQ(0, updated);
+	EXPECT_EQ(0, finalized);
+	EXPECT_EQ(1, finished);
+}
+
+TEST(scout_api, handle_status)
+{
+	FakeDhtImpl fake_dht;
+	init(fake_dht);
+	hash target;
+	target.fill(b(1));
+
+	// the handle passed in can be checked from the callback
+	op_handle h;
+	get(fake_dht, target, [&](std::vector<gsl::byte> contents, hash const&)
+	{
+		EXPECT_EQ(op_status::not_found, h.status());
+	}, nullptr, h);
+	EXPECT_EQ(op_status::not_found, h.status());
+}
@@ -22,6 +22,15 @@ limitations under the License.
 using namespace scout;
 using b = gsl::byte;
 
+// the byte layouts the tests below expect
+static_assert(entry_header_fields[0].offset == 0 && entry_header_fields[0].size == 8, "entry seq");
+static_assert(entry_header_fields[1].offset == 8 && entry_header_fields[1].size == 4, "entry id");
+static_assert(entry_header_fields[2].offset == 12 && entry_header_fields[2].size == 2, "entry reserved");
+static_assert(entry_header_fields[3].offset == 14, "entry content length");
+static_assert(entry_header_fields[4].offset == 15, "entry content offset");
+static_assert(entries_header_fields[1].offset == 1, "entries offset");
+static_assert(dht_msg_header_fields[1].offset == 20 && dht_msg_header_fields[2].offset == 22, "dht msg header");
+
 TEST(serialization, entry)
 {
 	std::array<char, 10> const test_content
@@ -45,6 +54,29 @@ TEST(serialization, entry)
 	EXPECT_EQ(0, parsed.second.size_bytes());
 }
 
+TEST(serialization, entry_max_contents)
+{
+	std::vector<gsl::byte> test_content(entry::max_contents, b(0x5a));
+	entry e(7);
+	e.assign(gsl::as_span(test_content));
+	EXPECT_EQ(entry::max_contents, e.value().size());
+
+	std::array<gsl::byte, 1000> output_buffer;
+	auto remaining = e.serialize(output_buffer);
+	auto serialized = gsl::as_span(output_buffer.data(), output_buffer.size() - remaining.size());
+	auto parsed = entry::parse(serialized);
+	EXPECT_EQ(e, parsed.first);
+
+	// a copy is equal, and independent of the original
+	entry copy = e;
+	EXPECT_EQ(e, copy);
+	std::array<char, 3> const shorter = { 1, 2, 3 };
+	copy.update_contents(gsl::as_bytes(gsl::as_span(shorter)));
+	EXPECT_EQ(3, copy.value().size());
+	EXPECT_EQ(entry::max_contents, e.value().size());
+	EXPECT_FALSE(e == copy);
+}
+
 TEST(serialization, list_token)
 {
 	hash const test_hash
@@ -106,6 +138,96 @@ TEST(serialization, entries)
 	EXPECT_EQ(test_vector, parsed_vector);
 }
 
+TEST(serialization, entry_malformed)
+{
+	std::array<char, 10> const test_content
+		{ 0, 1, 2, 3, 4, 5, 6, 7 , 8, 9 };
+	entry e(111);
+	e.assign(gsl::as_span(test_content));
+	std::array<gsl::byte, 1000> output_buffer;
+	auto remaining = e.serialize(output_buffer);
+	auto const serialized = gsl::as_span(output_buffer.data(), output_buffer.size() - remaining.size());
+
+	// too short for the header
+	entry parsed(0);
+	gsl::span<gsl::byte const> input = serialized.first(sizeof(entry_header) - 1);
+	EXPECT_EQ(parse_error::truncated, entry::try_parse(input, parsed));
+	EXPECT_EQ(std::ptrdiff_t(sizeof(entry_header) - 1), input.size());
+	EXPECT_THROW(entry::parse(serialized.first(sizeof(entry_header) - 1)), std::length_error);
+
+	// the header claims more content than there is
+	input = serialized.first(serialized.size() - 1);
+	EXPECT_EQ(parse_error::bad_length, entry::try_parse(input, parsed));
+	EXPECT_EQ(serialized.size() - 1, input.size());
+	EXPECT_EQ(0, parsed.id());
+	EXPECT_THROW(entry::parse(serialized.first(serialized.size() - 1)), std::length_error);
+
+	input = serialized;
+	EXPECT_EQ(parse_error::none, entry::try_parse(input, parsed));
+	EXPECT_EQ(e, parsed);
+	EXPECT_EQ(0, input.size());
+}
+
+TEST(serialization, entries_malformed)
+{
+	std::array<char, 10> const test_content
+		{ 0, 1, 2, 3, 4, 5, 6, 7 , 8, 9 };
+	std::vector<entry> test_vector;
+	for (int i = 0; i < 3; ++i)
+	{
+		test_vector.emplace_back(i);
+		test_vector.back().assign(gsl::as_span(test_content));
+	}
+	std::array<gsl::byte, 1000> output_buffer;
+	auto remaining = serialize(test_vector, output_buffer);
+	auto const serialized = gsl::as_span(output_buffer.data(), output_buffer.size() - remaining.size());
+
+	// the last entry is cut short, the entries before it aren't kept
+	std::vector<entry> parsed_vector(1, entry(42));
+	gsl::span<gsl::byte const> input = serialized.first(serialized.size() - 1);
+	EXPECT_EQ(parse_error::bad_length, try_parse(input, parsed_vector));
+	EXPECT_EQ(serialized.size() - 1, input.size());
+	ASSERT_EQ(1, parsed_vector.size());
+	EXPECT_EQ(42, parsed_vector[0].id());
+	EXPECT_THROW(parse(serialized.first(serialized.size() - 1), parsed_vector), std::length_error);
+
+	input = serialized.first(sizeof(entries_header) - 1);
+	EXPECT_EQ(parse_error::truncated, try_parse(input, parsed_vector));
+	EXPECT_EQ(1, parsed_vector.size());
+}
+
+TEST(serialization, list_malformed)
+{
+	hash const test_hash
+		{ b(0), b(1), b(2), b(3), b(4), b(5), b(6), b(7), b(8), b(9)
+		, b(10), b(11), b(12), b(13), b(14), b(15), b(16), b(17), b(18), b(19) };
+	chash_span test_hash_span = gsl::as_span(test_hash);
+
+	// one byte short of a hash, nothing is consumed or changed
+	list_token token;
+	gsl::span<gsl::byte const> input = test_hash_span.first(test_hash.size() - 1);
+	EXPECT_EQ(parse_error::truncated, list_token::try_parse(input, token));
+	EXPECT_EQ(std::ptrdiff_t(test_hash.size() - 1), input.size());
+	EXPECT_EQ(list_token(), token);
+	EXPECT_THROW(list_token::parse(test_hash_span.first(test_hash.size() - 1)), std::length_error);
+
+	list_head head;
+	input = test_hash_span.first(0);
+	EXPECT_EQ(parse_error::truncated, list_head::try_parse(input, head));
+	EXPECT_EQ(list_head(), head);
+	EXPECT_THROW(list_head::parse(test_hash_span.first(0)), std::length_error);
+
+	input = test_hash_span;
+	EXPECT_EQ(parse_error::none, list_token::try_parse(input, token));
+	EXPECT_EQ(test_hash, token.next());
+	EXPECT_EQ(0, input.size());
+
+	input = test_hash_span;
+	EXPECT_EQ(parse_error::none, list_head::try_parse(input, head));
+	EXPECT_EQ(test_hash, head.head());
+	EXPECT_EQ(0, input.size());
+}
+
 TEST(serialization, msg_dht_blob)
 {
 
@@ -128,4 +250,33 @@ TEST(serialization, msg_dht_blob)
 	EXPECT_EQ(test_hash, parsed_hash);
 	// check that the parsed message matches:
 	EXPECT_TRUE(std::equal(test_msg_span.begin(), test_msg_span.end(), parsed_msg.begin()));
-}
\ No newline at end of file
+}
+
+TEST(serialization, msg_dht_blob_malformed)
+{
+	hash const test_hash = { b(0), b(1), b(2), b(3), b(4), b(5), b(6), b(7), b(8), b(9),
+		b(10), b(11), b(12), b(13), b(14), b(15), b(16), b(17), b(18), b(19) };
+	std::string test_msg = "ta mere suce des schtroumpfs";
+	auto test_msg_span = gsl::as_bytes(gsl::as_span(test_msg.c_str(), test_msg.size()));
+	auto const dht_blob = message_dht_blob_write(test_msg_span, gsl::as_span(test_hash));
+	auto const blob_span = gsl::as_bytes(gsl::as_span(dht_blob));
+
+	hash parsed_hash;
+	gsl::span<gsl::byte const> msg;
+	// too short for the header
+	auto const truncated = blob_span.first(sizeof(dht_msg_header) - 1);
+	EXPECT_EQ(parse_error::truncated, message_dht_blob_parse(truncated, parsed_hash, msg));
+	EXPECT_EQ(0, message_dht_blob_view(truncated, parsed_hash).size());
+	EXPECT_THROW(message_dht_blob_read(truncated, parsed_hash), std::length_error);
+
+	// the message is cut short
+	auto const short_msg = blob_span.first(blob_span.size() - 1);
+	EXPECT_EQ(parse_error::bad_length, message_dht_blob_parse(short_msg, parsed_hash, msg));
+	EXPECT_EQ(0, msg.size());
+	EXPECT_EQ(0, message_dht_blob_view(short_msg, parsed_hash).size());
+	EXPECT_TRUE(message_dht_blob_read(short_msg, parsed_hash).empty());
+
+	EXPECT_EQ(parse_error::none, message_dht_blob_parse(blob_span, parsed_hash, msg));
+	EXPECT_EQ(test_hash, parsed_hash);
+	EXPECT_TRUE(std::equal(test_msg_span.begin(), test_msg_span.end(), msg.begin()));
+}
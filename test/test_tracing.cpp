@@ -0,0 +1,59 @@
+/*
+Copyright 2016 BitTorrent Inc
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <tracing.hpp>
+
+using namespace scout;
+
+TEST(tracing, chrome_trace_writer)
+{
+	char const* filename = "test_tracing.json";
+	{
+		chrome_trace_writer writer(filename);
+		ASSERT_TRUE(writer.is_open());
+		writer.op_begin(7, op_type::synchronize);
+		writer.phase_begin(7, op_type::synchronize, op_phase::lookup);
+		writer.event(7, op_type::synchronize, "response");
+		writer.phase_end(7, op_type::synchronize, op_phase::lookup);
+		writer.op_end(7, op_type::synchronize);
+	}
+
+	std::ifstream f(filename);
+	std::string trace((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	std::remove(filename);
+
+	EXPECT_EQ(0, trace.find("{\"traceEvents\":[\n"));
+	EXPECT_NE(std::string::npos, trace.find(
+		"{\"name\":\"synchronize\",\"cat\":\"synchronize\",\"ph\":\"b\",\"id\":\"0x7\""));
+	EXPECT_NE(std::string::npos, trace.find(
+		"{\"name\":\"lookup\",\"cat\":\"synchronize\",\"ph\":\"e\",\"id\":\"0x7\""));
+	EXPECT_NE(std::string::npos, trace.find(
+		"{\"name\":\"response\",\"cat\":\"synchronize\",\"ph\":\"n\",\"id\":\"0x7\""));
+
+	// one event per line, separated by commas and closed off
+	int separators = 0;
+	for (std::size_t i = trace.find(",\n"); i != std::string::npos; i = trace.find(",\n", i + 1))
+		++separators;
+	EXPECT_EQ(4, separators);
+	ASSERT_GE(trace.size(), 4);
+	EXPECT_EQ("\n]}\n", trace.substr(trace.size() - 4));
+}